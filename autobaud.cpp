@@ -0,0 +1,288 @@
+// autobaud.cpp: Switch the CFE console to a faster baud rate for the dump, and back afterwards.
+//
+// Stock CFE has no command to change the console rate, but a number of vendor builds add
+// one. The help listing is searched for a known one (or baudcmd= gives the template), then
+// for each candidate rate: the host is checked to support it, the command is sent at the
+// old rate, both sides switch, and the link has to echo a random token and read the probe
+// block back unchanged. A failed rate is undone by sending the command for the old rate.
+
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+
+#include "autobaud.h"
+#include "line_parser.h"
+
+struct baud_command_name
+{
+	const char* name;		// As listed by 'help'.
+	const char* command;	// Template, AUTOBAUD_RATE_FIELD is replaced by the rate.
+};
+
+// Rate changing commands found in vendor CFE builds. Others can be given with baudcmd=.
+static const baud_command_name AUTOBAUD_COMMANDS[] =
+{
+	{ "baud", "baud %u" },
+	{ "setbaud", "setbaud %u" }
+};
+
+static void autobaud_sleep(uint32_t ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static std::string autobaud_command_for(baud_session* session, uint32_t baud)
+{
+	std::string command = session->baud_command;
+	size_t field = command.find(AUTOBAUD_RATE_FIELD);
+
+	if(field != std::string::npos)
+	{
+		command.replace(field, AUTOBAUD_RATE_FIELD.length(), std::to_string(baud));
+	}
+
+	return command;
+}
+
+// Read the probe block, returns the number of bytes recovered.
+static uint32_t autobaud_read_probe(baud_session* session, uint8_t* target)
+{
+	std::vector<std::string> lines;
+	std::string command = FDUMP_CMD + " -offset=" + std::to_string(session->probe_offset)
+		+ " -size=" + std::to_string(AUTOBAUD_PROBE_SIZE) + " " + session->device_name;
+
+	if(!rx_command(session->rx, command, &lines))
+	{
+		return 0;
+	}
+
+	uint32_t total = 0;
+
+	for(const std::string& line : lines)
+	{
+		uint32_t byte_count = 0;
+		uint32_t address = 0;
+
+		if(total + BYTES_PER_LINE > AUTOBAUD_PROBE_SIZE)
+		{
+			break;
+		}
+
+		if(scan_fdump_line(line.c_str(), (uint32_t)line.length(), target + total, BYTES_PER_LINE,
+			&byte_count, &address, nullptr) == LK_DATA)
+		{
+			total += byte_count;
+		}
+	}
+
+	return total;
+}
+
+// Both directions work at the current rate: a random token comes back in the echo,
+// and the probe block reads back the same as it did at the base rate.
+static bool autobaud_test_link(baud_session* session)
+{
+	static std::mt19937 rng((uint32_t)std::chrono::steady_clock::now().time_since_epoch().count());
+
+	char token[32];
+	snprintf(token, sizeof(token), "fdump_probe_%08x", (uint32_t)rng());
+
+	std::vector<std::string> lines;
+
+	// Unknown to CFE, so the reply is just the echo and an error. Only returns true once the echo is seen.
+	if(!rx_command(session->rx, token, &lines))
+	{
+		return false;
+	}
+
+	uint8_t probe[AUTOBAUD_PROBE_SIZE];
+	uint32_t probe_len = autobaud_read_probe(session, probe);
+
+	return probe_len == session->reference_len && memcmp(probe, session->reference, probe_len) == 0;
+}
+
+static bool autobaud_set_host(baud_session* session, uint32_t baud)
+{
+	// uart_config() reports every setting when verbose, which is noise here.
+	bool verbose = session->verbose;
+	uart_set_verbosity(session->uart_device, false);
+	uart_set_baud(session->uart_device, baud);
+
+	bool ok = uart_config(session->uart_device);
+
+	uart_set_verbosity(session->uart_device, verbose);
+
+	return ok;
+}
+
+// Tell the console to change rate, then follow it.
+static bool autobaud_change(baud_session* session, uint32_t baud)
+{
+	// Ctrl-c first clears anything half typed at the wrong rate off the console's line.
+	std::string command = AUTOBAUD_CLEAR_LINE + autobaud_command_for(session, baud) + "\r";
+
+	rx_drain(session->rx);
+
+	uart_write(session->uart_device, (void*)command.c_str(), command.length());
+	uart_drain(session->uart_device);
+
+	// The echo and maybe a status line arrive around the switch, neither can be trusted.
+	autobaud_sleep(AUTOBAUD_SETTLE_MS);
+
+	if(!autobaud_set_host(session, baud))
+	{
+		return false;
+	}
+
+	session->current_baud = baud;
+
+	autobaud_sleep(AUTOBAUD_SETTLE_MS);
+	rx_drain(session->rx);
+
+	return true;
+}
+
+void autobaud_init(baud_session* session, uart_dev* uart_device, rx_buffer* rx, const std::string& device_name,
+	uint32_t probe_offset, const std::string& baud_command, bool verbose)
+{
+	session->uart_device = uart_device;
+	session->rx = rx;
+	session->device_name = device_name;
+	session->probe_offset = probe_offset;
+	session->baud_command = baud_command;
+	session->base_baud = uart_device->baud;
+	session->current_baud = uart_device->baud;
+	session->reference_len = 0;
+	session->verbose = verbose;
+}
+
+bool autobaud_probe(baud_session* session)
+{
+	if(session->baud_command.empty())
+	{
+		std::vector<std::string> lines;
+
+		if(!rx_command(session->rx, AUTOBAUD_HELP_CMD, &lines))
+		{
+			std::cout << "Autobaud: no reply to help, staying at " << session->base_baud << " baud." << std::endl;
+			return false;
+		}
+
+		// Commands are listed one per line, the name first.
+		for(const std::string& line : lines)
+		{
+			std::string name = line.substr(0, line.find_first_of(WHITESPACE));
+
+			for(const baud_command_name& known : AUTOBAUD_COMMANDS)
+			{
+				if(name == known.name)
+				{
+					session->baud_command = known.command;
+				}
+			}
+		}
+
+		if(session->baud_command.empty())
+		{
+			std::cout << "Autobaud: CFE has no known baud command (try baudcmd=), staying at "
+				<< session->base_baud << " baud." << std::endl;
+			return false;
+		}
+	}
+
+	session->reference_len = autobaud_read_probe(session, session->reference);
+
+	if(session->reference_len == 0)
+	{
+		std::cout << "Autobaud: could not read the probe block from " << session->device_name
+			<< ", staying at " << session->base_baud << " baud." << std::endl;
+		return false;
+	}
+
+	if(session->verbose)
+	{
+		std::cout << "Autobaud: using '" << session->baud_command << "', probe block is "
+			<< session->reference_len << " bytes." << std::endl;
+	}
+
+	return true;
+}
+
+uint32_t autobaud_switch(baud_session* session, uint32_t max_baud)
+{
+	for(uint32_t baud : AUTOBAUD_RATES)
+	{
+		if(baud > max_baud || baud <= session->base_baud)
+		{
+			continue;
+		}
+
+		// Don't ask the console for a rate the host can't follow.
+		bool host_ok = autobaud_set_host(session, baud);
+		autobaud_set_host(session, session->base_baud);
+
+		if(!host_ok)
+		{
+			if(session->verbose)
+			{
+				std::cout << "Autobaud: " << baud << " not supported by the host." << std::endl;
+			}
+			continue;
+		}
+
+		if(autobaud_change(session, baud) && autobaud_test_link(session))
+		{
+			std::cout << "Autobaud: switched to " << baud << " baud." << std::endl;
+			return baud;
+		}
+
+		if(session->verbose)
+		{
+			std::cout << "Autobaud: " << baud << " failed the link test." << std::endl;
+		}
+
+		if(!autobaud_restore(session))
+		{
+			// Stuck, the dump would only read garbage.
+			return 0;
+		}
+	}
+
+	std::cout << "Autobaud: no faster rate worked, staying at " << session->base_baud << " baud." << std::endl;
+
+	return session->base_baud;
+}
+
+bool autobaud_restore(baud_session* session)
+{
+	if(session->current_baud == session->base_baud)
+	{
+		return true;
+	}
+
+	uint32_t fast_baud = session->current_baud;
+
+	for(uint32_t i = 0; i < AUTOBAUD_RESTORE_TRIES; i++)
+	{
+		if(autobaud_change(session, session->base_baud) && autobaud_test_link(session))
+		{
+			if(session->verbose)
+			{
+				std::cout << "Autobaud: restored " << session->base_baud << " baud." << std::endl;
+			}
+			return true;
+		}
+
+		// A marginal line may have garbled the command, so the console could still be at the fast rate.
+		if(autobaud_set_host(session, fast_baud))
+		{
+			session->current_baud = fast_baud;
+		}
+	}
+
+	std::cout << "Autobaud: could not restore " << session->base_baud << " baud, the console may need a reset." << std::endl;
+
+	return false;
+}
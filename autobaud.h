@@ -0,0 +1,46 @@
+// autobaud.h: Switch the CFE console to a faster baud rate for the dump, and back afterwards.
+// The console always comes up at 115200, so a big flash takes hours unless both sides are
+// moved to a faster rate. Each candidate rate has to pass an echo test and a checksum of a
+// probe block read at both rates before it is used, otherwise the next slower one is tried.
+
+#ifndef AUTOBAUD_H
+#define AUTOBAUD_H
+
+#include <string>
+#include <cstdint>
+
+// Minimal C++ Uart library.
+#include "uart.h"
+#include "serial_rx.h"
+
+const uint32_t AUTOBAUD_PROBE_SIZE = 256; // Bytes of flash read at both rates and compared.
+const uint32_t AUTOBAUD_SETTLE_MS = 100; // Time the console gets to change rate once the command has gone out.
+const uint32_t AUTOBAUD_RESTORE_TRIES = 3; // Times the command for the base rate is sent before giving up on the console.
+const std::string AUTOBAUD_RATE_FIELD = "%u"; // Replaced by the rate in a baud command template.
+const std::string AUTOBAUD_CLEAR_LINE = "\x03"; // Ctrl-c, drops a partly typed command line.
+const std::string AUTOBAUD_HELP_CMD = "help"; // Lists the console commands, searched for a baud command.
+
+// Fastest first, only those above the current rate and at most autobaud= are tried.
+const uint32_t AUTOBAUD_RATES[] = { 4000000, 3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400 };
+
+struct baud_session
+{
+	uart_dev* uart_device;
+	rx_buffer* rx;
+	std::string device_name;	// Flash device the probe block is read from.
+	uint32_t probe_offset;
+	std::string baud_command;	// e.g. "baud %u", empty until found or given.
+	uint32_t base_baud;			// Rate the console came up at, restored at the end.
+	uint32_t current_baud;
+	uint8_t reference[AUTOBAUD_PROBE_SIZE]; // Probe block as read at base_baud.
+	uint32_t reference_len;
+	bool verbose;
+};
+
+void autobaud_init(baud_session* session, uart_dev* uart_device, rx_buffer* rx, const std::string& device_name,
+	uint32_t probe_offset, const std::string& baud_command, bool verbose);
+bool autobaud_probe(baud_session* session);
+uint32_t autobaud_switch(baud_session* session, uint32_t max_baud);
+bool autobaud_restore(baud_session* session);
+
+#endif
@@ -0,0 +1,676 @@
+// batch.cpp: Dumps from several routers at once, one port each, driven from one event loop.
+//
+// Every port gets its own dump_session, uart device and receive ring, so nothing is shared
+// between them but the loop. The loop sleeps in epoll_wait() (poll() on the BSDs) until a
+// port has data or a deadline comes up, reads each ready port without waiting, and feeds
+// the lines to its session. While a port is streaming it is left out of the wait for about
+// the time RX_COALESCE_BYTES take to arrive, the same coalescing rx_fill() does by sleeping,
+// so every wakeup picks up a burst from each port and the CPU use stays flat as ports are added.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include "batch.h"
+
+#ifdef POSIX
+
+#ifdef LINUX
+	#include <sys/epoll.h>
+#else
+	#include <poll.h>
+#endif
+#include <sys/resource.h>
+
+static bool batch_parse_number(const std::string& value, uint64_t* number)
+{
+	char* end = nullptr;
+
+	*number = strtoull(value.c_str(), &end, 0);
+
+	return !value.empty() && end != nullptr && *end == '\0';
+}
+
+// One job line, key=value pairs on top of the defaults.
+static bool batch_parse_job(const std::string& line, batch_job* job, std::string* error)
+{
+	std::istringstream tokens(line);
+	std::string token;
+	bool got_if = false;
+	bool got_size = false;
+
+	while(tokens >> token)
+	{
+		size_t equals = token.find('=');
+
+		if(equals == std::string::npos)
+		{
+			*error = "expected key=value, got " + token;
+			return false;
+		}
+
+		std::string key = token.substr(0, equals);
+		std::string value = token.substr(equals + 1);
+		uint64_t number = 0;
+		bool is_number = batch_parse_number(value, &number);
+
+		if(key == "tty")
+		{
+			job->tty = value;
+		}
+		else if(key == "if")
+		{
+			job->settings.device_name = value;
+			got_if = true;
+		}
+		else if(key == "of")
+		{
+			job->settings.of_name = value;
+
+			if(compress_type_for_name(value) != COMPRESS_NONE)
+			{
+				job->settings.compress = compress_type_for_name(value);
+			}
+		}
+		else if(key == "bs" && value == BLOCK_SIZE_AUTO)
+		{
+			job->settings.block_size = TUNER_MAX_SIZE;
+			job->settings.block_size_auto = true;
+		}
+		else if(key == "hash")
+		{
+			if(!digest_parse_types(value, &job->settings.digests))
+			{
+				*error = "hash= takes crc32, sha256, xxh64 or all, got " + value;
+				return false;
+			}
+		}
+		else if(key == "verify")
+		{
+			if(!session_parse_verify(value, &job->settings.read_twice, &job->settings.verify_type, &job->settings.verify_hex))
+			{
+				*error = "verify= takes twice, a digest name and its hex like sha256:<64 hex digits>, or both, got " + value;
+				return false;
+			}
+		}
+		else if(!is_number)
+		{
+			*error = "not a number or unknown key: " + token;
+			return false;
+		}
+		else if(key == "offset" || key == "skip")
+		{
+			job->settings.offset = number;
+		}
+		else if(key == "size" || key == "count")
+		{
+			job->settings.size = number;
+			got_size = true;
+		}
+		else if(key == "bs")
+		{
+			job->settings.block_size = (uint32_t)number;
+			job->settings.block_size_auto = false;
+		}
+		else if(key == "baud")
+		{
+			job->baud = (uint32_t)number;
+		}
+		else if(key == "pipeline")
+		{
+			job->settings.pipeline_depth = (uint32_t)number;
+		}
+		else if(key == "retries")
+		{
+			job->settings.retries = (uint32_t)number;
+		}
+		else if(key == "timeout")
+		{
+			job->settings.idle_timeout_ms = (uint32_t)number;
+		}
+		else
+		{
+			*error = "unknown key " + key;
+			return false;
+		}
+	}
+
+	if(job->tty.empty() || !got_if || !got_size)
+	{
+		*error = "needs at least tty=, if= and size=";
+		return false;
+	}
+
+	if(job->settings.block_size == 0)
+	{
+		*error = "needs bs=, here or on the command line";
+		return false;
+	}
+
+	if(job->baud == 0)
+	{
+		*error = "baud= must be a rate above 0";
+		return false;
+	}
+
+	if(job->settings.pipeline_depth > PIPELINE_MAX_DEPTH)
+	{
+		*error = "pipeline= can type ahead at most " + std::to_string(PIPELINE_MAX_DEPTH) + " commands";
+		return false;
+	}
+
+	// The expected digest has to be worked out.
+	job->settings.digests |= job->settings.verify_type;
+	job->settings.name = job->tty;
+
+	return true;
+}
+
+bool batch_load(const std::string& file_name, const batch_job& defaults, std::vector<batch_job*>* jobs)
+{
+	std::ifstream file(file_name);
+
+	if(!file.is_open())
+	{
+		std::cout << "Opening job file " << file_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	std::string line;
+	uint32_t line_number = 0;
+
+	while(std::getline(file, line))
+	{
+		line_number++;
+
+		// Comments.
+		size_t hash = line.find('#');
+
+		if(hash != std::string::npos)
+		{
+			line.erase(hash);
+		}
+
+		if(line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+
+		batch_job* job = new batch_job(defaults);
+		std::string error;
+
+		if(!batch_parse_job(line, job, &error))
+		{
+			std::cout << file_name << ":" << line_number << ": " << error << std::endl;
+			delete job;
+			return false;
+		}
+
+		for(batch_job* other : *jobs)
+		{
+			if(other->tty == job->tty)
+			{
+				std::cout << file_name << ":" << line_number << ": " << job->tty << " is already used by another job" << std::endl;
+				delete job;
+				return false;
+			}
+
+			// Two jobs writing one image, or one's journal, would overwrite each other.
+			const std::string& of_name = job->settings.of_name;
+			const std::string& other_of = other->settings.of_name;
+
+			if(!of_name.empty() && !other_of.empty() && (of_name == other_of
+				|| of_name == other_of + JOURNAL_EXT || of_name + JOURNAL_EXT == other_of))
+			{
+				std::cout << file_name << ":" << line_number << ": " << of_name << " is already written by the job for "
+					<< other->tty << ", give each job its own of=" << std::endl;
+				delete job;
+				return false;
+			}
+		}
+
+		jobs->push_back(job);
+	}
+
+	if(jobs->empty())
+	{
+		std::cout << "No jobs in " << file_name << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool batch_open_job(batch_job* job)
+{
+	job->started = std::chrono::steady_clock::now();
+
+	uart_init(&job->uart_device);
+	uart_set_baud(job->uart_device, job->baud);
+	uart_set_flowctrl(job->uart_device, job->flow_control);
+	uart_set_parity(job->uart_device, job->parity, job->parity_mode);
+	uart_set_stopbits(job->uart_device, job->stop_bits);
+	uart_set_databits(job->uart_device, job->data_bits);
+	uart_set_verbosity(job->uart_device, job->settings.very_verbose);
+
+	// The loop waits on the tty, uart_read() must not.
+	uart_set_read_timeout(job->uart_device, 0);
+
+	rx_init(&job->rx, job->uart_device, RX_BUFFER_SIZE);
+	session_init(&job->session, job->settings, job->uart_device, job->rx);
+
+	if(!uart_open(job->uart_device, job->tty) || !uart_config(job->uart_device))
+	{
+		std::cout << job->tty << ": Opening the tty failed." << std::endl;
+		return false;
+	}
+
+	if(!session_open(job->session))
+	{
+		return false;
+	}
+
+	job->active = true;
+	job->armed = true;
+
+	return true;
+}
+
+// The ports being waited on, epoll on Linux and poll() elsewhere.
+struct batch_loop
+{
+#ifdef LINUX
+	int epoll_fd;
+#else
+	std::vector<batch_job*> jobs;	// All of them, the armed ones are polled.
+	std::vector<struct pollfd> fds;
+	std::vector<batch_job*> fd_jobs;
+#endif
+};
+
+static bool batch_loop_init(batch_loop* loop, std::vector<batch_job*>& jobs)
+{
+#ifdef LINUX
+	loop->epoll_fd = epoll_create1(0);
+
+	if(loop->epoll_fd < 0)
+	{
+		std::cout << "epoll_create1 failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	for(batch_job* job : jobs)
+	{
+		if(job->active)
+		{
+			struct epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.ptr = job;
+
+			if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, job->uart_device->serial_port, &event) != 0)
+			{
+				std::cout << job->tty << ": epoll_ctl failed: " << strerror(errno) << std::endl;
+				return false;
+			}
+		}
+	}
+#else
+	loop->jobs = jobs;
+#endif
+
+	return true;
+}
+
+// Arms or disarms a port, a port that is done is left out for good.
+static void batch_loop_watch(batch_loop* loop, batch_job* job, bool armed)
+{
+	job->armed = armed;
+
+#ifdef LINUX
+	if(!job->active)
+	{
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, job->uart_device->serial_port, nullptr);
+		return;
+	}
+
+	struct epoll_event event = {};
+	event.events = armed ? (uint32_t)EPOLLIN : 0;
+	event.data.ptr = job;
+
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, job->uart_device->serial_port, &event);
+#endif
+}
+
+// Waits up to timeout_ms for armed ports to have data. ready gets the ports to read,
+// hung_up those whose tty went away.
+static void batch_loop_wait(batch_loop* loop, int timeout_ms,
+	std::vector<batch_job*>* ready, std::vector<batch_job*>* hung_up)
+{
+	ready->clear();
+	hung_up->clear();
+
+#ifdef LINUX
+	struct epoll_event events[BATCH_MAX_EVENTS];
+	int count = epoll_wait(loop->epoll_fd, events, BATCH_MAX_EVENTS, timeout_ms);
+
+	for(int i = 0; i < count; i++)
+	{
+		batch_job* job = (batch_job*)events[i].data.ptr;
+
+		if(events[i].events & (EPOLLHUP | EPOLLERR))
+		{
+			hung_up->push_back(job);
+		}
+		else if(events[i].events & EPOLLIN)
+		{
+			ready->push_back(job);
+		}
+	}
+#else
+	loop->fds.clear();
+	loop->fd_jobs.clear();
+
+	for(batch_job* job : loop->jobs)
+	{
+		if(job->active && job->armed)
+		{
+			loop->fds.push_back({ job->uart_device->serial_port, POLLIN, 0 });
+			loop->fd_jobs.push_back(job);
+		}
+	}
+
+	if(poll(loop->fds.data(), loop->fds.size(), timeout_ms) <= 0)
+	{
+		return;
+	}
+
+	for(size_t i = 0; i < loop->fds.size(); i++)
+	{
+		if(loop->fds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+		{
+			hung_up->push_back(loop->fd_jobs[i]);
+		}
+		else if(loop->fds[i].revents & POLLIN)
+		{
+			ready->push_back(loop->fd_jobs[i]);
+		}
+	}
+#endif
+}
+
+static void batch_loop_free(batch_loop* loop)
+{
+#ifdef LINUX
+	if(loop->epoll_fd >= 0)
+	{
+		close(loop->epoll_fd);
+	}
+#endif
+}
+
+static void batch_close_job(batch_loop* loop, batch_job* job)
+{
+	job->active = false;
+	job->finished = std::chrono::steady_clock::now();
+
+	// Out of the wait before the tty is closed.
+	batch_loop_watch(loop, job, false);
+
+	if(job->session->incomplete_blocks > 0)
+	{
+		std::cout << job->tty << ": " << job->session->incomplete_blocks << " block(s) still had missing or unconfirmed lines after "
+			<< job->settings.retries << " re-read round(s), run again with resume to fill them." << std::endl;
+		job->failed = true;
+	}
+
+	if(!session_close(job->session))
+	{
+		job->failed = true;
+	}
+
+	uart_close(job->uart_device);
+}
+
+static double batch_seconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+	return std::chrono::duration<double>(to - from).count();
+}
+
+static void batch_print_progress(std::vector<batch_job*>& jobs, std::chrono::steady_clock::time_point started)
+{
+	uint64_t bytes = 0;
+	uint64_t total = 0;
+	uint32_t done = 0;
+
+	for(batch_job* job : jobs)
+	{
+		if(job->session != nullptr)
+		{
+			bytes += job->session->bytes_read - job->session->bytes_done;
+			total += job->session->size - job->session->bytes_done;
+		}
+
+		if(!job->active)
+		{
+			done++;
+		}
+	}
+
+	double seconds = batch_seconds(started, std::chrono::steady_clock::now());
+
+	std::cout << "Batch: " << done << " of " << jobs.size() << " ports done, " << bytes << " of " << total
+		<< " bytes, " << (uint64_t)(seconds > 0 ? bytes / seconds : 0) << " bytes/s" << std::endl;
+}
+
+static void batch_print_summary(std::vector<batch_job*>& jobs, std::chrono::steady_clock::time_point started)
+{
+	double wall = batch_seconds(started, std::chrono::steady_clock::now());
+	uint64_t bytes = 0;
+	uint32_t failed = 0;
+
+	std::cout << "Port                 Device            Bytes    Seconds    Bytes/s  Result" << std::endl;
+
+	for(batch_job* job : jobs)
+	{
+		uint64_t job_bytes = (job->session != nullptr) ? job->session->bytes_read - job->session->bytes_done : 0;
+		double seconds = (job->session != nullptr) ? batch_seconds(job->started, job->finished) : 0;
+		char row[160];
+
+		snprintf(row, sizeof(row), "%-20s %-12s %10llu %10.1f %10llu  %s", job->tty.c_str(),
+			job->settings.device_name.c_str(), (unsigned long long)job_bytes, seconds,
+			(unsigned long long)(seconds > 0 ? job_bytes / seconds : 0), job->failed ? "FAILED" : "ok");
+		std::cout << row << std::endl;
+
+		bytes += job_bytes;
+		failed += job->failed ? 1 : 0;
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+	std::cout << "Batch: " << jobs.size() - failed << " of " << jobs.size() << " ports ok, " << bytes << " bytes in "
+		<< wall << " s, " << (uint64_t)(wall > 0 ? bytes / wall : 0) << " bytes/s together, CPU time "
+		<< cpu << " s (" << (wall > 0 ? cpu / wall * 100 : 0) << "% of wall)" << std::endl;
+}
+
+// Runs every job to the end, or until keep_running goes false.
+// Returns false if any of them failed.
+bool batch_run(std::vector<batch_job*>& jobs, const bool* keep_running)
+{
+	auto started = std::chrono::steady_clock::now();
+	auto next_progress = started + std::chrono::milliseconds(BATCH_PROGRESS_MS);
+	bool verbose = jobs.front()->settings.verbose;
+	uint32_t active = 0;
+
+	for(batch_job* job : jobs)
+	{
+		if(!batch_open_job(job))
+		{
+			job->failed = true;
+			job->finished = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		std::cout << job->tty << ": Reading device " << job->settings.device_name << std::endl;
+		active++;
+	}
+
+	batch_loop loop;
+
+	if(!batch_loop_init(&loop, jobs))
+	{
+		active = 0;
+	}
+
+	std::vector<batch_job*> ready;
+	std::vector<batch_job*> hung_up;
+
+	while(active > 0 && *keep_running)
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto wake = now + std::chrono::milliseconds(UART_READ_TIMEOUT_MS);
+
+		for(batch_job* job : jobs)
+		{
+			if(!job->active)
+			{
+				continue;
+			}
+
+			if(!job->armed && now >= job->rearm_at)
+			{
+				batch_loop_watch(&loop, job, true);
+			}
+
+			session_check_idle(job->session, now);
+
+			if(!session_send(job->session))
+			{
+				job->failed = true;
+			}
+
+			if(job->failed || session_done(job->session))
+			{
+				batch_close_job(&loop, job);
+				active--;
+				continue;
+			}
+
+			wake = std::min(wake, job->armed ? session_deadline(job->session) : job->rearm_at);
+		}
+
+		if(verbose && now >= next_progress)
+		{
+			batch_print_progress(jobs, started);
+			next_progress = now + std::chrono::milliseconds(BATCH_PROGRESS_MS);
+		}
+
+		if(active == 0)
+		{
+			break;
+		}
+
+		// Round up, waking a little late only lets a bit more build up in the tty.
+		auto wait_us = std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count();
+		int timeout_ms = (wait_us > 0) ? (int)((wait_us + 999) / 1000) : 0;
+
+		batch_loop_wait(&loop, timeout_ms, &ready, &hung_up);
+
+		now = std::chrono::steady_clock::now();
+
+		for(batch_job* job : ready)
+		{
+			uint64_t start = stats_start(&job->session->stats);
+			bool filled = rx_fill_ready(job->rx);
+			stats_add(&job->session->stats, SP_RECEIVE, start);
+
+			if(filled)
+			{
+				session_data_arrived(job->session, now);
+			}
+
+			session_receive(job->session);
+
+			// More is on the way, let it build up before reading the port again.
+			uint32_t coalesce_us = rx_coalesce_us(job->rx);
+
+			if(coalesce_us > 0)
+			{
+				job->rearm_at = now + std::chrono::microseconds(coalesce_us);
+				batch_loop_watch(&loop, job, false);
+			}
+		}
+
+		for(batch_job* job : hung_up)
+		{
+			std::cout << job->tty << ": The tty went away." << std::endl;
+			job->failed = true;
+		}
+	}
+
+	// Interrupted, write out what there is and stop the consoles.
+	for(batch_job* job : jobs)
+	{
+		if(job->active)
+		{
+			if(!session_interrupt(job->session))
+			{
+				job->failed = true;
+			}
+
+			// Write ctrl-c to tty (EXT_CTRL_C is etx - ASCII code 3)
+			const char ctrl_c = '\x03';
+			uart_write(job->uart_device, (void*)&ctrl_c, 1);
+
+			job->failed = true;
+			batch_close_job(&loop, job);
+		}
+	}
+
+	batch_loop_free(&loop);
+	batch_print_summary(jobs, started);
+
+	for(batch_job* job : jobs)
+	{
+		if(job->failed)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#else
+
+bool batch_load(const std::string& file_name, const batch_job& defaults, std::vector<batch_job*>* jobs)
+{
+	std::cout << "batch= is only supported on POSIX systems." << std::endl;
+	return false;
+}
+
+bool batch_run(std::vector<batch_job*>& jobs, const bool* keep_running)
+{
+	return false;
+}
+
+#endif
+
+void batch_free(std::vector<batch_job*>& jobs)
+{
+	// Free allocated memory;
+	for(batch_job* job : jobs)
+	{
+		session_free(job->session);
+		rx_free(job->rx);
+		uart_free(job->uart_device);
+		delete job;
+	}
+
+	jobs.clear();
+}
@@ -0,0 +1,52 @@
+// batch.h: Dumps from several routers at once, one port each, driven from one event loop.
+// The job file has one dump per line with the same key=value arguments as the command line:
+//   tty=/dev/ttyUSB0 if=flash0 offset=0 size=16777216 of=router1.bin
+// Whatever a line leaves out (bs=, baud=, pipeline=, retries=, timeout=, hash=) comes from the
+// command line, verify= only from its own line. Blank lines and anything after a # are ignored.
+// POSIX only.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "uart.h"
+#include "serial_rx.h"
+#include "dump_session.h"
+
+const uint32_t BATCH_PROGRESS_MS = 1000; // Progress line interval with -v.
+const uint32_t BATCH_MAX_EVENTS = 64; // Ready ports taken per epoll_wait().
+
+struct batch_job
+{
+	dump_settings settings;
+	std::string tty;
+
+	// Line settings.
+	uint32_t baud;
+	int32_t flow_control;
+	bool parity;
+	int32_t parity_mode;
+	uint32_t stop_bits;
+	uint32_t data_bits;
+
+	uart_dev* uart_device;
+	rx_buffer* rx;
+	dump_session* session;
+
+	bool active;			// Open and still dumping.
+	bool failed;
+	bool armed;				// Waiting on the tty for data, off while letting a burst build up.
+	std::chrono::steady_clock::time_point rearm_at;
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point finished;
+};
+
+bool batch_load(const std::string& file_name, const batch_job& defaults, std::vector<batch_job*>* jobs);
+bool batch_run(std::vector<batch_job*>& jobs, const bool* keep_running);
+void batch_free(std::vector<batch_job*>& jobs);
+
+#endif
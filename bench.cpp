@@ -0,0 +1,1011 @@
+// bench.cpp: Microbenchmarks for the fdump parser and decode path.
+// Build with 'make bench' and run ./fdump_bench. Results are ns per 16 byte line
+// and MB/s of decoded data, so parser changes can be judged on numbers.
+// Besides the hex kernels, each step a console line goes through in a dump is timed over
+// synthetic CFE transcripts of a few command sizes: splitting the received bytes into lines,
+// scanning them, placing them in their block, and writing and hashing the finished blocks.
+// operator new is replaced with one that counts, and once everything is set up reading,
+// journaling, writing and hashing blocks must not allocate at all, nor listing them with -l.
+// Before any of that, the scanner is checked against the std::regex parser it replaced on a
+// corpus of good, cut short, echoed and garbled lines.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <new>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <algorithm>
+#include <regex>
+
+#include "line_parser.h"
+#include "hex_decode.h"
+#include "dump_session.h"
+
+const uint32_t BENCH_LINES = 65536; // Lines of input generated per benchmark, cycled through on every pass.
+const double BENCH_MIN_SECONDS = 0.25; // Run each benchmark for at least this long.
+
+const uint32_t BENCH_IMAGE_SIZE = 1048576; // Flash image the transcripts are printed from.
+const uint32_t BENCH_REGION_SIZE = 65536; // The image goes random, random, erased, zeros in regions of this.
+const uint32_t BENCH_TRANSCRIPT_SIZES[] = { 4096, 65536, 1048576 }; // -size= of each transcript's fdump command.
+const uint32_t BENCH_READ_SIZE = 4096; // Bytes handed to the line splitter at once, about what a read() of the tty gets.
+const uint32_t BENCH_WRITE_BLOCK = 65536; // Block size the output benchmarks write the image in.
+const std::string BENCH_OUTPUT_NAME = "fdump_bench.tmp"; // Scratch image for the output benchmarks, removed after.
+const uint32_t BENCH_WARMUP_BLOCKS = 2; // Blocks read before allocations are counted, the first writes set up stdio buffers.
+const uint32_t BENCH_COUNTED_BLOCKS = 16; // Blocks read while they are.
+const uint32_t BENCH_CORPUS_LINES = 20000; // Data lines the parser corpus is made from, each also cut short and garbled.
+
+volatile uint32_t bench_sink = 0; // Results are folded in here so the optimizer can't drop the work.
+
+std::atomic<uint64_t> bench_allocations(0); // Calls to operator new, and new[] which goes through it.
+
+typedef void(*BenchFn)(uint32_t index);
+typedef bool(*BenchPassFn)();
+
+void* operator new(size_t size)
+{
+	bench_allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void* p = malloc(size > 0 ? size : 1);
+
+	if(p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+// Not inlined, or gcc sees free() of what it takes for the library's operator new.
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void bench_report(const char* name, double seconds, uint64_t lines)
+{
+	double ns_per_line = seconds * 1e9 / (double)lines;
+	double mb_per_second = (double)lines * BYTES_PER_LINE / seconds / 1e6;
+
+	printf("  %-36s %10.2f ns/line %10.1f MB/s\n", name, ns_per_line, mb_per_second);
+}
+
+void bench_run(const char* name, BenchFn fn)
+{
+	uint64_t lines = 0;
+	double seconds = 0.0;
+	auto start = std::chrono::steady_clock::now();
+
+	do
+	{
+		for(uint32_t i = 0; i < BENCH_LINES; i++)
+		{
+			fn(i);
+		}
+		lines += BENCH_LINES;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while(seconds < BENCH_MIN_SECONDS);
+
+	bench_report(name, seconds, lines);
+}
+
+// Repeats fn, a pass over lines_per_pass lines of input, for at least BENCH_MIN_SECONDS.
+// A pass that returns false has gone wrong, and the benchmark fails.
+bool bench_run_passes(const char* name, BenchPassFn fn, uint64_t lines_per_pass)
+{
+	uint64_t lines = 0;
+	double seconds = 0.0;
+	auto start = std::chrono::steady_clock::now();
+
+	do
+	{
+		if(!fn())
+		{
+			std::cout << "  " << name << " went wrong." << std::endl;
+			return false;
+		}
+		lines += lines_per_pass;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while(seconds < BENCH_MIN_SECONDS);
+
+	bench_report(name, seconds, lines);
+
+	return true;
+}
+
+// Hex payload of each line, zero terminated as hex_to_buffer() expects.
+std::vector<std::string> hex_lines;
+std::vector<std::string> spaced_lines; // The same as CFE prints it, "xx " per byte.
+
+void generate_hex_lines()
+{
+	std::mt19937 rng(0x464c5348);
+	char digit[3];
+
+	hex_lines.resize(BENCH_LINES);
+	spaced_lines.resize(BENCH_LINES);
+
+	for(uint32_t i = 0; i < BENCH_LINES; i++)
+	{
+		std::string& line = hex_lines[i];
+		bool upper = (i & 1) != 0;
+
+		for(uint32_t b = 0; b < BYTES_PER_LINE; b++)
+		{
+			snprintf(digit, sizeof(digit), upper ? "%02X" : "%02x", (unsigned)(rng() & 0xFF));
+			line += digit;
+			spaced_lines[i] += digit;
+			spaced_lines[i] += ' ';
+		}
+	}
+}
+
+void bench_hex_legacy(uint32_t index)
+{
+	char buffer[BYTES_PER_LINE];
+	char printable[BYTES_PER_LINE];
+	const char* src = hex_lines[index].c_str();
+
+	hex_to_buffer(src, buffer);
+	hexbuffer_to_friendlystring(src, printable);
+
+	bench_sink += (uint8_t)buffer[index & 15] + (uint8_t)printable[index & 15];
+}
+
+void bench_hex_kernel(uint32_t index)
+{
+	uint8_t buffer[BYTES_PER_LINE];
+	char printable[BYTES_PER_LINE];
+
+	hex_decode_line(hex_lines[index].c_str(), buffer, printable);
+
+	bench_sink += buffer[index & 15] + (uint8_t)printable[index & 15];
+}
+
+void bench_hex_spaced(uint32_t index)
+{
+	uint8_t buffer[BYTES_PER_LINE];
+	char printable[BYTES_PER_LINE];
+
+	hex_decode_spaced(spaced_lines[index].c_str(), buffer, printable);
+
+	bench_sink += buffer[index & 15] + (uint8_t)printable[index & 15];
+}
+
+bool check_hex_kernel()
+{
+	// Every kernel must agree with the legacy functions before its numbers count.
+	for(uint32_t i = 0; i < BENCH_LINES; i++)
+	{
+		char expected[BYTES_PER_LINE];
+		char expected_printable[BYTES_PER_LINE];
+		uint8_t buffer[BYTES_PER_LINE];
+		char printable[BYTES_PER_LINE];
+
+		hex_to_buffer(hex_lines[i].c_str(), expected);
+		hexbuffer_to_friendlystring(hex_lines[i].c_str(), expected_printable);
+
+		if(!hex_decode_line(hex_lines[i].c_str(), buffer, printable)
+			|| memcmp(expected, buffer, BYTES_PER_LINE) != 0
+			|| memcmp(expected_printable, printable, BYTES_PER_LINE) != 0)
+		{
+			std::cout << "  " << hex_decode_kernel_name() << " decodes line " << i << " differently." << std::endl;
+			return false;
+		}
+
+		if(!hex_decode_spaced(spaced_lines[i].c_str(), buffer, printable)
+			|| memcmp(expected, buffer, BYTES_PER_LINE) != 0
+			|| memcmp(expected_printable, printable, BYTES_PER_LINE) != 0)
+		{
+			std::cout << "  " << hex_decode_kernel_name() << " decodes spaced line " << i << " differently." << std::endl;
+			return false;
+		}
+	}
+
+	// And reject anything that isn't hex, in every position, or a separator that isn't a space.
+	uint8_t buffer[BYTES_PER_LINE];
+
+	for(uint32_t i = 0; i < HEX_SPACED_CHARS; i++)
+	{
+		std::string bad = spaced_lines[i];
+		bool separator = (i % 3 == 2);
+		bad[i] = separator ? '0' : 'g';
+
+		if(hex_decode_spaced(bad.c_str(), buffer, nullptr))
+		{
+			std::cout << "  " << hex_decode_kernel_name() << " accepted spaced line with '" << bad[i] << "' at " << i << "." << std::endl;
+			return false;
+		}
+
+		if(i < HEX_DECODE_CHARS)
+		{
+			bad = hex_lines[i];
+			bad[i] = 'g';
+
+			if(hex_decode_line(bad.c_str(), buffer, nullptr))
+			{
+				std::cout << "  " << hex_decode_kernel_name() << " accepted a non hex character at " << i << "." << std::endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool bench_hex_decode()
+{
+	const char* kernels[] = { "avx2", "sse2", "scalar" };
+	const char* selected = hex_decode_kernel_name();
+	bool pass = true;
+
+	std::cout << "Hex decode, " << (uint32_t)BYTES_PER_LINE << " bytes per line with printable view (runtime kernel: " << selected << "):" << std::endl;
+
+	bench_run("legacy hex_to_buffer+friendlystring", bench_hex_legacy);
+
+	for(const char* kernel : kernels)
+	{
+		if(!hex_decode_set_kernel(kernel))
+		{
+			continue; // Not built in, or not supported by this CPU.
+		}
+
+		if(!check_hex_kernel())
+		{
+			pass = false;
+			continue;
+		}
+
+		std::string name = std::string("hex_decode_") + kernel;
+		bench_run(name.c_str(), bench_hex_kernel);
+		name = std::string("hex_decode_spaced_") + kernel;
+		bench_run(name.c_str(), bench_hex_spaced);
+	}
+
+	hex_decode_set_kernel(selected);
+
+	return pass;
+}
+
+// The parser fdump had before scan_fdump_line(), kept here to hold the scanner to it: the
+// address column and every \b[0-9a-fA-F]{2}\b token, the first 32 digits of them decoded.
+// Returns the byte count, 0 for a line that isn't data.
+uint32_t legacy_parse_line(const std::string& text, uint8_t* target)
+{
+	static const std::regex re_data("(\\b[0-9a-fA-F]{2}\\b)");
+	std::string line = trim(text);
+	std::string hex_data;
+
+	if(line.empty() || starts_with(line, FDUMP_CMD + " ") || starts_with(line, CFE_STATUS_PREFIX))
+	{
+		return 0;
+	}
+
+	for(std::sregex_iterator next(line.begin(), line.end(), re_data), end; next != end; next++)
+	{
+		hex_data += next->str();
+	}
+
+	if(hex_data.length() > HEX_DECODE_CHARS)
+	{
+		hex_data.erase(HEX_DECODE_CHARS, std::string::npos);
+	}
+
+	hex_to_buffer(hex_data.c_str(), (char*)target);
+
+	return (uint32_t)hex_data.length() / 2;
+}
+
+// One data line the way CFE prints it, in upper or lower case.
+std::string corpus_data_line(std::mt19937& rng, uint32_t offset, uint8_t* bytes)
+{
+	const char* digits = (rng() & 1) ? "0123456789ABCDEF" : "0123456789abcdef";
+	char address[16];
+	snprintf(address, sizeof(address), "%08X: ", offset);
+
+	std::string line = address;
+	std::string ascii;
+
+	for(uint32_t i = 0; i < BYTES_PER_LINE; i++)
+	{
+		// Mostly text, so the ASCII column has words in it too.
+		bytes[i] = (rng() % 3 == 0) ? (uint8_t)rng() : (uint8_t)(' ' + rng() % 95);
+		line += digits[bytes[i] >> 4];
+		line += digits[bytes[i] & 0x0F];
+		line += ' ';
+		ascii += is_printable_ascii_char((char)bytes[i]) ? (char)bytes[i] : '.';
+	}
+
+	return line + "   " + ascii;
+}
+
+// Good lines, each cut short somewhere and garbled a few ways, echoes, status lines, prompts
+// and messages.
+void generate_corpus(std::vector<std::string>* corpus)
+{
+	static const char noise[] = "0123456789abcdefABCDEFgxz_:. -*\t\x01\x7f\xe9";
+	static const char* const others[] =
+	{
+		"", "   ", "*** command status = 0", "*** command status = -1",
+		"CFE>", "CFE> ", "CFE> fdump -offset=0 -size=4096 flash0", "CFE> ab cd ef",
+		"fdump -offset=65536 -size=65536 flash0", "fdump", "fdumpster ab",
+		"Invalid argument: ab cd ef", "Could not open device flash9", "ab cd ef 01",
+		"00", "00:", "0: 12", "Zz: 12 34", "_00: 12"
+	};
+	std::mt19937 rng(0x52454745);
+	uint8_t bytes[BYTES_PER_LINE];
+
+	for(const char* other : others)
+	{
+		corpus->push_back(other);
+	}
+
+	for(uint32_t i = 0; i < BENCH_CORPUS_LINES; i++)
+	{
+		std::string line = corpus_data_line(rng, i * BYTES_PER_LINE, bytes);
+
+		corpus->push_back(line);
+		corpus->push_back(line.substr(0, rng() % line.length()));
+
+		std::string garbled = line;
+
+		for(uint32_t n = 1 + rng() % 3; n > 0; n--)
+		{
+			size_t at = rng() % garbled.length();
+			char c = noise[rng() % (sizeof(noise) - 1)];
+
+			switch(rng() % 3)
+			{
+			case 0: garbled[at] = c; break;
+			case 1: garbled.insert(at, 1, c); break;
+			default: garbled.erase(at, 1); break;
+			}
+		}
+
+		corpus->push_back(garbled);
+		corpus->push_back(CFE_PROMPT + " " + line);
+		corpus->push_back(FDUMP_CMD + " " + line);
+	}
+}
+
+// Hex digits the line starts with, after any whitespace.
+size_t corpus_address_digits(const std::string& line)
+{
+	size_t start = line.find_first_not_of(WHITESPACE);
+	size_t end = line.find_first_not_of("0123456789abcdefABCDEF", start);
+
+	return (start == std::string::npos) ? 0 : ((end == std::string::npos) ? line.length() : end) - start;
+}
+
+// The scanner has to take the same lines as data as the regex parser did, with the same bytes.
+// By design it differs on lines that don't start with an address column, messages and the
+// prompt with something after it, which gave the old parser bytes out of any two digit word,
+// and on a two digit address column, which it took for the first byte.
+bool check_scanner_corpus()
+{
+	std::vector<std::string> corpus;
+	uint32_t data_lines = 0;
+	uint32_t no_address = 0;
+	uint32_t prompts = 0;
+	uint32_t short_address = 0;
+	uint32_t mismatches = 0;
+
+	generate_corpus(&corpus);
+
+	for(const std::string& line : corpus)
+	{
+		uint8_t expected[HEX_DECODE_BYTES];
+		uint8_t data[BYTES_PER_LINE];
+		uint32_t byte_count = 0;
+		uint32_t address = 0;
+		uint32_t expected_count = legacy_parse_line(line, expected);
+		LineKind kind = scan_fdump_line(line.c_str(), (uint32_t)line.length(), data, BYTES_PER_LINE, &byte_count, &address, nullptr);
+
+		if(kind != LK_DATA)
+		{
+			byte_count = 0;
+		}
+
+		if(byte_count == expected_count && memcmp(data, expected, byte_count) == 0)
+		{
+			data_lines += (byte_count > 0) ? 1 : 0;
+		}
+		else if(byte_count == 0 && kind == LK_OTHER)
+		{
+			no_address++;
+		}
+		else if(byte_count == 0 && kind == LK_PROMPT)
+		{
+			prompts++;
+		}
+		else if(kind == LK_DATA && expected_count > 0 && expected[0] == address && address <= 0xFF
+			&& corpus_address_digits(line) == 2
+			&& expected_count - 1 == std::min<uint32_t>(byte_count, HEX_DECODE_BYTES - 1) && memcmp(data, expected + 1, expected_count - 1) == 0)
+		{
+			short_address++;
+		}
+		else if(mismatches++ < 10)
+		{
+			std::cout << "  scan_fdump_line() reads " << byte_count << " bytes, the regex parser " << expected_count
+				<< ": \"" << line << "\"" << std::endl;
+		}
+	}
+
+	printf("  %-36s %10zu lines %10" PRIu32 " data\n", "same as the regex parser",
+		corpus.size() - no_address - prompts - short_address - mismatches, data_lines);
+	printf("  %-36s %10" PRIu32 " lines\n", "no address column, not data now", no_address);
+	printf("  %-36s %10" PRIu32 " lines\n", "prompt with text, not data now", prompts);
+	printf("  %-36s %10" PRIu32 " lines\n", "two digit address, not a byte now", short_address);
+
+	if(mismatches > 0)
+	{
+		std::cout << "  " << mismatches << " lines read differently." << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// What the console prints for one fdump command, from its echo to the status line.
+struct bench_transcript
+{
+	uint32_t size;			// -size= of the command.
+	std::string text;		// With the CR LF line ends and the next prompt.
+	std::vector<std::string> lines; // Without their line ends, as rx_next_line() hands them on.
+	uint32_t data_lines;
+};
+
+std::vector<uint8_t> bench_image;
+std::vector<bench_transcript> transcripts;
+const bench_transcript* bench_current = nullptr; // Transcript the pass benchmarks run over.
+
+rx_buffer* bench_rx = nullptr;
+dump_pipeline* bench_pipeline = nullptr;
+image_file bench_output;
+digest_set bench_digest;
+uint32_t bench_digest_type = 0;
+console_out* bench_console = nullptr; // With -l, each block is also queued for the console thread.
+
+// Where the console thread writes during the -l allocation test.
+struct bench_discard_streambuf : public std::streambuf
+{
+protected:
+	std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+	int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+};
+
+void generate_image()
+{
+	std::mt19937 rng(0x43464521);
+
+	bench_image.resize(BENCH_IMAGE_SIZE);
+
+	for(uint32_t i = 0; i < BENCH_IMAGE_SIZE; i++)
+	{
+		uint32_t region = (i / BENCH_REGION_SIZE) % 4;
+
+		if(region == 2)
+		{
+			bench_image[i] = 0xFF;
+		}
+		else if(region == 3)
+		{
+			bench_image[i] = 0x00;
+		}
+		else
+		{
+			bench_image[i] = (uint8_t)(rng() & 0xFF);
+		}
+	}
+}
+
+// Prints the first size bytes of the image the way cfe_sim does, lower case like CFE.
+void generate_transcript(bench_transcript* transcript, uint32_t size)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	transcript->size = size;
+	transcript->data_lines = 0;
+	transcript->lines.push_back(CFE_PROMPT + " " + FDUMP_CMD + " " + FDUMP_CMD_ARG_OFFSET + "0 "
+		+ FDUMP_CMD_ARG_SIZE + std::to_string(size) + " flash0");
+
+	for(uint32_t offset = 0; offset < size; offset += BYTES_PER_LINE)
+	{
+		char address[16];
+		snprintf(address, sizeof(address), "%08X: ", offset);
+
+		std::string line = address;
+		std::string ascii;
+
+		for(uint32_t i = 0; i < BYTES_PER_LINE; i++)
+		{
+			uint8_t byte = bench_image[offset + i];
+
+			line += digits[byte >> 4];
+			line += digits[byte & 0x0F];
+			line += ' ';
+			ascii += is_printable_ascii_char((char)byte) ? (char)byte : '.';
+		}
+
+		transcript->lines.push_back(line + "   " + ascii);
+		transcript->data_lines++;
+	}
+
+	transcript->lines.push_back(CFE_STATUS_PREFIX + " 0");
+
+	for(const std::string& line : transcript->lines)
+	{
+		transcript->text += line + "\r\n";
+	}
+
+	transcript->text += CFE_PROMPT + " ";
+}
+
+// Copies len bytes into the ring as if the reader had, the ring has to have room.
+void bench_rx_put(const char* data, uint32_t len)
+{
+	uint64_t head = bench_rx->head.load(std::memory_order_relaxed);
+
+	for(uint32_t i = 0; i < len; i++)
+	{
+		bench_rx->ring[(head + i) & (bench_rx->capacity - 1)] = data[i];
+	}
+
+	bench_rx->head.store(head + len, std::memory_order_release);
+}
+
+// rx_next_line() splitting the transcript as it comes in, BENCH_READ_SIZE bytes at a time.
+bool bench_split_lines()
+{
+	const std::string& text = bench_current->text;
+	uint32_t lines = 0;
+	const char* line;
+	uint32_t line_len;
+
+	for(uint32_t at = 0; at < text.length(); at += BENCH_READ_SIZE)
+	{
+		bench_rx_put(text.data() + at, std::min<uint32_t>(BENCH_READ_SIZE, (uint32_t)text.length() - at));
+
+		while(rx_next_line(bench_rx, &line, &line_len))
+		{
+			bench_sink += (uint8_t)line[0];
+			lines++;
+		}
+	}
+
+	// The prompt has no line end, and waits for the next command's echo.
+	rx_reset_line(bench_rx);
+
+	return lines == bench_current->lines.size();
+}
+
+// scan_fdump_line() on every line, the way pipeline_add_line() calls it.
+bool bench_scan_lines()
+{
+	uint32_t data_lines = 0;
+
+	for(const std::string& line : bench_current->lines)
+	{
+		uint8_t data[BYTES_PER_LINE];
+		uint32_t byte_count = 0;
+		uint32_t address = 0;
+
+		if(scan_fdump_line(line.c_str(), (uint32_t)line.length(), data, BYTES_PER_LINE, &byte_count, &address, nullptr) == LK_DATA)
+		{
+			bench_sink += data[address & 15];
+			data_lines++;
+		}
+	}
+
+	return data_lines == bench_current->data_lines;
+}
+
+// What scan_fdump_line() did before the spaced kernels: the data tokens of each line copied
+// into a buffer first, then hex_decode_line(). Only the data lines, the rest is the same.
+bool bench_gather_lines()
+{
+	uint32_t data_lines = 0;
+
+	for(uint32_t i = 1; i <= bench_current->data_lines; i++)
+	{
+		const std::string& line = bench_current->lines[i];
+		const char* c = line.c_str() + line.find(':');
+		const char* end = line.c_str() + line.length();
+		char hex_data[HEX_DECODE_CHARS];
+		uint8_t data[BYTES_PER_LINE];
+		uint32_t pairs = 0;
+
+		while(c < end && pairs < HEX_DECODE_BYTES)
+		{
+			while(c < end && !isalnum((uint8_t)*c) && *c != '_') c++;
+
+			const char* token = c;
+
+			while(c < end && (isalnum((uint8_t)*c) || *c == '_')) c++;
+
+			if(c - token == 2)
+			{
+				hex_data[pairs * 2] = token[0];
+				hex_data[pairs * 2 + 1] = token[1];
+				pairs++;
+			}
+		}
+
+		if(pairs == HEX_DECODE_BYTES && hex_decode_line(hex_data, data, nullptr))
+		{
+			bench_sink += data[i & 15];
+			data_lines++;
+		}
+	}
+
+	return data_lines == bench_current->data_lines;
+}
+
+// With the printable view for -l.
+bool bench_scan_lines_printable()
+{
+	uint32_t data_lines = 0;
+
+	for(const std::string& line : bench_current->lines)
+	{
+		uint8_t data[BYTES_PER_LINE];
+		char printable[BYTES_PER_LINE];
+		uint32_t byte_count = 0;
+		uint32_t address = 0;
+
+		if(scan_fdump_line(line.c_str(), (uint32_t)line.length(), data, BYTES_PER_LINE, &byte_count, &address, printable) == LK_DATA)
+		{
+			bench_sink += data[address & 15] + (uint8_t)printable[address & 15];
+			data_lines++;
+		}
+	}
+
+	return data_lines == bench_current->data_lines;
+}
+
+// trim() of the std::string line reader fdump used before the scanner.
+bool bench_trim_lines()
+{
+	for(const std::string& line : bench_current->lines)
+	{
+		bench_sink += (uint32_t)trim(line).length();
+	}
+
+	return true;
+}
+
+// Hands len bytes of console output to the pipeline, BENCH_READ_SIZE at a time.
+void bench_feed(const char* text, uint32_t len)
+{
+	const char* line;
+	uint32_t line_len;
+
+	for(uint32_t at = 0; at < len; at += BENCH_READ_SIZE)
+	{
+		bench_rx_put(text + at, std::min<uint32_t>(BENCH_READ_SIZE, len - at));
+
+		while(rx_next_line(bench_rx, &line, &line_len))
+		{
+			if(pipeline_add_line(bench_pipeline, line, line_len) == LK_STATUS)
+			{
+				pipeline_command_done(bench_pipeline, 0);
+			}
+		}
+	}
+}
+
+// A whole read of a block: the command goes out, the transcript is split into lines, each
+// one is placed in the block, then the lines the ASCII column couldn't confirm are read
+// again, and the block comes out finished, nullptr if it doesn't.
+flash_block* bench_read_block()
+{
+	const std::string& text = bench_current->text;
+	pipeline_command command = { 0, bench_current->size, nullptr, true, false };
+	flash_block* block;
+
+	command.block = pipeline_add_block(bench_pipeline, 0, bench_current->size);
+	pipeline_sent(bench_pipeline, command, 0);
+	bench_feed(text.data(), (uint32_t)text.length());
+	rx_reset_line(bench_rx);
+
+	while((block = pipeline_finished_block(bench_pipeline)) == nullptr && pipeline_next_reread(bench_pipeline, &command))
+	{
+		// Just the lines asked for, as CFE would print them for the narrow command.
+		pipeline_sent(bench_pipeline, command, 0);
+
+		for(uint64_t offset = command.offset; offset < command.offset + command.size; offset += BYTES_PER_LINE)
+		{
+			const std::string& line = bench_current->lines[1 + offset / BYTES_PER_LINE];
+			bench_feed(line.data(), (uint32_t)line.length());
+			bench_feed("\r\n", 2);
+		}
+
+		const std::string& status = bench_current->lines.back();
+		bench_feed(status.data(), (uint32_t)status.length());
+		bench_feed("\r\n", 2);
+	}
+
+	return block;
+}
+
+bool bench_assemble_block()
+{
+	flash_block* block = bench_read_block();
+	bool ok = block != nullptr && block_complete(block) && memcmp(block->data, bench_image.data(), bench_current->size) == 0;
+
+	if(block != nullptr)
+	{
+		bench_sink += block->data[block->size - 1];
+		pipeline_release_block(bench_pipeline);
+	}
+
+	return ok;
+}
+
+bool bench_transcript_lines()
+{
+	bool pass = true;
+
+	rx_init(&bench_rx, nullptr, RX_THREAD_BUFFER_SIZE);
+	pipeline_init(&bench_pipeline, 0, BLOCK_RETRIES, BENCH_IMAGE_SIZE, false);
+
+	for(const bench_transcript& transcript : transcripts)
+	{
+		bench_current = &transcript;
+
+		std::cout << "CFE transcript, fdump -size=" << transcript.size << " (" << transcript.lines.size()
+			<< " lines, " << transcript.text.length() << " bytes):" << std::endl;
+
+		pass = bench_run_passes("rx_next_line", bench_split_lines, transcript.data_lines) && pass;
+		pass = bench_run_passes("tokens gathered, hex_decode_line", bench_gather_lines, transcript.data_lines) && pass;
+		pass = bench_run_passes("scan_fdump_line", bench_scan_lines, transcript.data_lines) && pass;
+		pass = bench_run_passes("scan_fdump_line printable", bench_scan_lines_printable, transcript.data_lines) && pass;
+		pass = bench_run_passes("trim", bench_trim_lines, transcript.data_lines) && pass;
+		pass = bench_run_passes("block assembly", bench_assemble_block, transcript.data_lines) && pass;
+	}
+
+	pipeline_free(bench_pipeline);
+	rx_free(bench_rx);
+
+	return pass;
+}
+
+// Writes the image into the open output, a block at a time.
+bool bench_write_image()
+{
+	for(uint32_t offset = 0; offset < BENCH_IMAGE_SIZE; offset += BENCH_WRITE_BLOCK)
+	{
+		if(!image_write(&bench_output, offset, bench_image.data() + offset, BENCH_WRITE_BLOCK))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool bench_write_image_sparse()
+{
+	for(uint32_t offset = 0; offset < BENCH_IMAGE_SIZE; offset += BENCH_WRITE_BLOCK)
+	{
+		if(!image_write_sparse(&bench_output, offset, bench_image.data() + offset, BENCH_WRITE_BLOCK))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// A compressed image only goes forward, so each pass is a file of its own.
+bool bench_write_image_gzip()
+{
+	return image_open_compressed(&bench_output, BENCH_OUTPUT_NAME, COMPRESS_GZIP)
+		&& bench_write_image() && image_close(&bench_output);
+}
+
+bool bench_digest_image()
+{
+	digest_init(&bench_digest, bench_digest_type);
+
+	for(uint32_t offset = 0; offset < BENCH_IMAGE_SIZE; offset += BENCH_WRITE_BLOCK)
+	{
+		digest_update(&bench_digest, bench_image.data() + offset, BENCH_WRITE_BLOCK);
+	}
+
+	bench_sink += (uint32_t)bench_digest.bytes;
+
+	return true;
+}
+
+bool bench_output_image()
+{
+	uint64_t lines = BENCH_IMAGE_SIZE / BYTES_PER_LINE;
+	bool pass = true;
+
+	std::cout << "Output, " << BENCH_IMAGE_SIZE << " byte image in " << BENCH_WRITE_BLOCK << " byte blocks:" << std::endl;
+
+	image_init(&bench_output);
+
+	if(image_open(&bench_output, BENCH_OUTPUT_NAME, BENCH_IMAGE_SIZE, false))
+	{
+		pass = bench_run_passes("image_write", bench_write_image, lines) && pass;
+		pass = bench_run_passes("image_write_sparse", bench_write_image_sparse, lines) && pass;
+		pass = image_close(&bench_output) && pass;
+	}
+	else
+	{
+		std::cout << "  Can't open " << BENCH_OUTPUT_NAME << ": " << strerror(errno) << std::endl;
+		pass = false;
+	}
+
+	image_init(&bench_output);
+
+	if(image_open_compressed(&bench_output, BENCH_OUTPUT_NAME, COMPRESS_GZIP) && image_close(&bench_output))
+	{
+		pass = bench_run_passes("image_write gzip", bench_write_image_gzip, lines) && pass;
+		std::remove((BENCH_OUTPUT_NAME + COMPRESS_INDEX_EXT).c_str());
+	}
+
+	std::remove(BENCH_OUTPUT_NAME.c_str());
+
+	for(uint32_t type = 1; type <= DIGEST_ALL; type <<= 1)
+	{
+		std::string name = std::string("digest ") + digest_name(type);
+
+		bench_digest_type = type;
+		pass = bench_run_passes(name.c_str(), bench_digest_image, lines) && pass;
+	}
+
+	return pass;
+}
+
+// What session_finish_block() does with a block: journal it, write it and hash it.
+bool bench_read_write_block(dump_journal* journal, dump_stats* stats)
+{
+	flash_block* block = bench_read_block();
+
+	if(block == nullptr || !block_complete(block))
+	{
+		return false;
+	}
+
+	if(bench_console != nullptr)
+	{
+		console_hexdump(bench_console, block->offset, block->data, block->size);
+	}
+
+	journal_block_start(journal);
+	journal_update(journal, block->data, block->size);
+
+	bool ok = image_write(&bench_output, 0, block->data, block->size);
+
+	digest_update(&bench_digest, block->data, block->size);
+	stats_sample(stats, &stats->block_us, block->started_ns);
+	ok = journal_block_done(journal, 0) && ok;
+	pipeline_release_block(bench_pipeline);
+
+	return ok;
+}
+
+// The steady state of a dump, with --stats and every digest on, mustn't allocate. With listing
+// the blocks also go to the console thread like -l, warmed up until every slot of its ring has
+// held a block, and it writes to a streambuf that throws the text away.
+bool bench_allocations_per_line(bool listing)
+{
+	dump_journal journal;
+	dump_stats stats;
+	bench_discard_streambuf discard;
+	std::streambuf* stdout_buffer = nullptr;
+	uint32_t warmup_blocks = BENCH_WARMUP_BLOCKS + (listing ? CONSOLE_ITEMS : 0);
+	bool pass = true;
+
+	bench_current = &transcripts[1];
+	rx_init(&bench_rx, nullptr, RX_THREAD_BUFFER_SIZE);
+	pipeline_init(&bench_pipeline, 0, BLOCK_RETRIES, bench_current->size, false);
+	stats_init(&stats, true, warmup_blocks + BENCH_COUNTED_BLOCKS, 1);
+	bench_pipeline->stats = &stats;
+	digest_init(&bench_digest, DIGEST_ALL);
+	image_init(&bench_output);
+	journal.file = nullptr;
+	journal.blocks = 0;
+	journal.bytes = 0;
+
+	std::cout << "Allocations, fdump -size=" << bench_current->size << " read, journaled, written and hashed"
+		<< (listing ? ", listed with -l:" : ":") << std::endl;
+
+	if(!image_open(&bench_output, BENCH_OUTPUT_NAME, bench_current->size, false)
+		|| !journal_create(&journal, BENCH_OUTPUT_NAME + JOURNAL_EXT, "bench"))
+	{
+		std::cout << "  Can't open " << BENCH_OUTPUT_NAME << ": " << strerror(errno) << std::endl;
+		pass = false;
+	}
+
+	if(listing)
+	{
+		stdout_buffer = std::cout.rdbuf(&discard);
+		console_open(&bench_console, 0);
+	}
+
+	for(uint32_t i = 0; pass && i < warmup_blocks; i++)
+	{
+		pass = bench_read_write_block(&journal, &stats);
+	}
+
+	uint64_t before = bench_allocations.load();
+
+	for(uint32_t i = 0; pass && i < BENCH_COUNTED_BLOCKS; i++)
+	{
+		pass = bench_read_write_block(&journal, &stats);
+	}
+
+	uint64_t allocations = bench_allocations.load() - before;
+	uint64_t lines = (uint64_t)BENCH_COUNTED_BLOCKS * bench_current->data_lines;
+
+	if(listing)
+	{
+		console_close(bench_console);
+		bench_console = nullptr;
+		std::cout.rdbuf(stdout_buffer);
+	}
+
+	if(pass)
+	{
+		printf("  %-36s %10.4f per line %10" PRIu64 " in %" PRIu64 " lines\n", "operator new", (double)allocations / (double)lines,
+			allocations, lines);
+	}
+	else
+	{
+		std::cout << "  Reading a block went wrong." << std::endl;
+	}
+
+	if(allocations > 0)
+	{
+		std::cout << "  The block loop allocates, it should not once set up." << std::endl;
+		pass = false;
+	}
+
+	journal_close(&journal, true);
+	image_close(&bench_output);
+	pipeline_free(bench_pipeline);
+	rx_free(bench_rx);
+	std::remove(BENCH_OUTPUT_NAME.c_str());
+
+	return pass;
+}
+
+int main()
+{
+	bool pass = true;
+
+	generate_hex_lines();
+	generate_image();
+
+	for(uint32_t size : BENCH_TRANSCRIPT_SIZES)
+	{
+		transcripts.emplace_back();
+		generate_transcript(&transcripts.back(), size);
+	}
+
+	std::cout << "Scanner against the regex parser:" << std::endl;
+	pass = check_scanner_corpus() && pass;
+	pass = bench_hex_decode() && pass;
+	pass = bench_transcript_lines() && pass;
+	pass = bench_output_image() && pass;
+	pass = bench_allocations_per_line(false) && pass;
+	pass = bench_allocations_per_line(true) && pass;
+
+	return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
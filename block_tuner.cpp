@@ -0,0 +1,71 @@
+// block_tuner.cpp: Picks the size of the next fdump command for bs=auto.
+//
+// Per data line a block of n lines costs
+//   overhead / n                  the command, its echo and the wait for the end of the reply,
+// + line_time                     the line itself,
+// + error_rate * (overhead + ..)  a narrow re-read, the same whatever the block size,
+// + n * line_time * loss_rate     the whole block again when a line can't be recovered,
+// which is lowest at n = sqrt(overhead / (line_time * loss_rate)). Without any losses
+// bigger is always better, so the size only grows, up to TUNER_MAX_SIZE.
+
+#include <cmath>
+#include <algorithm>
+
+#include "block_tuner.h"
+#include "line_parser.h"
+
+void tuner_init(block_tuner* tuner, uint32_t retries)
+{
+	tuner->size = TUNER_START_SIZE;
+	tuner->retries = retries;
+	tuner->blocks = 0;
+	tuner->overhead = 0;
+	tuner->line_time = 0;
+	tuner->error_rate = 0;
+	tuner->loss_rate = 0;
+}
+
+static double tuner_average(block_tuner* tuner, double average, double sample)
+{
+	// The first block sets the averages, later ones move them.
+	return (tuner->blocks == 0) ? sample : average + TUNER_SMOOTHING * (sample - average);
+}
+
+void tuner_update(block_tuner* tuner, uint32_t lines, double seconds, uint64_t wire_bytes, uint32_t baud,
+	uint32_t lines_missed, uint32_t lines_lost)
+{
+	if(lines == 0 || baud == 0)
+	{
+		return;
+	}
+
+	double wire_seconds = (double)wire_bytes * TUNER_BITS_PER_CHAR / baud;
+
+	tuner->overhead = tuner_average(tuner, tuner->overhead, std::max(0.0, seconds - wire_seconds));
+	tuner->line_time = tuner_average(tuner, tuner->line_time, wire_seconds / lines);
+	tuner->error_rate = tuner_average(tuner, tuner->error_rate, (double)lines_missed / lines);
+	tuner->loss_rate = tuner_average(tuner, tuner->loss_rate, (double)lines_lost / lines);
+	tuner->blocks++;
+
+	// A line is only lost if every re-read misses it too, so the error rate bounds
+	// the losses before any have been seen.
+	double loss = std::max(tuner->loss_rate, std::pow(tuner->error_rate, tuner->retries + 1));
+	double target = TUNER_MAX_SIZE;
+
+	if(loss > 0 && tuner->line_time > 0)
+	{
+		target = std::sqrt(tuner->overhead / (tuner->line_time * loss)) * BYTES_PER_LINE;
+	}
+
+	target = std::min(target, (double)tuner->size * TUNER_MAX_GROWTH);
+	target = std::min(target, (double)TUNER_MAX_SIZE);
+
+	uint32_t size = (uint32_t)target / TUNER_ALIGN * TUNER_ALIGN;
+
+	tuner->size = std::max(size, TUNER_MIN_SIZE);
+}
+
+uint32_t tuner_next_size(block_tuner* tuner, uint64_t bytes_left)
+{
+	return (uint32_t)std::min((uint64_t)tuner->size, bytes_left);
+}
@@ -0,0 +1,38 @@
+// block_tuner.h: Picks the size of the next fdump command for bs=auto.
+// Every block is timed against the bytes it took on the line, which gives the fixed
+// overhead of a command, and its lines are counted for how many had to be re-read and
+// how many were still missing at the end. Small blocks pay the overhead over and over,
+// large ones lose more when they can't be completed, the next size balances the two.
+
+#ifndef BLOCK_TUNER_H
+#define BLOCK_TUNER_H
+
+#include <cstdint>
+
+const uint32_t TUNER_START_SIZE = 4096;		// First block, small so the first numbers come in quickly.
+const uint32_t TUNER_MIN_SIZE = 1024;
+const uint32_t TUNER_MAX_SIZE = 262144;		// A couple of minutes at 115200, bounds what a ctrl-c or resume loses.
+const uint32_t TUNER_ALIGN = 1024;			// Sizes are whole multiples of this.
+const uint32_t TUNER_MAX_GROWTH = 2;		// Grow by at most this factor per block, shrink at once.
+const uint32_t TUNER_BITS_PER_CHAR = 10;	// 8/N/1 with the start bit.
+const double TUNER_SMOOTHING = 0.25;		// Weight of the newest block in the running averages.
+
+struct block_tuner
+{
+	uint32_t size;			// Size of the next block.
+	uint32_t retries;		// Re-read rounds per block, a line is lost only when all of them miss it.
+	uint32_t blocks;		// Blocks measured so far.
+
+	// Running averages.
+	double overhead;		// Seconds per command beyond the time its bytes take on the line.
+	double line_time;		// Seconds per data line on the line.
+	double error_rate;		// Share of lines missing or damaged after the first read.
+	double loss_rate;		// Share of lines still missing after the re-reads.
+};
+
+void tuner_init(block_tuner* tuner, uint32_t retries);
+void tuner_update(block_tuner* tuner, uint32_t lines, double seconds, uint64_t wire_bytes, uint32_t baud,
+	uint32_t lines_missed, uint32_t lines_lost);
+uint32_t tuner_next_size(block_tuner* tuner, uint64_t bytes_left);
+
+#endif
@@ -0,0 +1,1005 @@
+// cfe_sim.cpp: CFE console simulator on a pseudo-terminal, and an end-to-end benchmark harness.
+//
+// Serves a backing image file through a pty the way a CFE console would: it echoes
+// commands, answers 'fdump -offset= -size=', 'help' and 'show devices', and prints
+// the CFE> prompt. Output is paced to any baud rate and can be injected with noise,
+// so fdump can be exercised and timed on a plain Linux box without a router.
+// With crc=1 it also has 'crc32 -offset= -size=', a checksum command like some CFE builds have.
+// With maxbaud= it also has a 'baud <rate>' command. The line is garbled whenever fdump's
+// tty isn't at the console rate, and above maxbaud it drops SIM_MARGINAL_ERRORS of characters.
+// latency= is how long typed characters take to reach the console, like the latency timer of a
+// USB serial adapter, and fifo= how many it keeps while busy, like a UART receive FIFO.
+//
+// Usage:
+//   ./cfe_sim image=flash.bin [dev=flash0] [baud=115200] [noise=0.001] [seed=1] [maxbaud=921600]
+//             [crc=1] [latency=5] [fifo=16] [link=/tmp/ttyCFE]
+//       Serve until killed, fdump connects with tty=<the pty printed at startup>.
+//
+//   ./cfe_sim image=flash.bin [baud=...] [noise=...] [log=fdump.log] run ./fdump if=flash0 of=out.bin offset=0 bs=65536 size=1048576
+//       Benchmark harness: runs fdump against the simulator (tty= is added), then reports
+//       bytes/s, CPU time and syscalls of the fdump process and checks of= against the image,
+//       inflating it first when it is compressed.
+
+#ifdef POSIX
+	#include <iostream>
+	#include <fstream>
+	#include <string>
+	#include <vector>
+	#include <deque>
+	#include <random>
+	#include <chrono>
+
+	#include <cstdio>
+	#include <cstdlib>
+	#include <cstring>
+	#include <cstdint>
+
+	#include <fcntl.h>
+	#include <errno.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <unistd.h>
+	#include <termios.h>
+	#include <sys/wait.h>
+	#include <sys/resource.h>
+
+	#ifdef HAVE_ZLIB
+		#include <zlib.h>
+	#endif
+
+	const std::string SIM_PROMPT = "CFE> ";
+	const std::string SIM_NEW_LINE = "\r\n";
+	const uint32_t SIM_LINE_BYTES = 16; // Bytes per fdump line, as CFE prints them.
+	const uint32_t SIM_LINE_CHARS = 79; // Characters per full fdump line, address, hex and ASCII columns and "\r\n".
+	const size_t SIM_OUTPUT_LOW_WATER = 65536; // Generate more fdump lines when less than this is queued.
+	const size_t SIM_MAX_WRITE = 4096; // Largest single write to the pty master.
+	const double SIM_MARGINAL_ERRORS = 0.02; // Share of characters garbled above maxbaud.
+
+	struct sim_baud
+	{
+		uint32_t rate;
+		speed_t speed;
+	};
+
+	// Rates the 'baud' command understands, as the tty reports them.
+	const sim_baud SIM_BAUD_RATES[] =
+	{
+		{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+	#ifdef B460800
+		{ 460800, B460800 },
+	#endif
+	#ifdef B921600
+		{ 921600, B921600 },
+	#endif
+	#ifdef B1000000
+		{ 1000000, B1000000 },
+	#endif
+	#ifdef B1500000
+		{ 1500000, B1500000 },
+	#endif
+	#ifdef B2000000
+		{ 2000000, B2000000 },
+	#endif
+	#ifdef B3000000
+		{ 3000000, B3000000 },
+	#endif
+	#ifdef B4000000
+		{ 4000000, B4000000 },
+	#endif
+	};
+
+	struct cfe_sim
+	{
+		int master;				// pty master, the simulator's end.
+		int slave;				// Kept open so the pty survives fdump closing and reopening it.
+		std::string slave_name;
+		std::vector<uint8_t> image;
+		std::string dev_name;
+		uint32_t baud;			// 0 is unpaced.
+		uint32_t console_baud;	// Rate the console is at, fdump's tty has to match it.
+		uint32_t max_baud;		// Fastest clean rate, 0 is no 'baud' command.
+		bool crc;				// Has a 'crc32' command.
+		uint32_t switch_baud;	// Rate to change to once output reaches switch_at, 0 is none.
+		size_t switch_at;
+		double noise;			// Chance per data line of it being damaged.
+		double latency;			// Seconds typed characters take to reach the console.
+		size_t fifo;			// Typed characters kept while a command runs, 0 is no limit.
+		std::mt19937 rng;
+
+		std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> typed; // On their way, see latency.
+		std::string input;		// Typed characters not yet making up a whole command.
+		std::vector<std::string> commands; // Commands waiting for the running one to finish.
+		std::string output;		// Queued console output.
+		size_t output_pos;
+
+		bool dumping;			// An fdump command is producing lines.
+		uint64_t dump_pos;
+		uint64_t dump_end;
+		int dump_status;
+
+		std::chrono::steady_clock::time_point pace_start; // Pacing restarts whenever the line goes idle.
+		uint64_t pace_sent;
+
+		uint64_t commands_run;
+		double line_seconds;	// Least time the dumped data needs on the line, at the rates it went out at.
+		uint64_t lines_damaged;
+		uint64_t typed_lost;	// Characters dropped for not fitting the fifo.
+	};
+
+	volatile sig_atomic_t sim_running = 1;
+
+	void sim_sighandler(int)
+	{
+		sim_running = 0;
+	}
+
+	std::string sim_arg_value(const std::string& arg)
+	{
+		size_t eq = arg.find('=');
+		return (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+	}
+
+	bool sim_has_prefix(const std::string& s, const std::string& prefix)
+	{
+		return s.compare(0, prefix.length(), prefix) == 0;
+	}
+
+	bool sim_open_pty(cfe_sim* sim)
+	{
+		sim->master = posix_openpt(O_RDWR | O_NOCTTY);
+
+		if(sim->master < 0 || grantpt(sim->master) != 0 || unlockpt(sim->master) != 0)
+		{
+			std::cout << "Opening pty			[failed]	" << strerror(errno) << std::endl;
+			return false;
+		}
+
+		sim->slave_name = ptsname(sim->master);
+		sim->slave = open(sim->slave_name.c_str(), O_RDWR | O_NOCTTY);
+
+		if(sim->slave < 0)
+		{
+			std::cout << "Opening " << sim->slave_name << "			[failed]	" << strerror(errno) << std::endl;
+			return false;
+		}
+
+		// Raw until fdump configures it, so nothing is echoed or translated by the line discipline.
+		struct termios tty;
+		tcgetattr(sim->slave, &tty);
+		cfmakeraw(&tty);
+		tcsetattr(sim->slave, TCSANOW, &tty);
+
+		fcntl(sim->master, F_SETFL, fcntl(sim->master, F_GETFL) | O_NONBLOCK);
+
+		return true;
+	}
+
+	// Damage one line of output the way a noisy or overrun serial line would.
+	void sim_damage_line(cfe_sim* sim, std::string& line)
+	{
+		if(sim->noise <= 0.0 || std::uniform_real_distribution<double>(0.0, 1.0)(sim->rng) >= sim->noise)
+		{
+			return;
+		}
+
+		sim->lines_damaged++;
+
+		size_t at = std::uniform_int_distribution<size_t>(0, line.length() - 1)(sim->rng);
+
+		switch(sim->rng() % 3)
+		{
+		case 0:
+			// Whole line lost.
+			line.clear();
+			break;
+		case 1:
+			// One character lost.
+			line.erase(at, 1);
+			break;
+		default:
+			// One character garbled.
+			line[at] = (char)('!' + sim->rng() % 94);
+		}
+	}
+
+	void sim_queue_dump_lines(cfe_sim* sim)
+	{
+		static const char digits[] = "0123456789abcdef";
+
+		while(sim->dumping && sim->output.length() - sim->output_pos < SIM_OUTPUT_LOW_WATER)
+		{
+			if(sim->dump_pos >= sim->dump_end)
+			{
+				sim->dumping = false;
+				sim->output += "*** command status = " + std::to_string(sim->dump_status) + SIM_NEW_LINE + SIM_PROMPT;
+				break;
+			}
+
+			uint64_t count = sim->dump_end - sim->dump_pos;
+			if(count > SIM_LINE_BYTES) count = SIM_LINE_BYTES;
+
+			// 00000000: 46 4c 53 48 00 80 00 00 8e 03 00 00 1c 00 01 00    FLSH............
+			char address[24];
+			snprintf(address, sizeof(address), "%08llX: ", (unsigned long long)sim->dump_pos);
+
+			std::string line = address;
+			std::string ascii;
+
+			for(uint64_t i = 0; i < count; i++)
+			{
+				uint8_t byte = sim->image[sim->dump_pos + i];
+
+				line += digits[byte >> 4];
+				line += digits[byte & 0x0F];
+				line += ' ';
+				ascii += (byte > 31 && byte < 127) ? (char)byte : '.';
+			}
+			line += "   " + ascii;
+
+			sim_damage_line(sim, line);
+
+			sim->output += line + SIM_NEW_LINE;
+			sim->dump_pos += count;
+			sim->line_seconds += 10.0 * SIM_LINE_CHARS / sim->console_baud;
+		}
+	}
+
+	// Parse '<command> -offset=N -size=N device', the form fdump sends.
+	void sim_parse_range(const std::string& command, uint64_t* offset, uint64_t* size, std::string* device)
+	{
+		size_t pos = command.find(' ');
+
+		*offset = 0;
+		*size = 0;
+		device->clear();
+
+		while(pos < command.length())
+		{
+			size_t end = command.find(' ', pos);
+			if(end == std::string::npos) end = command.length();
+
+			std::string token = command.substr(pos, end - pos);
+
+			if(sim_has_prefix(token, "-offset="))
+			{
+				*offset = strtoull(sim_arg_value(token).c_str(), nullptr, 0);
+			}
+			else if(sim_has_prefix(token, "-size="))
+			{
+				*size = strtoull(sim_arg_value(token).c_str(), nullptr, 0);
+			}
+			else if(!token.empty())
+			{
+				*device = token;
+			}
+
+			pos = end + 1;
+		}
+	}
+
+	void sim_start_fdump(cfe_sim* sim, const std::string& command)
+	{
+		uint64_t dump_offset;
+		uint64_t dump_size;
+		std::string device;
+
+		sim_parse_range(command, &dump_offset, &dump_size, &device);
+
+		if(device != sim->dev_name)
+		{
+			sim->output += "Could not open device '" + device + "'" + SIM_NEW_LINE
+				+ "*** command status = -6" + SIM_NEW_LINE + SIM_PROMPT;
+			return;
+		}
+
+		sim->dump_status = 0;
+
+		if(dump_offset > sim->image.size())
+		{
+			dump_offset = sim->image.size();
+		}
+		if(dump_size > sim->image.size() - dump_offset)
+		{
+			// Past the end of the device, dump what there is and fail like a read error.
+			dump_size = sim->image.size() - dump_offset;
+			sim->dump_status = -22;
+		}
+
+		sim->dumping = true;
+		sim->dump_pos = dump_offset;
+		sim->dump_end = dump_offset + dump_size;
+
+		sim_queue_dump_lines(sim);
+	}
+
+	// 'crc32 -offset=N -size=N device': the CRC32 of the range, the same one zlib works out.
+	void sim_run_crc(cfe_sim* sim, const std::string& command)
+	{
+		uint64_t crc_offset;
+		uint64_t crc_size;
+		std::string device;
+
+		sim_parse_range(command, &crc_offset, &crc_size, &device);
+
+		if(device != sim->dev_name)
+		{
+			sim->output += "Could not open device '" + device + "'" + SIM_NEW_LINE
+				+ "*** command status = -6" + SIM_NEW_LINE + SIM_PROMPT;
+			return;
+		}
+
+		if(crc_offset > sim->image.size() || crc_size > sim->image.size() - crc_offset)
+		{
+			sim->output += "Range past the end of the device" + SIM_NEW_LINE
+				+ "*** command status = -22" + SIM_NEW_LINE + SIM_PROMPT;
+			return;
+		}
+
+		uint32_t crc = 0xFFFFFFFF;
+
+		for(uint64_t i = crc_offset; i < crc_offset + crc_size; i++)
+		{
+			crc ^= sim->image[i];
+
+			for(int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+			}
+		}
+
+		char reply[64];
+		snprintf(reply, sizeof(reply), "CRC32 of %llu bytes: 0x%08x", (unsigned long long)crc_size, ~crc);
+
+		sim->output += reply + SIM_NEW_LINE + "*** command status = 0" + SIM_NEW_LINE + SIM_PROMPT;
+	}
+
+	// 'baud <rate>': the echo goes out at the old rate, the status and prompt at the new one.
+	void sim_start_baud(cfe_sim* sim, const std::string& command)
+	{
+		uint32_t rate = (uint32_t)strtoul(command.c_str() + 5, nullptr, 10);
+		bool known = false;
+
+		for(const sim_baud& baud : SIM_BAUD_RATES)
+		{
+			known = known || (baud.rate == rate);
+		}
+
+		if(!known)
+		{
+			sim->output += "Invalid baud rate: " + std::to_string(rate) + SIM_NEW_LINE
+				+ "*** command status = -1" + SIM_NEW_LINE + SIM_PROMPT;
+			return;
+		}
+
+		sim->switch_baud = rate;
+		sim->switch_at = sim->output.length();
+		sim->output += "*** command status = 0" + SIM_NEW_LINE + SIM_PROMPT;
+	}
+
+	// Whether fdump's tty is at the same rate as the console.
+	bool sim_link_ok(cfe_sim* sim)
+	{
+		if(sim->max_baud == 0)
+		{
+			return true;
+		}
+
+		struct termios tty;
+		if(tcgetattr(sim->slave, &tty) != 0)
+		{
+			return false;
+		}
+
+		for(const sim_baud& baud : SIM_BAUD_RATES)
+		{
+			if(baud.speed == cfgetospeed(&tty))
+			{
+				return baud.rate == sim->console_baud;
+			}
+		}
+
+		return false;
+	}
+
+	// Each character as it arrives at the other end of the line.
+	char sim_line_char(cfe_sim* sim, bool link_ok, char c)
+	{
+		bool marginal = sim->max_baud > 0 && sim->console_baud > sim->max_baud
+			&& std::uniform_real_distribution<double>(0.0, 1.0)(sim->rng) < SIM_MARGINAL_ERRORS;
+
+		return (link_ok && !marginal) ? c : (char)('!' + sim->rng() % 94);
+	}
+
+	void sim_run_command(cfe_sim* sim, std::string command)
+	{
+		sim->commands_run++;
+
+		// The console echoes the command as it reads it.
+		sim->output += command + SIM_NEW_LINE;
+
+		while(!command.empty() && command.back() == ' ') command.pop_back();
+		while(!command.empty() && command.front() == ' ') command.erase(0, 1);
+
+		if(command.empty())
+		{
+			sim->output += SIM_PROMPT;
+		}
+		else if(sim_has_prefix(command, "fdump "))
+		{
+			sim_start_fdump(sim, command);
+		}
+		else if(sim->crc && sim_has_prefix(command, "crc32 "))
+		{
+			sim_run_crc(sim, command);
+		}
+		else if(sim->max_baud > 0 && sim_has_prefix(command, "baud "))
+		{
+			sim_start_baud(sim, command);
+		}
+		else if(command == "help")
+		{
+			sim->output += "Available commands:" + SIM_NEW_LINE + SIM_NEW_LINE
+				+ "fdump               Dump the contents of a flash device." + SIM_NEW_LINE
+				+ (sim->crc ? "crc32               Checksum a range of a flash device." + SIM_NEW_LINE : "")
+				+ ((sim->max_baud > 0) ? "baud                Set the console baud rate." + SIM_NEW_LINE : "")
+				+ "show devices        Display information about the installed devices." + SIM_NEW_LINE
+				+ "help                Obtain help for CFE commands" + SIM_NEW_LINE + SIM_NEW_LINE
+				+ "For more information about a command, enter 'help command-name'" + SIM_NEW_LINE
+				+ "*** command status = 0" + SIM_NEW_LINE + SIM_PROMPT;
+		}
+		else if(command == "show devices")
+		{
+			char size[64];
+			snprintf(size, sizeof(size), "%lluKB", (unsigned long long)(sim->image.size() / 1024));
+
+			sim->output += "Device Name          Description" + SIM_NEW_LINE
+				+ "-------------------  ---------------------------------------------------------" + SIM_NEW_LINE
+				+ "              uart0  Simulated UART on " + sim->slave_name + SIM_NEW_LINE
+				+ "             " + sim->dev_name + "  Simulated flash, backed by image: " + size + SIM_NEW_LINE
+				+ "*** command status = 0" + SIM_NEW_LINE + SIM_PROMPT;
+		}
+		else
+		{
+			sim->output += "Invalid command: \"" + command + "\"" + SIM_NEW_LINE
+				+ "Available commands: fdump, show devices, help" + SIM_NEW_LINE
+				+ "*** command status = -1" + SIM_NEW_LINE + SIM_PROMPT;
+		}
+	}
+
+	// Characters typed while a command was running, waiting to be read by the console.
+	size_t sim_typed_ahead(cfe_sim* sim)
+	{
+		bool busy = sim->dumping || sim->output_pos < sim->output.length() || !sim->commands.empty();
+
+		if(!busy)
+		{
+			return 0;
+		}
+
+		size_t typed = sim->input.length();
+
+		for(const std::string& command : sim->commands)
+		{
+			typed += command.length() + 1;
+		}
+
+		return typed;
+	}
+
+	// Characters as the console receives them.
+	void sim_receive(cfe_sim* sim, const std::string& received)
+	{
+		bool link_ok = sim_link_ok(sim);
+
+		for(size_t i = 0; i < received.length(); i++)
+		{
+			if(sim->fifo > 0 && sim_typed_ahead(sim) >= sim->fifo)
+			{
+				// Overrun, the console isn't reading while it is busy.
+				sim->typed_lost++;
+				continue;
+			}
+
+			char c = sim_line_char(sim, link_ok, received[i]);
+
+			if(c == '\r' || c == '\n')
+			{
+				sim->commands.push_back(sim->input);
+				sim->input.clear();
+			}
+			else if(c == '\x03')
+			{
+				// Like the real console, ctrl-c doesn't stop a running command.
+				sim->input.clear();
+			}
+			else
+			{
+				sim->input += c;
+			}
+		}
+	}
+
+	void sim_read_input(cfe_sim* sim)
+	{
+		char buffer[1024];
+		ssize_t got;
+
+		while((got = read(sim->master, buffer, sizeof(buffer))) > 0)
+		{
+			if(sim->latency > 0)
+			{
+				auto arrival = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(sim->latency));
+
+				sim->typed.emplace_back(arrival, std::string(buffer, got));
+			}
+			else
+			{
+				sim_receive(sim, std::string(buffer, got));
+			}
+		}
+	}
+
+	// Hand over typed characters whose latency is up, returns the milliseconds until the next, -1 if none.
+	int sim_deliver_typed(cfe_sim* sim)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		while(!sim->typed.empty() && sim->typed.front().first <= now)
+		{
+			sim_receive(sim, sim->typed.front().second);
+			sim->typed.pop_front();
+		}
+
+		if(sim->typed.empty())
+		{
+			return -1;
+		}
+
+		return 1 + (int)std::chrono::duration_cast<std::chrono::milliseconds>(sim->typed.front().first - now).count();
+	}
+
+	// Time until the pacing allows another write, 0 if it already does.
+	int sim_write_output(cfe_sim* sim)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		while(sim->output_pos < sim->output.length())
+		{
+			size_t pending = sim->output.length() - sim->output_pos;
+			size_t allowed = pending;
+
+			if(sim->baud > 0)
+			{
+				// 10 bits per character with 8/N/1 framing.
+				double elapsed = std::chrono::duration<double>(now - sim->pace_start).count();
+				uint64_t budget = (uint64_t)(elapsed * sim->baud / 10.0);
+
+				allowed = (budget > sim->pace_sent) ? (size_t)(budget - sim->pace_sent) : 0;
+
+				if(allowed == 0)
+				{
+					return 1; // Try again in a millisecond.
+				}
+				if(allowed > pending) allowed = pending;
+			}
+
+			if(allowed > SIM_MAX_WRITE) allowed = SIM_MAX_WRITE;
+
+			if(sim->switch_baud > 0)
+			{
+				if(sim->output_pos >= sim->switch_at)
+				{
+					// Everything at the old rate is out, change over.
+					sim->console_baud = sim->switch_baud;
+					if(sim->baud > 0)
+					{
+						sim->baud = sim->switch_baud;
+						sim->pace_start = now;
+						sim->pace_sent = 0;
+					}
+					sim->switch_baud = 0;
+					continue;
+				}
+				if(allowed > sim->switch_at - sim->output_pos) allowed = sim->switch_at - sim->output_pos;
+			}
+
+			char garbled[SIM_MAX_WRITE];
+			const char* data = sim->output.data() + sim->output_pos;
+
+			if(sim->max_baud > 0)
+			{
+				bool link_ok = sim_link_ok(sim);
+
+				for(size_t i = 0; i < allowed; i++)
+				{
+					garbled[i] = sim_line_char(sim, link_ok, data[i]);
+				}
+				data = garbled;
+			}
+
+			ssize_t sent = write(sim->master, data, allowed);
+
+			if(sent <= 0)
+			{
+				return 1; // The slave side is full, fdump isn't reading fast enough.
+			}
+
+			sim->output_pos += sent;
+			sim->pace_sent += sent;
+
+			sim_queue_dump_lines(sim);
+
+			if(sim->output_pos > SIM_OUTPUT_LOW_WATER)
+			{
+				sim->output.erase(0, sim->output_pos);
+				sim->switch_at -= (sim->switch_baud > 0) ? sim->output_pos : 0;
+				sim->output_pos = 0;
+			}
+		}
+
+		return -1; // Idle.
+	}
+
+	void sim_step(cfe_sim* sim, int idle_timeout_ms)
+	{
+		bool was_idle = (sim->output_pos >= sim->output.length());
+
+		int typed_timeout = sim_deliver_typed(sim);
+
+		// Run the next typed command once the previous one has finished.
+		while(!sim->dumping && sim->output_pos >= sim->output.length() && !sim->commands.empty())
+		{
+			std::string command = sim->commands.front();
+			sim->commands.erase(sim->commands.begin());
+			sim_run_command(sim, command);
+		}
+
+		if(was_idle && sim->output_pos < sim->output.length())
+		{
+			sim->pace_start = std::chrono::steady_clock::now();
+			sim->pace_sent = 0;
+		}
+
+		int timeout = sim_write_output(sim);
+
+		if(timeout < 0 || (typed_timeout >= 0 && typed_timeout < timeout))
+		{
+			timeout = typed_timeout;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = sim->master;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		poll(&pfd, 1, (timeout < 0) ? idle_timeout_ms : timeout);
+
+		if(pfd.revents & POLLIN)
+		{
+			sim_read_input(sim);
+		}
+	}
+
+	bool sim_load_image(cfe_sim* sim, const std::string& image_name)
+	{
+		std::ifstream image_file(image_name, std::ios::in | std::ios::binary);
+
+		if(!image_file.is_open())
+		{
+			std::cout << "Opening image " << image_name << "			[failed]	" << strerror(errno) << std::endl;
+			return false;
+		}
+
+		sim->image.assign(std::istreambuf_iterator<char>(image_file), std::istreambuf_iterator<char>());
+
+		return true;
+	}
+
+	// Read syscall counters of a child that has exited but not been reaped yet.
+	void sim_child_syscalls(pid_t pid, uint64_t* syscr, uint64_t* syscw)
+	{
+		*syscr = 0;
+		*syscw = 0;
+
+	#ifdef LINUX
+		std::ifstream io("/proc/" + std::to_string(pid) + "/io");
+		std::string key;
+		uint64_t value;
+
+		while(io >> key >> value)
+		{
+			if(key == "syscr:") *syscr = value;
+			if(key == "syscw:") *syscw = value;
+		}
+	#endif
+	}
+
+	// Reads the fdump output file whole. A compressed of= (.gz or compress=gzip) is inflated,
+	// gzread passes a plain file through as it is.
+	bool sim_read_output(const std::string& of_name, std::vector<uint8_t>* data)
+	{
+	#ifdef HAVE_ZLIB
+		gzFile output = gzopen(of_name.c_str(), "rb");
+
+		if(output == nullptr)
+		{
+			return false;
+		}
+
+		uint8_t buffer[65536];
+		int got;
+
+		while((got = gzread(output, buffer, sizeof(buffer))) > 0)
+		{
+			data->insert(data->end(), buffer, buffer + got);
+		}
+
+		return gzclose(output) == Z_OK && got == 0;
+	#else
+		std::ifstream output(of_name, std::ios::in | std::ios::binary);
+		data->assign((std::istreambuf_iterator<char>(output)), std::istreambuf_iterator<char>());
+		return output.is_open();
+	#endif
+	}
+
+	// Check the fdump output file against the image it was dumped from.
+	bool sim_verify_output(cfe_sim* sim, const std::string& of_name, uint64_t dump_offset, uint64_t dump_size)
+	{
+		std::vector<uint8_t> data;
+
+		if(!sim_read_output(of_name, &data) || dump_offset + dump_size > sim->image.size() || data.size() != dump_size)
+		{
+			return false;
+		}
+
+		return memcmp(data.data(), sim->image.data() + dump_offset, dump_size) == 0;
+	}
+
+	int sim_run_benchmark(cfe_sim* sim, std::vector<std::string> fdump_args, const std::string& log_name)
+	{
+		std::string of_name;
+		uint64_t dump_offset = 0;
+		uint64_t dump_size = 0;
+
+		for(const std::string& arg : fdump_args)
+		{
+			if(sim_has_prefix(arg, "of=")) of_name = sim_arg_value(arg);
+			if(sim_has_prefix(arg, "offset=") || sim_has_prefix(arg, "skip=")) dump_offset = strtoull(sim_arg_value(arg).c_str(), nullptr, 0);
+			if(sim_has_prefix(arg, "size=") || sim_has_prefix(arg, "count=")) dump_size = strtoull(sim_arg_value(arg).c_str(), nullptr, 0);
+		}
+
+		fdump_args.push_back("tty=" + sim->slave_name);
+
+		std::vector<char*> child_argv;
+		for(std::string& arg : fdump_args)
+		{
+			child_argv.push_back(&arg[0]);
+		}
+		child_argv.push_back(nullptr);
+
+		auto start = std::chrono::steady_clock::now();
+		pid_t pid = fork();
+
+		if(pid == 0)
+		{
+			int log = open(log_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+			if(log >= 0)
+			{
+				dup2(log, STDOUT_FILENO);
+				close(log);
+			}
+
+			close(sim->master);
+			close(sim->slave);
+
+			execv(child_argv[0], child_argv.data());
+			perror("execv");
+			_exit(127);
+		}
+
+		if(pid < 0)
+		{
+			std::cout << "fork failed: " << strerror(errno) << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		// Serve the console until fdump exits, leaving it unreaped to read its counters.
+		siginfo_t info;
+
+		while(sim_running)
+		{
+			memset(&info, 0, sizeof(info));
+
+			if(waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid)
+			{
+				break;
+			}
+
+			sim_step(sim, 10);
+		}
+
+		double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		uint64_t syscr;
+		uint64_t syscw;
+		sim_child_syscalls(pid, &syscr, &syscw);
+
+		int status = 0;
+		struct rusage usage;
+		memset(&usage, 0, sizeof(usage));
+
+		if(!sim_running)
+		{
+			kill(pid, SIGTERM);
+		}
+		wait4(pid, &status, 0, &usage);
+
+		double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+		double system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+		double mib = dump_size / 1048576.0;
+
+		printf("Dumped bytes:        %llu\n", (unsigned long long)dump_size);
+		printf("Wall time:           %.3f s\n", wall);
+		printf("Throughput:          %.0f bytes/s", dump_size / wall);
+		if(sim->baud > 0 && sim->line_seconds > 0.0)
+		{
+			// 10 bits per character, and a line of 16 data bytes is SIM_LINE_CHARS characters on the wire.
+			printf(" (%.1f%% of line rate, the data needs %.3f s at the rates used)", 100.0 * sim->line_seconds / wall, sim->line_seconds);
+		}
+		printf("\n");
+		printf("CPU time:            %.3f s user, %.3f s sys (%.1f%% of wall)\n", user, system, 100.0 * (user + system) / wall);
+	#ifdef LINUX
+		printf("Syscalls:            %llu read, %llu write", (unsigned long long)syscr, (unsigned long long)syscw);
+		if(mib > 0.0)
+		{
+			printf(" (%.0f read per MiB)", syscr / mib);
+		}
+		printf("\n");
+	#endif
+		printf("Damaged lines:       %llu\n", (unsigned long long)sim->lines_damaged);
+
+		if(sim->fifo > 0)
+		{
+			printf("Typed ahead lost:    %llu characters\n", (unsigned long long)sim->typed_lost);
+		}
+		printf("fdump exit status:   %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+		bool verified = true;
+
+		if(!of_name.empty())
+		{
+			verified = sim_verify_output(sim, of_name, dump_offset, dump_size);
+			printf("Output check:        %s\n", verified ? "matches image" : "DIFFERS from image");
+		}
+
+		return (WIFEXITED(status) && WEXITSTATUS(status) == 0 && verified) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	int main(int argc, char** argv)
+	{
+		cfe_sim sim;
+		std::string image_name;
+		std::string link_name;
+		std::string log_name = "/dev/null";
+		std::vector<std::string> fdump_args;
+		uint32_t seed = 1;
+
+		sim.master = -1;
+		sim.slave = -1;
+		sim.dev_name = "flash0";
+		sim.baud = 115200;
+		sim.max_baud = 0;
+		sim.crc = false;
+		sim.switch_baud = 0;
+		sim.switch_at = 0;
+		sim.noise = 0.0;
+		sim.latency = 0.0;
+		sim.fifo = 0;
+		sim.typed_lost = 0;
+		sim.output_pos = 0;
+		sim.dumping = false;
+		sim.pace_sent = 0;
+		sim.commands_run = 0;
+		sim.line_seconds = 0.0;
+		sim.lines_damaged = 0;
+
+		for(int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+
+			if(arg == "run")
+			{
+				// Everything after 'run' is the fdump command line.
+				for(i++; i < argc; i++)
+				{
+					fdump_args.push_back(argv[i]);
+				}
+			}
+			else if(sim_has_prefix(arg, "image=")) image_name = sim_arg_value(arg);
+			else if(sim_has_prefix(arg, "dev=")) sim.dev_name = sim_arg_value(arg);
+			else if(sim_has_prefix(arg, "baud=")) sim.baud = (uint32_t)strtoul(sim_arg_value(arg).c_str(), nullptr, 10);
+			else if(sim_has_prefix(arg, "maxbaud=")) sim.max_baud = (uint32_t)strtoul(sim_arg_value(arg).c_str(), nullptr, 10);
+			else if(sim_has_prefix(arg, "crc=")) sim.crc = (strtoul(sim_arg_value(arg).c_str(), nullptr, 10) != 0);
+			else if(sim_has_prefix(arg, "noise=")) sim.noise = strtod(sim_arg_value(arg).c_str(), nullptr);
+			else if(sim_has_prefix(arg, "latency=")) sim.latency = strtod(sim_arg_value(arg).c_str(), nullptr) / 1000.0;
+			else if(sim_has_prefix(arg, "fifo=")) sim.fifo = (size_t)strtoul(sim_arg_value(arg).c_str(), nullptr, 10);
+			else if(sim_has_prefix(arg, "seed=")) seed = (uint32_t)strtoul(sim_arg_value(arg).c_str(), nullptr, 10);
+			else if(sim_has_prefix(arg, "link=")) link_name = sim_arg_value(arg);
+			else if(sim_has_prefix(arg, "log=")) log_name = sim_arg_value(arg);
+			else
+			{
+				std::cout << "Unknown argument: " << arg << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+
+		if(image_name.empty())
+		{
+			std::cout << "Usage: cfe_sim image=<file> [dev=flash0] [baud=115200] [noise=0] [seed=1] [maxbaud=0] [crc=0]" << std::endl;
+			std::cout << "                [latency=<ms>] [fifo=<chars>] [link=<path>] [log=<file>] [run <fdump> <fdump options>]" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		sim.rng.seed(seed);
+		sim.console_baud = (sim.baud > 0) ? sim.baud : 115200;
+
+		if(!sim_load_image(&sim, image_name) || !sim_open_pty(&sim))
+		{
+			return EXIT_FAILURE;
+		}
+
+		signal(SIGINT, &sim_sighandler);
+		signal(SIGTERM, &sim_sighandler);
+
+		int result = EXIT_SUCCESS;
+
+		if(!fdump_args.empty())
+		{
+			result = sim_run_benchmark(&sim, fdump_args, log_name);
+		}
+		else
+		{
+			if(!link_name.empty())
+			{
+				unlink(link_name.c_str());
+
+				if(symlink(sim.slave_name.c_str(), link_name.c_str()) != 0)
+				{
+					std::cout << "Linking " << link_name << "			[failed]	" << strerror(errno) << std::endl;
+				}
+			}
+
+			std::cout << "Serving " << sim.dev_name << " (" << sim.image.size() << " bytes) at " << sim.baud
+				<< " baud on " << sim.slave_name << std::endl;
+			std::cout << "  e.g. ./fdump tty=" << (link_name.empty() ? sim.slave_name : link_name)
+				<< " if=" << sim.dev_name << " offset=0 bs=4096 size=" << sim.image.size() << " of=out.bin -v" << std::endl;
+
+			while(sim_running)
+			{
+				sim_step(&sim, 100);
+			}
+
+			if(!link_name.empty())
+			{
+				unlink(link_name.c_str());
+			}
+
+			std::cout << "Ran " << sim.commands_run << " commands, damaged " << sim.lines_damaged << " lines." << std::endl;
+		}
+
+		close(sim.slave);
+		close(sim.master);
+
+		return result;
+	}
+#else
+	#include <iostream>
+
+	int main()
+	{
+		std::cout << "cfe_sim needs POSIX pseudo-terminals." << std::endl;
+		return 1;
+	}
+#endif
@@ -0,0 +1,440 @@
+// compress.cpp: gzip members written by a thread of their own, and reading them back by index.
+//
+// Writes only go forward, a compressed file can't be written into like a plain one, so blocks
+// have to come in order. A gap is filled with zeros, as it would read from a plain image.
+
+#include <iostream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#ifdef HAVE_ZLIB
+	#include <zlib.h>
+#endif
+
+#include "compress.h"
+
+bool compress_parse_type(const std::string& text, uint32_t* type)
+{
+	if(text == "gzip" || text == "gz")
+	{
+		*type = COMPRESS_GZIP;
+	}
+	else if(text == "none")
+	{
+		*type = COMPRESS_NONE;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static bool compress_ends_with(const std::string& name, const std::string& ext)
+{
+	return name.length() > ext.length() && name.compare(name.length() - ext.length(), ext.length(), ext) == 0;
+}
+
+uint32_t compress_type_for_name(const std::string& name)
+{
+	return compress_ends_with(name, COMPRESS_GZIP_EXT) ? COMPRESS_GZIP : COMPRESS_NONE;
+}
+
+// What the image is called once it is decompressed, for the digests and the manifest.
+std::string compress_image_name(const std::string& name, uint32_t type)
+{
+	if(type == COMPRESS_GZIP && compress_ends_with(name, COMPRESS_GZIP_EXT))
+	{
+		return name.substr(0, name.length() - COMPRESS_GZIP_EXT.length());
+	}
+
+	return name;
+}
+
+#ifdef HAVE_ZLIB
+static void compress_fail(compress_writer* writer)
+{
+	std::lock_guard<std::mutex> lock(writer->lock);
+
+	if(!writer->failed)
+	{
+		writer->failed = true;
+		writer->error = (errno != 0) ? errno : EIO;
+	}
+}
+
+// Takes chunks off the queue until it is closed and empty. After a failure they are only
+// dropped, so writes that wait on the queue still get to see it.
+static void compress_thread(compress_writer* writer)
+{
+	z_stream stream;
+	std::memset(&stream, 0, sizeof(stream));
+
+	// 16 added to the window bits asks for a gzip header and trailer.
+	bool ok = (deflateInit2(&stream, COMPRESS_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+	std::vector<uint8_t> out;
+
+	if(!ok)
+	{
+		errno = ENOMEM;
+		compress_fail(writer);
+	}
+
+	while(true)
+	{
+		compress_chunk chunk;
+		{
+			std::unique_lock<std::mutex> lock(writer->lock);
+			writer->changed.wait(lock, [writer] { return !writer->queue.empty() || writer->closing; });
+
+			if(writer->queue.empty())
+			{
+				break;
+			}
+
+			chunk = std::move(writer->queue.front());
+			writer->queue.pop_front();
+			ok = !writer->failed;
+		}
+
+		writer->changed.notify_all();
+
+		if(ok)
+		{
+			deflateReset(&stream);
+			out.resize(deflateBound(&stream, (uLong)chunk.data.size()));
+
+			stream.next_in = chunk.data.data();
+			stream.avail_in = (uInt)chunk.data.size();
+			stream.next_out = out.data();
+			stream.avail_out = (uInt)out.size();
+
+			// The bound is enough for one call to finish the member.
+			if(deflate(&stream, Z_FINISH) != Z_STREAM_END)
+			{
+				errno = EIO;
+				compress_fail(writer);
+			}
+			else
+			{
+				writer->file.write((const char*)out.data(), (std::streamsize)stream.total_out);
+				writer->index << chunk.offset << " " << chunk.data.size() << " " << writer->compressed_bytes
+					<< " " << stream.total_out << "\n";
+
+				if(writer->file.fail() || writer->index.fail())
+				{
+					compress_fail(writer);
+				}
+
+				writer->compressed_bytes += stream.total_out;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(writer->lock);
+			chunk.data.clear();
+			writer->spare.push_back(std::move(chunk.data));
+		}
+	}
+
+	deflateEnd(&stream);
+}
+#endif
+
+// Creates name and its index, and starts the thread.
+bool compress_open(compress_writer** writer, const std::string& name, uint32_t type)
+{
+	*writer = nullptr;
+
+#ifdef HAVE_ZLIB
+	if(type != COMPRESS_GZIP)
+	{
+		errno = EINVAL;
+		return false;
+	}
+
+	compress_writer* w = new compress_writer();
+	w->type = type;
+	w->name = name;
+	w->position = 0;
+	w->filling.offset = 0;
+	w->compressed_bytes = 0;
+	w->closing = false;
+	w->failed = false;
+	w->error = 0;
+
+	w->file.open(name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	w->index.open((name + COMPRESS_INDEX_EXT).c_str(), std::ios::out | std::ios::trunc);
+
+	if(!w->file.is_open() || !w->index.is_open())
+	{
+		delete w;
+		return false;
+	}
+
+	w->index << COMPRESS_INDEX_MAGIC << " " << COMPRESS_CHUNK_SIZE << "\n";
+	w->filling.data.reserve(COMPRESS_CHUNK_SIZE);
+	w->thread = std::thread(compress_thread, w);
+	*writer = w;
+
+	return true;
+#else
+	(void)name;
+	(void)type;
+
+	// Built without zlib.
+	errno = ENOTSUP;
+	return false;
+#endif
+}
+
+// Hands the full chunk to the thread and starts the next one, waits if the queue is full.
+static bool compress_queue_chunk(compress_writer* writer)
+{
+	std::unique_lock<std::mutex> lock(writer->lock);
+	writer->changed.wait(lock, [writer] { return writer->queue.size() < COMPRESS_QUEUE_MAX || writer->failed; });
+
+	if(writer->failed)
+	{
+		errno = writer->error;
+		return false;
+	}
+
+	uint64_t next = writer->filling.offset + writer->filling.data.size();
+	writer->queue.push_back(std::move(writer->filling));
+	writer->filling.offset = next;
+	writer->filling.data.clear();
+
+	if(!writer->spare.empty())
+	{
+		writer->filling.data = std::move(writer->spare.back());
+		writer->spare.pop_back();
+	}
+
+	lock.unlock();
+	writer->changed.notify_all();
+
+	writer->filling.data.reserve(COMPRESS_CHUNK_SIZE);
+
+	return true;
+}
+
+// Adds len bytes at position, which can't be before the end of what was written already.
+bool compress_write(compress_writer* writer, uint64_t position, const void* data, uint64_t len)
+{
+	if(position < writer->position)
+	{
+		errno = ESPIPE;
+		return false;
+	}
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t gap = position - writer->position;
+
+	while(gap + len > 0)
+	{
+		std::vector<uint8_t>& filling = writer->filling.data;
+		uint64_t room = COMPRESS_CHUNK_SIZE - filling.size();
+
+		if(gap > 0)
+		{
+			uint64_t zeros = std::min(gap, room);
+			filling.insert(filling.end(), (size_t)zeros, 0);
+			gap -= zeros;
+			writer->position += zeros;
+		}
+		else
+		{
+			uint64_t part = std::min(len, room);
+			filling.insert(filling.end(), bytes, bytes + part);
+			bytes += part;
+			len -= part;
+			writer->position += part;
+		}
+
+		if(filling.size() == COMPRESS_CHUNK_SIZE && !compress_queue_chunk(writer))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Compresses what is left, waits for the thread and frees the writer.
+// Returns false if any of it couldn't be written.
+bool compress_close(compress_writer* writer, uint64_t* compressed_bytes)
+{
+	bool ok = writer->filling.data.empty() || compress_queue_chunk(writer);
+
+	{
+		std::lock_guard<std::mutex> lock(writer->lock);
+		writer->closing = true;
+	}
+
+	writer->changed.notify_all();
+	writer->thread.join();
+
+	writer->file.close();
+	writer->index.close();
+
+	if(writer->failed)
+	{
+		errno = writer->error;
+		ok = false;
+	}
+	else if(writer->file.fail() || writer->index.fail())
+	{
+		errno = (errno != 0) ? errno : EIO;
+		ok = false;
+	}
+
+	*compressed_bytes = writer->compressed_bytes;
+	delete writer;
+
+	return ok;
+}
+
+#ifdef HAVE_ZLIB
+// One line of the index.
+struct compress_index_entry
+{
+	uint64_t offset;
+	uint64_t size;
+	uint64_t file_offset;
+	uint64_t file_size;
+};
+
+static bool compress_read_index(const std::string& index_name, std::vector<compress_index_entry>* entries)
+{
+	std::ifstream index(index_name.c_str());
+	std::string line;
+
+	if(!index.is_open())
+	{
+		return false;
+	}
+
+	if(!std::getline(index, line) || line.compare(0, COMPRESS_INDEX_MAGIC.length(), COMPRESS_INDEX_MAGIC) != 0)
+	{
+		std::cout << index_name << " is not an fdump index." << std::endl;
+		errno = EINVAL;
+		return false;
+	}
+
+	while(std::getline(index, line))
+	{
+		compress_index_entry entry;
+
+		if(!(std::istringstream(line) >> entry.offset >> entry.size >> entry.file_offset >> entry.file_size))
+		{
+			std::cout << index_name << ": damaged chunk record " << line << std::endl;
+			errno = EINVAL;
+			return false;
+		}
+
+		entries->push_back(entry);
+	}
+
+	return true;
+}
+#endif
+
+// Writes size bytes of the image from offset to of_name, 0 for the rest of it, only inflating
+// the chunks they are in.
+bool compress_extract(const std::string& name, uint64_t offset, uint64_t size, const std::string& of_name, uint64_t* extracted)
+{
+	*extracted = 0;
+
+#ifdef HAVE_ZLIB
+	std::vector<compress_index_entry> entries;
+
+	if(!compress_read_index(name + COMPRESS_INDEX_EXT, &entries))
+	{
+		return false;
+	}
+
+	std::ifstream file(name.c_str(), std::ios::in | std::ios::binary);
+	std::ofstream out(of_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if(!file.is_open() || !out.is_open())
+	{
+		return false;
+	}
+
+	uint64_t end = (size == 0) ? UINT64_MAX : offset + size;
+	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> chunk;
+	bool ok = true;
+
+	for(const compress_index_entry& entry : entries)
+	{
+		if(entry.offset + entry.size <= offset || entry.offset >= end)
+		{
+			continue;
+		}
+
+		compressed.resize(entry.file_size);
+		chunk.resize(entry.size);
+
+		file.seekg((std::streamoff)entry.file_offset);
+		file.read((char*)compressed.data(), (std::streamsize)entry.file_size);
+
+		if((uint64_t)file.gcount() != entry.file_size)
+		{
+			std::cout << name << " is shorter than its index." << std::endl;
+			errno = EINVAL;
+			ok = false;
+			break;
+		}
+
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+
+		if(inflateInit2(&stream, 15 + 16) != Z_OK)
+		{
+			errno = ENOMEM;
+			ok = false;
+			break;
+		}
+
+		stream.next_in = compressed.data();
+		stream.avail_in = (uInt)compressed.size();
+		stream.next_out = chunk.data();
+		stream.avail_out = (uInt)chunk.size();
+
+		int result = inflate(&stream, Z_FINISH);
+		uint64_t inflated = stream.total_out;
+		inflateEnd(&stream);
+
+		if(result != Z_STREAM_END || inflated != entry.size)
+		{
+			std::cout << name << ": damaged chunk at " << entry.offset << std::endl;
+			errno = EINVAL;
+			ok = false;
+			break;
+		}
+
+		uint64_t from = std::max(offset, entry.offset);
+		uint64_t to = std::min(end, entry.offset + entry.size);
+
+		out.write((const char*)chunk.data() + (from - entry.offset), (std::streamsize)(to - from));
+		*extracted += to - from;
+	}
+
+	out.close();
+
+	return ok && !out.fail();
+#else
+	(void)name;
+	(void)offset;
+	(void)size;
+	(void)of_name;
+
+	errno = ENOTSUP;
+	return false;
+#endif
+}
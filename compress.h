@@ -0,0 +1,70 @@
+// compress.h: of= written compressed, picked by its extension (.gz) or compress=gzip. The image
+// is cut into chunks of COMPRESS_CHUNK_SIZE that are compressed on their own and written one
+// after another as gzip members, which gzip -d and zcat read back as the one image. A thread
+// of its own does the compressing so the dump never waits on it, and each chunk's place goes in
+// a sidecar index, of.idx, so part of the image can be had without inflating what comes before:
+//   ./fdump unpack in=flash0.bin.gz offset=1048576 size=65536 of=part.bin
+// Mostly erased flash compresses to a small part of its size.
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+enum CompressType
+{
+	COMPRESS_NONE = 0,
+	COMPRESS_GZIP = 1
+};
+
+const uint32_t COMPRESS_CHUNK_SIZE = 1048576; // Image bytes per gzip member, what the index can seek to.
+const uint32_t COMPRESS_QUEUE_MAX = 4;	// Chunks waiting for the thread before writes wait on it.
+const int COMPRESS_LEVEL = 6;			// zlib's default, erased flash shrinks as far at 6 as at 9.
+const std::string COMPRESS_GZIP_EXT = ".gz";
+const std::string COMPRESS_INDEX_EXT = ".idx";
+const std::string COMPRESS_INDEX_MAGIC = "fdump-gzip-index 1"; // First line of the index, followed by the chunk size.
+
+// A chunk of the image on its way to the thread.
+struct compress_chunk
+{
+	uint64_t offset;			// In the image.
+	std::vector<uint8_t> data;
+};
+
+struct compress_writer
+{
+	uint32_t type;
+	std::string name;
+	std::ofstream file;
+	std::ofstream index;		// A line "<image offset> <length> <file offset> <compressed length>" per chunk.
+	uint64_t position;			// Image bytes taken so far, writes carry on from here.
+	compress_chunk filling;		// Not full yet, goes to the thread when it is.
+	uint64_t compressed_bytes;	// In the file so far.
+
+	// Shared with the thread.
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<compress_chunk> queue;
+	std::vector<std::vector<uint8_t>> spare; // Buffers the thread is done with, for the next chunks.
+	bool closing;
+	bool failed;
+	int error;					// errno of the write that failed.
+};
+
+bool compress_parse_type(const std::string& text, uint32_t* type);
+uint32_t compress_type_for_name(const std::string& name);
+std::string compress_image_name(const std::string& name, uint32_t type);
+bool compress_open(compress_writer** writer, const std::string& name, uint32_t type);
+bool compress_write(compress_writer* writer, uint64_t position, const void* data, uint64_t len);
+bool compress_close(compress_writer* writer, uint64_t* compressed_bytes);
+bool compress_extract(const std::string& name, uint64_t offset, uint64_t size, const std::string& of_name, uint64_t* extracted);
+
+#endif
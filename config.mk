@@ -16,12 +16,12 @@ DEBUG_FLAGS=-g
 
 #CXXFLAGS=-std=c++17 -Wall -pedantic $(SIZE_OPTIMIZATIONS_FLAG)
 CXXFLAGS=-std=c++17
-CXX_DEFINES=
+CXX_DEFINES=-D HAVE_ZLIB # Compressed of=, leave out with -lz to build without zlib.
 CXX_INCLUDES=-I$(IDIR)
-CXX_LIBRARIES= 
-LIBS=
+CXX_LIBRARIES=-lz
+LIBS=-pthread
 
-_OBJ=fdump.o uart_nix.o
+_OBJ=fdump.o uart_nix.o serial_rx.o line_parser.o hex_decode.o replay.o autobaud.o journal.o flash_block.o block_tuner.o dump_pipeline.o dump_session.o batch.o image_file.o digest.o diff.o compress.o stats.o progress.o console_out.o
 
 # GNU string replacement:
 #OBJ_DEBUG=$(patsubst %,$(ODIR)/%,$(DEBUG_NAME)/$(_OBJ))
@@ -50,6 +50,29 @@ OBJ_RELEASE=
 #OBJ_RELEASE=$(echo ${OBJECTS} | sed ${__EXPR})
 
 # Fallback:
-SOURCES=fdump.cpp uart_nix.cpp
-OBJ_DEBUG=$(ODIR)/$(DEBUG_NAME)/fdump.o $(ODIR)/$(DEBUG_NAME)/uart_nix.o
-OBJ_RELEASE=$(ODIR)/fdump.o $(ODIR)/uart_nix.o
+SOURCES=fdump.cpp uart_nix.cpp serial_rx.cpp line_parser.cpp hex_decode.cpp replay.cpp autobaud.cpp journal.cpp flash_block.cpp block_tuner.cpp dump_pipeline.cpp dump_session.cpp batch.cpp image_file.cpp digest.cpp diff.cpp compress.cpp stats.cpp progress.cpp console_out.cpp
+OBJ_DEBUG=$(ODIR)/$(DEBUG_NAME)/fdump.o $(ODIR)/$(DEBUG_NAME)/uart_nix.o $(ODIR)/$(DEBUG_NAME)/serial_rx.o $(ODIR)/$(DEBUG_NAME)/line_parser.o $(ODIR)/$(DEBUG_NAME)/hex_decode.o $(ODIR)/$(DEBUG_NAME)/replay.o $(ODIR)/$(DEBUG_NAME)/autobaud.o $(ODIR)/$(DEBUG_NAME)/journal.o $(ODIR)/$(DEBUG_NAME)/flash_block.o $(ODIR)/$(DEBUG_NAME)/block_tuner.o $(ODIR)/$(DEBUG_NAME)/dump_pipeline.o $(ODIR)/$(DEBUG_NAME)/dump_session.o $(ODIR)/$(DEBUG_NAME)/batch.o $(ODIR)/$(DEBUG_NAME)/image_file.o $(ODIR)/$(DEBUG_NAME)/digest.o $(ODIR)/$(DEBUG_NAME)/diff.o $(ODIR)/$(DEBUG_NAME)/compress.o $(ODIR)/$(DEBUG_NAME)/stats.o $(ODIR)/$(DEBUG_NAME)/progress.o $(ODIR)/$(DEBUG_NAME)/console_out.o
+OBJ_RELEASE=$(ODIR)/fdump.o $(ODIR)/uart_nix.o $(ODIR)/serial_rx.o $(ODIR)/line_parser.o $(ODIR)/hex_decode.o $(ODIR)/replay.o $(ODIR)/autobaud.o $(ODIR)/journal.o $(ODIR)/flash_block.o $(ODIR)/block_tuner.o $(ODIR)/dump_pipeline.o $(ODIR)/dump_session.o $(ODIR)/batch.o $(ODIR)/image_file.o $(ODIR)/digest.o $(ODIR)/diff.o $(ODIR)/compress.o $(ODIR)/stats.o $(ODIR)/progress.o $(ODIR)/console_out.o
+
+# Microbenchmarks, built with: make bench
+BENCH_NAME=fdump_bench
+BENCH_SOURCES=bench.cpp line_parser.cpp hex_decode.cpp uart_nix.cpp serial_rx.cpp flash_block.cpp dump_pipeline.cpp stats.cpp image_file.cpp compress.cpp digest.cpp journal.cpp console_out.cpp
+OBJ_BENCH=$(ODIR)/bench.o $(ODIR)/line_parser.o $(ODIR)/hex_decode.o $(ODIR)/uart_nix.o $(ODIR)/serial_rx.o $(ODIR)/flash_block.o $(ODIR)/dump_pipeline.o $(ODIR)/stats.o $(ODIR)/image_file.o $(ODIR)/compress.o $(ODIR)/digest.o $(ODIR)/journal.o $(ODIR)/console_out.o
+
+# CFE simulator on a pty, built with: make sim
+SIM_NAME=cfe_sim
+SIM_SOURCES=cfe_sim.cpp
+OBJ_SIM=$(ODIR)/cfe_sim.o
+
+# End to end benchmark of ./fdump against the simulator: make bench_e2e E2E_BAUD=921600
+E2E_IMAGE=$(ODIR)/e2e_image.bin
+E2E_KB=64
+E2E_BAUD=115200
+E2E_BS=16384
+E2E_NOISE=0
+
+# Noise test, fdump has to come out with the exact image or fail: make test_noise
+TEST_IMAGE=$(ODIR)/test_image.bin
+TEST_KB=64
+TEST_NOISE=0.01
+TEST_SEED=1
@@ -0,0 +1,354 @@
+// console_out.cpp: The console thread, and the std::cout buffer that feeds it.
+//
+// Text gathers in std::cout's buffer and is queued a line at a time, waking the thread. -l runs
+// are queued as the bytes themselves and only formatted on the thread, many lines to a write.
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cinttypes>
+
+#include "console_out.h"
+#include "line_parser.h"
+
+// A new item at the end of the queue, in a slot that keeps its buffer from the last item there,
+// or nullptr with the ring full. The lock must be held.
+static console_item* console_push(console_out* console, uint32_t kind, uint64_t offset)
+{
+	if(console->count == CONSOLE_ITEMS)
+	{
+		return nullptr;
+	}
+
+	console_item* item = &console->items[(console->first + console->count) % CONSOLE_ITEMS];
+	item->kind = kind;
+	item->offset = offset;
+	item->data.clear();
+	console->count++;
+
+	return item;
+}
+
+// The text at the end of the queue, if there is some the thread isn't writing out yet.
+// The lock must be held.
+static console_item* console_last_text(console_out* console)
+{
+	if(console->count == 0 || (console->count == 1 && console->writing))
+	{
+		return nullptr;
+	}
+
+	console_item* item = &console->items[(console->first + console->count - 1) % CONSOLE_ITEMS];
+
+	return (item->kind == CONSOLE_TEXT) ? item : nullptr;
+}
+
+// Adds to the text at the end of the queue, or starts it. Past CONSOLE_TEXT_MAX or with the
+// ring full it waits for the thread, unlike -l lines a message is never left out.
+static void console_text(console_out* console, const char* text, size_t len)
+{
+	{
+		std::unique_lock<std::mutex> lock(console->lock);
+		console_item* item;
+
+		while(true)
+		{
+			if(console->queued_text == 0 || console->queued_text + len <= CONSOLE_TEXT_MAX)
+			{
+				item = console_last_text(console);
+
+				if(item == nullptr)
+				{
+					item = console_push(console, CONSOLE_TEXT, 0);
+				}
+
+				if(item != nullptr)
+				{
+					break;
+				}
+			}
+
+			// What is queued may not have woken the thread yet, it hadn't ended a line.
+			console->changed.notify_all();
+			console->drained.wait(lock);
+		}
+
+		item->data.append(text, len);
+		console->queued_text += len;
+	}
+
+	// Most messages are written a piece at a time, the end of the line finishes one.
+	if(memchr(text, '\n', len) != nullptr)
+	{
+		console->changed.notify_all();
+	}
+}
+
+// Queues what std::cout has put in the buffer so far.
+void console_streambuf::flush_area()
+{
+	if(pptr() > pbase())
+	{
+		console_text(console, pbase(), (size_t)(pptr() - pbase()));
+		setp(area, area + CONSOLE_PUT_SIZE);
+	}
+}
+
+// Pieces go in the buffer, the end of a line sends it.
+std::streamsize console_streambuf::xsputn(const char* s, std::streamsize n)
+{
+	if(n > epptr() - pptr())
+	{
+		flush_area();
+	}
+
+	if(n > epptr() - pptr())
+	{
+		console_text(console, s, (size_t)n);
+		return n;
+	}
+
+	memcpy(pptr(), s, (size_t)n);
+	pbump((int)n);
+
+	if(memchr(s, '\n', (size_t)n) != nullptr)
+	{
+		flush_area();
+	}
+
+	return n;
+}
+
+// The buffer is full, or a character ends a line.
+console_streambuf::int_type console_streambuf::overflow(int_type c)
+{
+	flush_area();
+
+	if(!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+// std::flush and std::endl send the buffer and wake the thread, the terminal is its business.
+int console_streambuf::sync()
+{
+	flush_area();
+	console->changed.notify_all();
+	return 0;
+}
+
+static void console_write_out(console_out* console)
+{
+	if(!console->out.empty())
+	{
+		console->stdout_buffer->sputn(console->out.data(), (std::streamsize)console->out.size());
+		console->stdout_buffer->pubsync();
+		console->out.clear();
+	}
+}
+
+static void console_note_skipped(console_out* console)
+{
+	if(console->skipped_lines > 0)
+	{
+		char note[96];
+		snprintf(note, sizeof(note), "... %" PRIu64 " lines not shown, print_rate=%" PRIu32 "\n",
+			console->skipped_lines, console->print_rate);
+		console->out += note;
+		console->skipped_lines = 0;
+	}
+}
+
+// Formats the lines like hexdump, or with print_rate as many of the newest as it allows now.
+static void console_format(console_out* console, const console_item& item)
+{
+	const uint8_t* data = (const uint8_t*)item.data.data();
+	uint32_t len = (uint32_t)item.data.size();
+	uint32_t lines = (len + BYTES_PER_LINE - 1) / BYTES_PER_LINE;
+	uint32_t first = 0;
+
+	if(console->print_rate > 0)
+	{
+		// Saved up for at most a second.
+		auto now = std::chrono::steady_clock::now();
+		console->allowance = std::min((double)console->print_rate, console->allowance
+			+ std::chrono::duration<double>(now - console->allowed_at).count() * console->print_rate);
+		console->allowed_at = now;
+
+		uint32_t shown = std::min(lines, (uint32_t)console->allowance);
+		console->allowance -= shown;
+		first = lines - shown;
+		console->skipped_lines += first;
+
+		if(shown == 0)
+		{
+			return;
+		}
+	}
+
+	console_note_skipped(console);
+
+	char text[FORMATTED_LINE_MAX];
+
+	for(uint32_t i = first; i < lines; i++)
+	{
+		uint32_t line_len = std::min<uint32_t>(BYTES_PER_LINE, len - i * BYTES_PER_LINE);
+		uint32_t text_len = format_data_line(text, item.offset + i * BYTES_PER_LINE, data + i * BYTES_PER_LINE, line_len, nullptr);
+
+		console->out.append(text, text_len);
+		console->out += '\n';
+	}
+}
+
+// Takes items off the queue until it is closed and empty. What they come to is written once
+// the queue has run dry or there is CONSOLE_WRITE_SIZE of it.
+static void console_thread(console_out* console)
+{
+	while(true)
+	{
+		console_item* item;
+		uint64_t dropped;
+		bool more;
+		{
+			std::unique_lock<std::mutex> lock(console->lock);
+			console->changed.wait(lock, [console] { return console->count > 0 || console->closing; });
+
+			if(console->count == 0)
+			{
+				break;
+			}
+
+			// Stays in its slot, nothing is added to it while writing is set.
+			item = &console->items[console->first];
+			console->writing = true;
+
+			if(item->kind == CONSOLE_HEXDUMP)
+			{
+				console->queued_bytes -= item->data.size();
+			}
+			else
+			{
+				console->queued_text -= item->data.size();
+			}
+
+			dropped = console->dropped_lines;
+			console->dropped_lines = 0;
+			more = console->count > 1;
+		}
+
+		if(item->kind == CONSOLE_TEXT)
+		{
+			console->out += item->data;
+		}
+		else
+		{
+			console_format(console, *item);
+		}
+
+		if(dropped > 0)
+		{
+			char note[96];
+			snprintf(note, sizeof(note), "... %" PRIu64 " lines left out, the terminal is behind\n", dropped);
+			console->out += note;
+		}
+
+		if(!more || console->out.size() >= CONSOLE_WRITE_SIZE)
+		{
+			console_write_out(console);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(console->lock);
+			item->data.clear();
+			console->first = (console->first + 1) % CONSOLE_ITEMS;
+			console->count--;
+			console->writing = false;
+		}
+
+		console->drained.notify_all();
+	}
+
+	console_note_skipped(console);
+	console_write_out(console);
+}
+
+// Starts the thread and points std::cout at it.
+void console_open(console_out** console, uint32_t print_rate)
+{
+	console_out* c = new console_out();
+	c->buffer.console = c;
+	c->print_rate = print_rate;
+	c->allowance = print_rate;
+	c->allowed_at = std::chrono::steady_clock::now();
+	c->skipped_lines = 0;
+	c->queued_bytes = 0;
+	c->dropped_lines = 0;
+	c->queued_text = 0;
+	c->first = 0;
+	c->count = 0;
+	c->writing = false;
+	c->closing = false;
+	c->out.reserve(CONSOLE_WRITE_SIZE);
+
+	std::cout.flush();
+	c->stdout_buffer = std::cout.rdbuf(&c->buffer);
+	c->thread = std::thread(console_thread, c);
+
+	*console = c;
+}
+
+// Queues len bytes from offset to be printed like hexdump. Never waits: if the terminal is
+// CONSOLE_QUEUE_MAX behind or the ring is full, the lines are only counted.
+void console_hexdump(console_out* console, uint64_t offset, const uint8_t* data, uint32_t len)
+{
+	{
+		std::lock_guard<std::mutex> lock(console->lock);
+
+		// One run always goes in, however long, so a large bs= still prints.
+		if(console->queued_bytes > 0 && console->queued_bytes + len > CONSOLE_QUEUE_MAX)
+		{
+			console->dropped_lines += (len + BYTES_PER_LINE - 1) / BYTES_PER_LINE;
+			return;
+		}
+
+		console_item* item = console_push(console, CONSOLE_HEXDUMP, offset);
+
+		if(item == nullptr)
+		{
+			console->dropped_lines += (len + BYTES_PER_LINE - 1) / BYTES_PER_LINE;
+			return;
+		}
+
+		item->data.assign((const char*)data, len);
+		console->queued_bytes += len;
+	}
+
+	console->changed.notify_all();
+}
+
+// Writes out everything queued, waits for the thread and gives std::cout back.
+void console_close(console_out* console)
+{
+	if(console == nullptr)
+	{
+		return;
+	}
+
+	std::cout.flush();
+
+	{
+		std::lock_guard<std::mutex> lock(console->lock);
+		console->closing = true;
+	}
+
+	console->changed.notify_all();
+	console->thread.join();
+
+	std::cout.rdbuf(console->stdout_buffer);
+	delete console;
+}
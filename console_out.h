@@ -0,0 +1,92 @@
+// console_out.h: The console written by a thread of its own during a dump, with -l or -v.
+// While it is open std::cout goes into a queue instead of to the terminal, and -l hands it
+// whole runs of lines that the thread formats like hexdump and writes out in large pieces,
+// so a slow terminal (over ssh, say) never holds up the dump. Queued -l data is bounded: if
+// the terminal falls that far behind, lines are left out and counted rather than waited on.
+// print_rate=N shows at most N -l lines a second, the newest of each block. Messages are
+// never left out: past CONSOLE_TEXT_MAX queued, or with the queue full, writing one waits for
+// the thread to catch up, so a FAIL line always makes it to the terminal. std::cout
+// fills a small buffer of its own and only takes the lock a line at a time, so while the
+// console is open it is written from the main thread only.
+
+#ifndef CONSOLE_OUT_H
+#define CONSOLE_OUT_H
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+enum ConsoleItemKind
+{
+	CONSOLE_TEXT = 0,
+	CONSOLE_HEXDUMP = 1
+};
+
+const uint32_t CONSOLE_QUEUE_MAX = 1048576; // Bytes of -l data queued before lines are left out, some 5 MB of text.
+const uint32_t CONSOLE_WRITE_SIZE = 65536; // Formatted text is written out in pieces of about this.
+const uint32_t CONSOLE_TEXT_MAX = 1048576; // Bytes of messages queued before writing more waits.
+const uint32_t CONSOLE_ITEMS = 64;	// Slots in the queue, -l runs past them are left out, messages wait.
+const uint32_t CONSOLE_PUT_SIZE = 1024; // std::cout's buffer, handed to the queue at the end of each line.
+
+// Something on its way to the terminal.
+struct console_item
+{
+	uint32_t kind;				// ConsoleItemKind
+	uint64_t offset;			// Flash offset of the first line, for CONSOLE_HEXDUMP.
+	std::string data;			// The text, or the bytes to print like hexdump.
+};
+
+struct console_out;
+
+// What std::cout writes into while the console is open.
+struct console_streambuf : public std::streambuf
+{
+	console_out* console;
+	char area[CONSOLE_PUT_SIZE];
+
+	console_streambuf() { setp(area, area + CONSOLE_PUT_SIZE); }
+
+protected:
+	void flush_area();
+	std::streamsize xsputn(const char* s, std::streamsize n) override;
+	int_type overflow(int_type c) override;
+	int sync() override;
+};
+
+struct console_out
+{
+	console_streambuf buffer;
+	std::streambuf* stdout_buffer; // std::cout's own, the thread writes with it.
+	uint32_t print_rate;		// Most -l lines a second, 0 for all of them.
+
+	// The thread's own.
+	std::string out;			// Formatted, not written yet.
+	double allowance;			// -l lines that may be shown now with print_rate.
+	std::chrono::steady_clock::time_point allowed_at;
+	uint64_t skipped_lines;		// Not shown because of print_rate, since the last one that was.
+
+	// Shared with the thread.
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::condition_variable drained; // The thread is done with an item, for messages waiting on room.
+	console_item items[CONSOLE_ITEMS]; // A ring, each slot keeps its buffer for the next item in it.
+	uint32_t first;				// Oldest item in the ring.
+	uint32_t count;				// Items in the ring, the first is being written out while writing is set.
+	bool writing;
+	uint64_t queued_bytes;		// Of CONSOLE_HEXDUMP data in the queue.
+	uint64_t dropped_lines;		// -l lines left out with the queue full, not reported yet.
+	uint64_t queued_text;		// Of CONSOLE_TEXT in the queue.
+	bool closing;
+};
+
+void console_open(console_out** console, uint32_t print_rate);
+void console_hexdump(console_out* console, uint64_t offset, const uint8_t* data, uint32_t len);
+void console_close(console_out* console);
+
+#endif
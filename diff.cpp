@@ -0,0 +1,451 @@
+// diff.cpp: Reference copy, sample placement and comparison, deltas.
+//
+// Offsets here are in the image, from the start of the dump range. A delta is a text header
+// line with the image size, then per region a line "<offset> <length>" and its raw bytes.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <algorithm>
+#include <cstdlib>
+
+#include "diff.h"
+#include "image_file.h"
+#include "journal.h"
+#include "line_parser.h"
+
+// Checksum commands of CFE builds that have one, the first word of their line in help.
+static const std::string DIFF_CRC_COMMANDS[] =
+{
+	"crc32",
+	"crc"
+};
+
+bool diff_reference_size(const std::string& ref_name, uint64_t* ref_size)
+{
+	std::ifstream ref(ref_name.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+
+	if(!ref.is_open())
+	{
+		return false;
+	}
+
+	*ref_size = (uint64_t)ref.tellg();
+
+	return true;
+}
+
+// Makes of= a copy of the first size bytes of the reference, or all of it if it is shorter.
+bool diff_copy_reference(const std::string& ref_name, const std::string& of_name, uint64_t size, uint64_t* ref_size)
+{
+	if(!diff_reference_size(ref_name, ref_size))
+	{
+		return false;
+	}
+
+	std::ifstream ref(ref_name.c_str(), std::ios::in | std::ios::binary);
+	image_file image;
+	image_init(&image);
+
+	if(!image_open(&image, of_name, size, false))
+	{
+		return false;
+	}
+
+	std::vector<char> chunk(DIFF_COPY_SIZE);
+	uint64_t position = 0;
+	uint64_t end = std::min(*ref_size, size);
+	bool ok = true;
+
+	while(ok && position < end)
+	{
+		ref.read(chunk.data(), (std::streamsize)std::min<uint64_t>(end - position, chunk.size()));
+		ok = (ref.gcount() > 0) && image_write(&image, position, chunk.data(), (uint64_t)ref.gcount());
+		position += (uint64_t)ref.gcount();
+	}
+
+	return image_close(&image) && ok;
+}
+
+// Makes of= size bytes of erased flash, the reference for probe.
+bool diff_fill_erased(const std::string& of_name, uint64_t size)
+{
+	image_file image;
+	image_init(&image);
+
+	if(!image_open(&image, of_name, size, false))
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> erased(DIFF_COPY_SIZE, ERASED_BYTE);
+	bool ok = true;
+
+	for(uint64_t position = 0; ok && position < size; position += erased.size())
+	{
+		ok = image_write(&image, position, erased.data(), std::min<uint64_t>(size - position, erased.size()));
+	}
+
+	return image_close(&image) && ok;
+}
+
+// Every region the reference has in full, whole, to compare an image read in full with it.
+void diff_region_extents(uint64_t size, uint64_t ref_size, uint64_t region_size, std::vector<dump_extent>* extents)
+{
+	extents->clear();
+
+	for(uint64_t start = 0; start < size && start + std::min(region_size, size - start) <= ref_size; start += region_size)
+	{
+		extents->push_back({ start, std::min(region_size, size - start) });
+	}
+}
+
+// Spots to read from each region the reference has in full, spread out so the first and the
+// last bytes of the region are among them. A region no bigger than its samples is read whole.
+// The others are left out, they are read in full anyway.
+void diff_sample_extents(uint64_t size, uint64_t ref_size, uint64_t region_size, uint32_t samples,
+	std::vector<dump_extent>* extents)
+{
+	extents->clear();
+
+	for(uint64_t start = 0; start < size; start += region_size)
+	{
+		uint64_t length = std::min(region_size, size - start);
+
+		if(start + length > ref_size)
+		{
+			break;
+		}
+
+		if(length <= (uint64_t)samples * DIFF_SAMPLE_SIZE || samples <= 1)
+		{
+			extents->push_back({ start, std::min(length, (uint64_t)samples * DIFF_SAMPLE_SIZE) });
+			continue;
+		}
+
+		size_t first = extents->size();
+
+		for(uint32_t k = 0; k < samples; k++)
+		{
+			// On a line, so the last one may reach back a little.
+			uint64_t spot = start + ((length - DIFF_SAMPLE_SIZE) * k / (samples - 1)) / 16 * 16;
+			uint64_t spot_size = std::min((uint64_t)DIFF_SAMPLE_SIZE, start + length - spot);
+
+			if(extents->size() > first && extents->back().offset + extents->back().size >= spot)
+			{
+				// Runs into the one before, samples never join across regions so each tells on its own.
+				dump_extent& last = extents->back();
+				last.size = std::max(last.offset + last.size, spot + spot_size) - last.offset;
+			}
+			else
+			{
+				extents->push_back({ spot, spot_size });
+			}
+		}
+	}
+}
+
+static bool diff_read_at(std::ifstream& file, uint64_t position, char* data, uint64_t len)
+{
+	file.clear();
+	file.seekg((std::streamoff)position);
+	file.read(data, (std::streamsize)len);
+
+	return (uint64_t)file.gcount() == len;
+}
+
+// The regions to read in full: any with a sample that differs from the reference, and those
+// the reference doesn't have in full. Regions next to each other are joined. An empty
+// ref_name is erased flash.
+bool diff_changed_extents(const std::string& of_name, const std::string& ref_name, uint64_t size, uint64_t ref_size,
+	uint64_t region_size, const std::vector<dump_extent>& samples, std::vector<dump_extent>* changed)
+{
+	std::ifstream image(of_name.c_str(), std::ios::in | std::ios::binary);
+	std::ifstream ref;
+
+	if(!ref_name.empty())
+	{
+		ref.open(ref_name.c_str(), std::ios::in | std::ios::binary);
+	}
+
+	if(!image.is_open() || (!ref_name.empty() && !ref.is_open()))
+	{
+		return false;
+	}
+
+	uint64_t regions = (size + region_size - 1) / region_size;
+	std::vector<bool> differs(regions, false);
+	std::vector<char> sampled;
+	std::vector<char> expected;
+
+	for(uint64_t region = 0; region < regions; region++)
+	{
+		differs[region] = (std::min(size, (region + 1) * region_size) > ref_size);
+	}
+
+	for(const dump_extent& sample : samples)
+	{
+		sampled.resize(sample.size);
+		expected.resize(sample.size);
+
+		if(ref_name.empty())
+		{
+			std::fill(expected.begin(), expected.end(), (char)ERASED_BYTE);
+		}
+		else if(!diff_read_at(ref, sample.offset, expected.data(), sample.size))
+		{
+			return false;
+		}
+
+		if(!diff_read_at(image, sample.offset, sampled.data(), sample.size))
+		{
+			return false;
+		}
+
+		if(sampled != expected)
+		{
+			differs[sample.offset / region_size] = true;
+		}
+	}
+
+	changed->clear();
+
+	for(uint64_t region = 0; region < regions; region++)
+	{
+		if(!differs[region])
+		{
+			continue;
+		}
+
+		uint64_t start = region * region_size;
+		uint64_t length = std::min(region_size, size - start);
+
+		if(!changed->empty() && changed->back().offset + changed->back().size == start)
+		{
+			changed->back().size += length;
+		}
+		else
+		{
+			changed->push_back({ start, length });
+		}
+	}
+
+	return true;
+}
+
+// Looks through help for a checksum command. Only without the reader thread.
+bool diff_find_crc_command(rx_buffer* rx, std::string* command)
+{
+	std::vector<std::string> lines;
+
+	if(!rx_command(rx, DIFF_HELP_CMD, &lines))
+	{
+		return false;
+	}
+
+	for(const std::string& line : lines)
+	{
+		std::string name = line.substr(0, line.find_first_of(WHITESPACE));
+
+		for(const std::string& known : DIFF_CRC_COMMANDS)
+		{
+			if(name == known)
+			{
+				*command = known;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// The last word of the reply that is a CRC32 in hex, with or without 0x. The echo is left out.
+static bool diff_parse_crc(const std::vector<std::string>& lines, uint32_t* crc)
+{
+	bool found = false;
+
+	for(size_t i = 1; i < lines.size(); i++)
+	{
+		std::istringstream words(lines[i]);
+		std::string word;
+
+		while(words >> word)
+		{
+			if(word.compare(0, 2, "0x") == 0 || word.compare(0, 2, "0X") == 0)
+			{
+				word = word.substr(2);
+			}
+
+			if(word.length() == DIFF_CRC_DIGITS && word.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos)
+			{
+				*crc = (uint32_t)strtoul(word.c_str(), nullptr, 16);
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+// The regions to read in full: any whose CRC32 from CFE's checksum command isn't the one of
+// the same bytes in of=, and those the reference doesn't have in full. A reply that is lost
+// or can't be made out counts as a change, so a bad line only costs a read. Regions next to
+// each other are joined. Only false if of= can't be read.
+bool diff_crc_extents(rx_buffer* rx, const std::string& command, const std::string& device_name, uint64_t device_offset,
+	const std::string& of_name, uint64_t size, uint64_t ref_size, uint64_t region_size, std::vector<dump_extent>* changed)
+{
+	std::ifstream image(of_name.c_str(), std::ios::in | std::ios::binary);
+
+	if(!image.is_open())
+	{
+		return false;
+	}
+
+	std::vector<std::string> lines;
+	std::vector<char> region(region_size);
+
+	changed->clear();
+
+	for(uint64_t start = 0; start < size; start += region_size)
+	{
+		uint64_t length = std::min(region_size, size - start);
+		bool differs = (start + length > ref_size);
+
+		if(!differs)
+		{
+			std::string crc_cmd = command + " " + FDUMP_CMD_ARG_OFFSET + std::to_string(device_offset + start)
+				+ " " + FDUMP_CMD_ARG_SIZE + std::to_string(length) + " " + device_name;
+			uint32_t crc = 0;
+
+			if(!diff_read_at(image, start, region.data(), length))
+			{
+				return false;
+			}
+
+			differs = !rx_command(rx, crc_cmd, &lines) || !diff_parse_crc(lines, &crc)
+				|| crc != crc32_update(0, (const uint8_t*)region.data(), length);
+		}
+
+		if(!differs)
+		{
+			continue;
+		}
+
+		if(!changed->empty() && changed->back().offset + changed->back().size == start)
+		{
+			changed->back().size += length;
+		}
+		else
+		{
+			changed->push_back({ start, length });
+		}
+	}
+
+	return true;
+}
+
+// The changed regions as they are in the finished image.
+bool diff_write_delta(const std::string& delta_name, const std::string& of_name, uint64_t size,
+	const std::vector<dump_extent>& changed)
+{
+	std::ifstream image(of_name.c_str(), std::ios::in | std::ios::binary);
+	std::ofstream delta(delta_name.c_str(), std::ios::out | std::ios::binary);
+
+	if(!image.is_open() || !delta.is_open())
+	{
+		return false;
+	}
+
+	delta << DELTA_MAGIC << " " << size << "\n";
+
+	std::vector<char> chunk(DIFF_COPY_SIZE);
+
+	for(const dump_extent& extent : changed)
+	{
+		delta << extent.offset << " " << extent.size << "\n";
+
+		for(uint64_t done = 0; done < extent.size; )
+		{
+			uint64_t len = std::min<uint64_t>(extent.size - done, chunk.size());
+
+			if(!diff_read_at(image, extent.offset + done, chunk.data(), len))
+			{
+				return false;
+			}
+
+			delta.write(chunk.data(), (std::streamsize)len);
+			done += len;
+		}
+	}
+
+	delta.close();
+
+	return !delta.fail();
+}
+
+// Rebuilds the image a delta was made for from its reference.
+bool diff_apply_delta(const std::string& ref_name, const std::string& delta_name, const std::string& of_name, uint64_t* patched)
+{
+	std::ifstream delta(delta_name.c_str(), std::ios::in | std::ios::binary);
+	std::string line;
+	uint64_t size = 0;
+	uint64_t ref_size = 0;
+
+	*patched = 0;
+
+	if(!delta.is_open())
+	{
+		return false;
+	}
+
+	if(!std::getline(delta, line) || line.compare(0, DELTA_MAGIC.length(), DELTA_MAGIC) != 0
+		|| !(std::istringstream(line.substr(DELTA_MAGIC.length())) >> size))
+	{
+		std::cout << delta_name << " is not an fdump delta." << std::endl;
+		errno = EINVAL;
+		return false;
+	}
+
+	if(!diff_copy_reference(ref_name, of_name, size, &ref_size))
+	{
+		return false;
+	}
+
+	image_file image;
+	image_init(&image);
+
+	if(!image_open(&image, of_name, size, true))
+	{
+		return false;
+	}
+
+	std::vector<char> chunk(DIFF_COPY_SIZE);
+	bool ok = true;
+
+	while(ok && std::getline(delta, line))
+	{
+		uint64_t offset = 0;
+		uint64_t length = 0;
+
+		if(!(std::istringstream(line) >> offset >> length) || offset + length > size)
+		{
+			std::cout << delta_name << ": damaged region record " << line << std::endl;
+			errno = EINVAL;
+			ok = false;
+			break;
+		}
+
+		for(uint64_t done = 0; ok && done < length; )
+		{
+			delta.read(chunk.data(), (std::streamsize)std::min<uint64_t>(length - done, chunk.size()));
+			ok = (delta.gcount() > 0) && image_write(&image, offset + done, chunk.data(), (uint64_t)delta.gcount());
+			done += (uint64_t)delta.gcount();
+		}
+
+		*patched += length;
+	}
+
+	return image_close(&image) && ok;
+}
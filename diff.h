@@ -0,0 +1,46 @@
+// diff.h: Dumps against a reference image, ref=old.bin, and the regions that changed since.
+// If help lists a checksum command, the reference is copied to of=, CFE's CRC32 of each region
+// is compared with the copy's and only the regions that differ are read over it. Without one
+// the whole range is read and then compared with the reference region by region. With sampled
+// a few short spots of every region are read over the copy instead, and only the regions where
+// a spot differs are read in full. A change that no spot lands on is missed, so such an image
+// is unverified and fdump exits with EXIT_UNVERIFIED unless verify= vouches for it. With delta=
+// the regions that changed also go to a small file that patch puts on top of the reference:
+//   ./fdump patch ref=old.bin in=new.delta of=new.bin
+// probe does the same against erased flash instead of a reference, so regions that are all
+// 0xff aren't read at all. Sampled, it is unverified the same way.
+
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "dump_session.h"
+#include "serial_rx.h"
+
+const uint64_t DIFF_REGION_SIZE = 65536; // Default region= that is read whole if it differs, a typical erase block.
+const uint32_t DIFF_SAMPLES = 4;		// Default samples= read from each region.
+const uint32_t DIFF_SAMPLE_SIZE = 64;	// Bytes in one sample, four fdump lines.
+const uint32_t DIFF_COPY_SIZE = 1048576; // Chunk for copying and comparing files.
+const std::string DELTA_MAGIC = "fdump-delta 1"; // First line of a delta, followed by the image size.
+const std::string DIFF_HELP_CMD = "help"; // Lists the console commands, searched for a checksum command.
+const uint32_t DIFF_CRC_DIGITS = 8; // A CRC32 in hex, the last word of the reply that is one.
+
+bool diff_copy_reference(const std::string& ref_name, const std::string& of_name, uint64_t size, uint64_t* ref_size);
+bool diff_fill_erased(const std::string& of_name, uint64_t size);
+bool diff_reference_size(const std::string& ref_name, uint64_t* ref_size);
+void diff_region_extents(uint64_t size, uint64_t ref_size, uint64_t region_size, std::vector<dump_extent>* extents);
+void diff_sample_extents(uint64_t size, uint64_t ref_size, uint64_t region_size, uint32_t samples,
+	std::vector<dump_extent>* extents);
+bool diff_changed_extents(const std::string& of_name, const std::string& ref_name, uint64_t size, uint64_t ref_size,
+	uint64_t region_size, const std::vector<dump_extent>& samples, std::vector<dump_extent>* changed);
+bool diff_find_crc_command(rx_buffer* rx, std::string* command);
+bool diff_crc_extents(rx_buffer* rx, const std::string& command, const std::string& device_name, uint64_t device_offset,
+	const std::string& of_name, uint64_t size, uint64_t ref_size, uint64_t region_size, std::vector<dump_extent>* changed);
+bool diff_write_delta(const std::string& delta_name, const std::string& of_name, uint64_t size,
+	const std::vector<dump_extent>& changed);
+bool diff_apply_delta(const std::string& ref_name, const std::string& delta_name, const std::string& of_name, uint64_t* patched);
+
+#endif
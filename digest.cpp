@@ -0,0 +1,510 @@
+// digest.cpp: CRC-32, SHA-256 (FIPS 180-4) and XXH64, fed a block at a time.
+//
+// Each digest keeps what doesn't fill its next input block in its own buffer, digest_hex()
+// finishes a copy of the state so hashing can go on after it.
+
+#include <iostream>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "digest.h"
+#include "journal.h"
+
+static const uint32_t SHA256_K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t XXH64_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH64_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH64_PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH64_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH64_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint32_t rotr32(uint32_t x, uint32_t n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline uint64_t rotl64(uint64_t x, uint32_t n)
+{
+	return (x << n) | (x >> (64 - n));
+}
+
+static inline uint32_t read_be32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint32_t read_le32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t read_le64(const uint8_t* p)
+{
+	return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static void sha256_init(sha256_state* state)
+{
+	static const uint32_t H0[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(state->h, H0, sizeof(H0));
+	state->buffered = 0;
+	state->bytes = 0;
+}
+
+static void sha256_block(sha256_state* state, const uint8_t* block)
+{
+	uint32_t w[64];
+
+	for(int i = 0; i < 16; i++)
+	{
+		w[i] = read_be32(block + i * 4);
+	}
+
+	for(int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state->h[0], b = state->h[1], c = state->h[2], d = state->h[3];
+	uint32_t e = state->h[4], f = state->h[5], g = state->h[6], h = state->h[7];
+
+	for(int i = 0; i < 64; i++)
+	{
+		uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+		uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+		uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+		uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state->h[0] += a;
+	state->h[1] += b;
+	state->h[2] += c;
+	state->h[3] += d;
+	state->h[4] += e;
+	state->h[5] += f;
+	state->h[6] += g;
+	state->h[7] += h;
+}
+
+static void sha256_update(sha256_state* state, const uint8_t* data, size_t len)
+{
+	state->bytes += len;
+
+	if(state->buffered > 0)
+	{
+		size_t take = std::min<size_t>(64 - state->buffered, len);
+
+		memcpy(state->buffer + state->buffered, data, take);
+		state->buffered += (uint32_t)take;
+		data += take;
+		len -= take;
+
+		if(state->buffered < 64)
+		{
+			return;
+		}
+
+		sha256_block(state, state->buffer);
+		state->buffered = 0;
+	}
+
+	for(; len >= 64; data += 64, len -= 64)
+	{
+		sha256_block(state, data);
+	}
+
+	memcpy(state->buffer, data, len);
+	state->buffered = (uint32_t)len;
+}
+
+static std::string sha256_hex(sha256_state state)
+{
+	uint64_t bits = state.bytes * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t pad_len = (state.buffered < 56) ? 56 - state.buffered : 120 - state.buffered;
+
+	for(int i = 0; i < 8; i++)
+	{
+		pad[pad_len + i] = (uint8_t)(bits >> (56 - i * 8));
+	}
+
+	sha256_update(&state, pad, pad_len + 8);
+
+	char hex[65];
+
+	for(int i = 0; i < 8; i++)
+	{
+		snprintf(hex + i * 8, 9, "%08x", state.h[i]);
+	}
+
+	return hex;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	return rotl64(acc + input * XXH64_PRIME2, 31) * XXH64_PRIME1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t value)
+{
+	return (acc ^ xxh64_round(0, value)) * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+static void xxh64_init(xxh64_state* state)
+{
+	// Seed 0, like xxhsum.
+	state->v[0] = XXH64_PRIME1 + XXH64_PRIME2;
+	state->v[1] = XXH64_PRIME2;
+	state->v[2] = 0;
+	state->v[3] = 0 - XXH64_PRIME1;
+	state->buffered = 0;
+	state->bytes = 0;
+}
+
+static inline void xxh64_stripe(xxh64_state* state, const uint8_t* p)
+{
+	for(int i = 0; i < 4; i++)
+	{
+		state->v[i] = xxh64_round(state->v[i], read_le64(p + i * 8));
+	}
+}
+
+static void xxh64_update(xxh64_state* state, const uint8_t* data, size_t len)
+{
+	state->bytes += len;
+
+	if(state->buffered > 0)
+	{
+		size_t take = std::min<size_t>(32 - state->buffered, len);
+
+		memcpy(state->buffer + state->buffered, data, take);
+		state->buffered += (uint32_t)take;
+		data += take;
+		len -= take;
+
+		if(state->buffered < 32)
+		{
+			return;
+		}
+
+		xxh64_stripe(state, state->buffer);
+		state->buffered = 0;
+	}
+
+	for(; len >= 32; data += 32, len -= 32)
+	{
+		xxh64_stripe(state, data);
+	}
+
+	memcpy(state->buffer, data, len);
+	state->buffered = (uint32_t)len;
+}
+
+static std::string xxh64_hex(const xxh64_state* state)
+{
+	uint64_t h;
+
+	if(state->bytes >= 32)
+	{
+		h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+
+		for(int i = 0; i < 4; i++)
+		{
+			h = xxh64_merge(h, state->v[i]);
+		}
+	}
+	else
+	{
+		h = XXH64_PRIME5;
+	}
+
+	h += state->bytes;
+
+	const uint8_t* p = state->buffer;
+	const uint8_t* end = state->buffer + state->buffered;
+
+	for(; p + 8 <= end; p += 8)
+	{
+		h ^= xxh64_round(0, read_le64(p));
+		h = rotl64(h, 27) * XXH64_PRIME1 + XXH64_PRIME4;
+	}
+
+	if(p + 4 <= end)
+	{
+		h ^= (uint64_t)read_le32(p) * XXH64_PRIME1;
+		h = rotl64(h, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+		p += 4;
+	}
+
+	for(; p < end; p++)
+	{
+		h ^= *p * XXH64_PRIME5;
+		h = rotl64(h, 11) * XXH64_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH64_PRIME2;
+	h ^= h >> 29;
+	h *= XXH64_PRIME3;
+	h ^= h >> 32;
+
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+
+	return hex;
+}
+
+static uint32_t digest_type_of(std::string name)
+{
+	for(char& c : name)
+	{
+		c = (char)tolower((unsigned char)c);
+	}
+
+	if(name == "crc32")
+	{
+		return DIGEST_CRC32;
+	}
+	else if(name == "sha256")
+	{
+		return DIGEST_SHA256;
+	}
+	else if(name == "xxh64" || name == "xxhash")
+	{
+		return DIGEST_XXH64;
+	}
+
+	return 0;
+}
+
+// Comma separated names for hash=, all for every one.
+bool digest_parse_types(const std::string& list, uint32_t* types)
+{
+	*types = 0;
+
+	if(list == "all")
+	{
+		*types = DIGEST_ALL;
+		return true;
+	}
+
+	size_t start = 0;
+
+	while(start <= list.length())
+	{
+		size_t comma = std::min(list.find(',', start), list.length());
+		uint32_t type = digest_type_of(list.substr(start, comma - start));
+
+		if(type == 0)
+		{
+			return false;
+		}
+
+		*types |= type;
+		start = comma + 1;
+	}
+
+	return true;
+}
+
+// name:hex for verify=, the hex has to be as long as the digest.
+bool digest_parse_expected(const std::string& text, uint32_t* type, std::string* hex)
+{
+	size_t colon = text.find(':');
+
+	if(colon == std::string::npos)
+	{
+		return false;
+	}
+
+	*type = digest_type_of(text.substr(0, colon));
+	*hex = text.substr(colon + 1);
+
+	size_t expected_length = (*type == DIGEST_CRC32) ? 8 : (*type == DIGEST_SHA256) ? 64 : 16;
+
+	if(*type == 0 || hex->length() != expected_length)
+	{
+		return false;
+	}
+
+	for(char& c : *hex)
+	{
+		if(!isxdigit((unsigned char)c))
+		{
+			return false;
+		}
+
+		c = (char)tolower((unsigned char)c);
+	}
+
+	return true;
+}
+
+// The tag in the manifest, as sha256sum --tag and xxhsum --tag write it.
+const char* digest_name(uint32_t type)
+{
+	switch(type)
+	{
+		case DIGEST_CRC32: return "CRC32";
+		case DIGEST_SHA256: return "SHA256";
+		case DIGEST_XXH64: return "XXH64";
+	}
+
+	return "";
+}
+
+void digest_init(digest_set* set, uint32_t types)
+{
+	set->types = types;
+	set->crc = 0;
+	set->bytes = 0;
+	sha256_init(&set->sha256);
+	xxh64_init(&set->xxh64);
+}
+
+void digest_update(digest_set* set, const uint8_t* data, size_t len)
+{
+	set->bytes += len;
+
+	if(set->types & DIGEST_CRC32)
+	{
+		set->crc = crc32_update(set->crc, data, len);
+	}
+
+	if(set->types & DIGEST_SHA256)
+	{
+		sha256_update(&set->sha256, data, len);
+	}
+
+	if(set->types & DIGEST_XXH64)
+	{
+		xxh64_update(&set->xxh64, data, len);
+	}
+}
+
+// Hashes the first len bytes of a file, for what is in the image from before.
+bool digest_file(digest_set* set, const std::string& file_name, uint64_t len)
+{
+	std::ifstream file(file_name.c_str(), std::ios::in | std::ios::binary);
+	std::vector<uint8_t> chunk(DIGEST_READ_SIZE);
+
+	while(len > 0 && file)
+	{
+		file.read((char*)chunk.data(), (std::streamsize)std::min<uint64_t>(len, chunk.size()));
+		digest_update(set, chunk.data(), (size_t)file.gcount());
+		len -= (uint64_t)file.gcount();
+	}
+
+	return len == 0;
+}
+
+// The digest of everything so far in lower case hex, empty if it isn't being worked out.
+std::string digest_hex(const digest_set* set, uint32_t type)
+{
+	if(!(set->types & type))
+	{
+		return "";
+	}
+
+	switch(type)
+	{
+		case DIGEST_CRC32:
+		{
+			char hex[9];
+			snprintf(hex, sizeof(hex), "%08x", set->crc);
+
+			return hex;
+		}
+		case DIGEST_SHA256:
+			return sha256_hex(set->sha256);
+		case DIGEST_XXH64:
+			return xxh64_hex(&set->xxh64);
+	}
+
+	return "";
+}
+
+// Adds a line per digest to the manifest.
+bool digest_write_manifest(const digest_set* set, const std::string& manifest_name, const std::string& image_name)
+{
+	FILE* manifest = fopen(manifest_name.c_str(), "a");
+
+	if(manifest == nullptr)
+	{
+		return false;
+	}
+
+	for(uint32_t type = DIGEST_CRC32; type <= DIGEST_XXH64; type <<= 1)
+	{
+		if(set->types & type)
+		{
+			fprintf(manifest, "%s (%s) = %s\n", digest_name(type), image_name.c_str(), digest_hex(set, type).c_str());
+		}
+	}
+
+	return fclose(manifest) == 0;
+}
+
+// Prints the digests, prefix goes in front of every line, then adds them to the manifest if
+// one is named and checks the expected one. Returns false if either fails.
+bool digest_report(const digest_set* set, const std::string& prefix, const std::string& image_name,
+	const std::string& manifest_name, uint32_t verify_type, const std::string& verify_hex)
+{
+	for(uint32_t type = DIGEST_CRC32; type <= DIGEST_XXH64; type <<= 1)
+	{
+		if(set->types & type)
+		{
+			std::cout << prefix << digest_name(type) << " (" << image_name << ") = " << digest_hex(set, type) << std::endl;
+		}
+	}
+
+	bool ok = true;
+
+	if(!manifest_name.empty() && !digest_write_manifest(set, manifest_name, image_name))
+	{
+		std::cout << prefix << "Writing manifest " << manifest_name << " failed: " << strerror(errno) << std::endl;
+		ok = false;
+	}
+
+	if(verify_type != 0)
+	{
+		bool match = (digest_hex(set, verify_type) == verify_hex);
+
+		std::cout << prefix << "Verify " << digest_name(verify_type) << (match ? "			[ok]" : "			[MISMATCH]") << std::endl;
+
+		ok = ok && match;
+	}
+
+	return ok;
+}
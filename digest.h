@@ -0,0 +1,60 @@
+// digest.h: Checksums of the image worked out from the blocks as they are written, so there
+// is no second pass over a large dump with sha256sum or crc32. hash=crc32,sha256,xxh64 picks
+// them, manifest= appends them to a file in the tagged format sha256sum -c and xxhsum -c read:
+//   SHA256 (flash0.bin) = 5f1c...
+// verify=sha256:5f1c... fails the dump if the image doesn't match.
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+enum DigestType
+{
+	DIGEST_CRC32 = 1,
+	DIGEST_SHA256 = 2,
+	DIGEST_XXH64 = 4
+};
+
+const uint32_t DIGEST_READ_SIZE = 1048576; // Chunk for hashing what is already in a file.
+const uint32_t DIGEST_ALL = DIGEST_CRC32 | DIGEST_SHA256 | DIGEST_XXH64;
+
+struct sha256_state
+{
+	uint32_t h[8];
+	uint8_t buffer[64];
+	uint32_t buffered;
+	uint64_t bytes;
+};
+
+struct xxh64_state
+{
+	uint64_t v[4];
+	uint8_t buffer[32];
+	uint32_t buffered;
+	uint64_t bytes;
+};
+
+struct digest_set
+{
+	uint32_t types;			// DigestType bits, 0 for none.
+	uint32_t crc;
+	sha256_state sha256;
+	xxh64_state xxh64;
+	uint64_t bytes;			// Hashed so far.
+};
+
+bool digest_parse_types(const std::string& list, uint32_t* types);
+bool digest_parse_expected(const std::string& text, uint32_t* type, std::string* hex);
+const char* digest_name(uint32_t type);
+void digest_init(digest_set* set, uint32_t types);
+void digest_update(digest_set* set, const uint8_t* data, size_t len);
+bool digest_file(digest_set* set, const std::string& file_name, uint64_t len);
+std::string digest_hex(const digest_set* set, uint32_t type);
+bool digest_write_manifest(const digest_set* set, const std::string& manifest_name, const std::string& image_name);
+bool digest_report(const digest_set* set, const std::string& prefix, const std::string& image_name,
+	const std::string& manifest_name, uint32_t verify_type, const std::string& verify_hex);
+
+#endif
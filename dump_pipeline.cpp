@@ -0,0 +1,241 @@
+// dump_pipeline.cpp: Keeps track of the fdump commands on their way and the blocks they fill.
+//
+// Data lines are only taken for the range of the command being answered, which keeps a
+// line with a garbled address from landing anywhere else in the window.
+//
+// A block is finished once none of its commands are outstanding and it is either complete
+// or out of re-read rounds. Blocks finish in any order but are only handed out oldest
+// first, so the image is written in order. Re-reads of older blocks go before new blocks.
+
+#include <algorithm>
+
+#include "dump_pipeline.h"
+
+void pipeline_init(dump_pipeline** pipeline, uint32_t depth, uint32_t retries, uint32_t block_capacity, bool twice)
+{
+	*pipeline = new dump_pipeline();
+	(*pipeline)->depth = depth;
+	(*pipeline)->retries = retries;
+
+	// Lock step needs just the one block. Typed ahead, the commands in flight can span
+	// depth + 1 blocks, and one more lets new blocks go on while an old one is re-read.
+	(*pipeline)->window_size = (depth == 0) ? 1 : depth + 2;
+	(*pipeline)->active_wire_bytes = 0;
+	(*pipeline)->bad_lines = 0;
+	(*pipeline)->stray_lines = 0;
+	(*pipeline)->rereads = 0;
+	(*pipeline)->repaired_lines = 0;
+	(*pipeline)->confirmed_lines = 0;
+	(*pipeline)->stats = nullptr;
+
+	// All reserved up front, reading a block allocates nothing.
+	(*pipeline)->window.reserve((*pipeline)->window_size);
+	(*pipeline)->spare.reserve((*pipeline)->window_size);
+	(*pipeline)->sent.reserve(depth + 1);
+
+	for(uint32_t i = 0; i < (*pipeline)->window_size; i++)
+	{
+		flash_block* block;
+		block_init(&block, block_capacity, twice);
+		(*pipeline)->spare.push_back(block);
+	}
+}
+
+flash_block* pipeline_add_block(dump_pipeline* pipeline, uint64_t offset, uint32_t size)
+{
+	if(pipeline->spare.empty())
+	{
+		// The window is full.
+		return nullptr;
+	}
+
+	flash_block* block = pipeline->spare.back();
+	pipeline->spare.pop_back();
+
+	block_start(block, offset, size);
+	block->started_ns = (pipeline->stats != nullptr) ? stats_clock() : 0;
+	pipeline->window.push_back(block);
+
+	return block;
+}
+
+bool pipeline_next_reread(dump_pipeline* pipeline, pipeline_command* command)
+{
+	for(flash_block* block : pipeline->window)
+	{
+		if(block->gap_line >= block->lines)
+		{
+			// A new round only once everything sent for the block so far is back.
+			if(block->pending > 0 || block_complete(block) || block->rounds >= pipeline->retries)
+			{
+				continue;
+			}
+
+			block->rounds++;
+			block->gap_line = 0;
+		}
+
+		if(block_next_gap(block, &block->gap_line, &command->offset, &command->size))
+		{
+			command->block = block;
+			command->first_read = false;
+			pipeline->rereads++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool pipeline_can_send(dump_pipeline* pipeline)
+{
+	return pipeline->sent.size() < pipeline->depth + 1;
+}
+
+void pipeline_sent(dump_pipeline* pipeline, const pipeline_command& command, uint64_t wire_bytes)
+{
+	if(pipeline->sent.empty())
+	{
+		// Runs right away.
+		pipeline->active_since = std::chrono::steady_clock::now();
+		pipeline->active_wire_bytes = wire_bytes;
+	}
+
+	pipeline->sent.push_back(command);
+	pipeline->sent.back().answered = false;
+	command.block->pending++;
+}
+
+LineKind pipeline_add_line(dump_pipeline* pipeline, const char* line, uint32_t line_len)
+{
+	uint8_t data[BYTES_PER_LINE];
+	uint32_t byte_count = 0;
+	uint32_t address = 0;
+
+	dump_stats* stats = pipeline->stats;
+	LineKind kind = scan_fdump_line(line, line_len, data, BYTES_PER_LINE, &byte_count, &address, nullptr,
+		(stats != nullptr) ? &stats->phase_ns[SP_DECODE] : nullptr);
+
+	// Echoed commands, status lines and the prompt are not data.
+	if(kind != LK_DATA || byte_count == 0)
+	{
+		return kind;
+	}
+
+	if(stats != nullptr)
+	{
+		// The console sends CR LF after each.
+		stats->phase_calls[SP_DECODE]++;
+		stats->data_lines++;
+		stats->data_chars += line_len + 2;
+
+		if(!pipeline->sent.empty() && !pipeline->sent.front().answered)
+		{
+			pipeline->sent.front().answered = true;
+			stats_sample(stats, &stats->first_line_us, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				pipeline->active_since.time_since_epoch()).count());
+		}
+	}
+
+	// Replies come in the order the commands were sent, so a line outside the one being
+	// answered has a garbled address, or belongs to a command that was given up on.
+	if(pipeline->sent.empty() || address < pipeline->sent.front().offset
+		|| address >= pipeline->sent.front().offset + pipeline->sent.front().size)
+	{
+		pipeline->stray_lines++;
+		return kind;
+	}
+
+	for(flash_block* block : pipeline->window)
+	{
+		if(block_contains(block, address))
+		{
+			if(!block_add_line(block, address, data, byte_count, line, line_len))
+			{
+				pipeline->bad_lines++;
+			}
+			return kind;
+		}
+	}
+
+	pipeline->stray_lines++;
+
+	return kind;
+}
+
+void pipeline_command_done(dump_pipeline* pipeline, uint64_t wire_bytes)
+{
+	if(pipeline->sent.empty())
+	{
+		// A status line of something else, e.g. left over from before fdump started.
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	pipeline_command& command = pipeline->sent.front();
+	flash_block* block = command.block;
+
+	if(command.first_read)
+	{
+		block->first_seconds = std::chrono::duration<double>(now - pipeline->active_since).count();
+		block->first_wire_bytes = wire_bytes - pipeline->active_wire_bytes;
+		block->first_lines_ok = block->lines_ok;
+		block->first_lines_unconfirmed = block->lines_unconfirmed;
+	}
+
+	block->pending--;
+	pipeline->sent.erase(pipeline->sent.begin());
+
+	// The next one typed ahead starts now.
+	pipeline->active_since = now;
+	pipeline->active_wire_bytes = wire_bytes;
+}
+
+flash_block* pipeline_finished_block(dump_pipeline* pipeline)
+{
+	if(pipeline->window.empty())
+	{
+		return nullptr;
+	}
+
+	flash_block* block = pipeline->window.front();
+
+	if(block->pending > 0 || block->gap_line < block->lines
+		|| (!block_complete(block) && block->rounds < pipeline->retries))
+	{
+		return nullptr;
+	}
+
+	return block;
+}
+
+void pipeline_release_block(dump_pipeline* pipeline)
+{
+	flash_block* block = pipeline->window.front();
+
+	uint32_t gained = block->lines_ok - block->first_lines_ok;
+
+	pipeline->repaired_lines += gained - std::min(gained, block->lines_confirmed);
+	pipeline->confirmed_lines += block->lines_confirmed;
+	pipeline->window.erase(pipeline->window.begin());
+	pipeline->spare.push_back(block);
+}
+
+void pipeline_free(dump_pipeline* pipeline)
+{
+	// Free allocated memory;
+	if(pipeline != nullptr)
+	{
+		for(flash_block* block : pipeline->window)
+		{
+			block_free(block);
+		}
+
+		for(flash_block* block : pipeline->spare)
+		{
+			block_free(block);
+		}
+
+		delete pipeline;
+	}
+}
@@ -0,0 +1,64 @@
+// dump_pipeline.h: Keeps track of the fdump commands on their way and the blocks they fill.
+// With pipeline=N up to N commands are typed ahead of the one CFE is running, so the
+// console starts on the next one the moment it prints the prompt. Replies are matched
+// to commands by their status lines, and data lines go to whichever block in the window
+// their address column falls in, so the output stays right even if the console drops or
+// mangles a typed-ahead command. With pipeline=0 a command is only sent once the prompt
+// is back, the way fdump always worked.
+
+#ifndef DUMP_PIPELINE_H
+#define DUMP_PIPELINE_H
+
+#include <cstdint>
+#include <vector>
+#include <chrono>
+
+#include "flash_block.h"
+#include "stats.h"
+
+const uint32_t PIPELINE_MAX_DEPTH = 8; // Most commands pipeline= may type ahead.
+
+struct pipeline_command
+{
+	uint64_t offset;
+	uint32_t size;
+	flash_block* block;
+	bool first_read;		// The block's first read, timed for bs=auto.
+	bool answered;			// A data line of it has come in.
+};
+
+struct dump_pipeline
+{
+	uint32_t depth;			// Commands typed ahead of the running one.
+	uint32_t retries;		// Re-read rounds per block.
+	uint32_t window_size;	// Most blocks being read at once.
+	std::vector<flash_block*> window; // Blocks being read, oldest first.
+	std::vector<flash_block*> spare;  // Blocks to reuse.
+	std::vector<pipeline_command> sent; // Commands on their way, oldest first.
+
+	// When the oldest command in sent started running, for timing it.
+	std::chrono::steady_clock::time_point active_since;
+	uint64_t active_wire_bytes;
+
+	// Counters.
+	uint64_t bad_lines;		// Data lines dropped for not checking out.
+	uint64_t stray_lines;	// Data lines with an address outside every block being read.
+	uint64_t rereads;		// Narrow fdump commands sent to fill gaps.
+	uint64_t repaired_lines; // Lines filled in by re-reads.
+	uint64_t confirmed_lines; // With verify=twice, lines the ASCII column couldn't vouch for made good by a second copy.
+
+	dump_stats* stats;		// nullptr without --stats.
+};
+
+void pipeline_init(dump_pipeline** pipeline, uint32_t depth, uint32_t retries, uint32_t block_capacity, bool twice);
+flash_block* pipeline_add_block(dump_pipeline* pipeline, uint64_t offset, uint32_t size);
+bool pipeline_next_reread(dump_pipeline* pipeline, pipeline_command* command);
+bool pipeline_can_send(dump_pipeline* pipeline);
+void pipeline_sent(dump_pipeline* pipeline, const pipeline_command& command, uint64_t wire_bytes);
+LineKind pipeline_add_line(dump_pipeline* pipeline, const char* line, uint32_t line_len);
+void pipeline_command_done(dump_pipeline* pipeline, uint64_t wire_bytes);
+flash_block* pipeline_finished_block(dump_pipeline* pipeline);
+void pipeline_release_block(dump_pipeline* pipeline);
+void pipeline_free(dump_pipeline* pipeline);
+
+#endif
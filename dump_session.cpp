@@ -0,0 +1,741 @@
+// dump_session.cpp: One dump of a flash range through one CFE console.
+//
+// Every block is read with one fdump command, then the lines lost or damaged on the way are
+// re-read with narrow ones. With pipeline= commands are typed ahead of the running one,
+// otherwise the next is only sent once the status line and the prompt are back. Blocks are
+// written out in order as soon as the oldest one is finished.
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cinttypes>
+#include <algorithm>
+
+#include "dump_session.h"
+#include "line_parser.h"
+
+// verify= is twice, a digest name and its hex like sha256:<hex>, or both comma separated.
+bool session_parse_verify(const std::string& text, bool* read_twice, uint32_t* verify_type, std::string* verify_hex)
+{
+	size_t start = 0;
+
+	while(true)
+	{
+		size_t comma = text.find(',', start);
+		std::string part = text.substr(start, (comma == std::string::npos) ? std::string::npos : comma - start);
+
+		if(part == "twice")
+		{
+			*read_twice = true;
+		}
+		else if(!digest_parse_expected(part, verify_type, verify_hex))
+		{
+			return false;
+		}
+
+		if(comma == std::string::npos)
+		{
+			break;
+		}
+
+		start = comma + 1;
+	}
+
+	return true;
+}
+
+void session_init(dump_session** session, const dump_settings& settings, uart_dev* uart_device, rx_buffer* rx)
+{
+	*session = new dump_session();
+	(*session)->settings = settings;
+	(*session)->uart_device = uart_device;
+	(*session)->rx = rx;
+	(*session)->pipeline = nullptr;
+	(*session)->journal.file = nullptr;
+	(*session)->journal.blocks = 0;
+	(*session)->journal.bytes = 0;
+	image_init(&(*session)->output);
+	(*session)->position = 0;
+	(*session)->bytes_done = 0;
+	(*session)->bytes_read = 0;
+	(*session)->incomplete_blocks = 0;
+	(*session)->console_ready = true;
+	(*session)->got_status = false;
+	(*session)->interrupted = false;
+	(*session)->erased_bytes = 0;
+	(*session)->zero_bytes = 0;
+	(*session)->started_wire_bytes = rx->bytes_read;
+
+	// The parts of the range this session reads, in order.
+	if(settings.stripe_count > 1)
+	{
+		// Every stripe_count'th run, starting with run stripe_index. The last run can be short.
+		for(uint64_t start = settings.stripe_index * settings.stripe_size; start < settings.size;
+			start += settings.stripe_count * settings.stripe_size)
+		{
+			(*session)->extents.push_back({ start, std::min(settings.stripe_size, settings.size - start) });
+		}
+	}
+	else
+	{
+		(*session)->extents = settings.extents;
+	}
+
+	if((*session)->extents.empty())
+	{
+		// All of it, or nothing for a stripe with no run of its own.
+		(*session)->extents.push_back({ 0, (settings.stripe_count > 1) ? 0 : settings.size });
+	}
+
+	(*session)->partial = (settings.stripe_count > 1 || !settings.extents.empty());
+	(*session)->size = 0;
+
+	for(const dump_extent& extent : (*session)->extents)
+	{
+		(*session)->extent_starts.push_back((*session)->size);
+		(*session)->size += extent.size;
+	}
+
+	// Digests need the whole image in order, which one that reads only parts of it doesn't write.
+	digest_init(&(*session)->digest, (*session)->partial ? 0 : settings.digests);
+}
+
+// The extent position is in, counted in the bytes this session reads.
+static size_t session_extent(dump_session* session, uint64_t position)
+{
+	std::vector<uint64_t>::const_iterator next = std::upper_bound(session->extent_starts.begin(), session->extent_starts.end(), position);
+
+	return (next == session->extent_starts.begin()) ? 0 : (size_t)(next - session->extent_starts.begin()) - 1;
+}
+
+// Where position, counted in the bytes this session reads, is in the dump.
+uint64_t session_image_position(dump_session* session, uint64_t position)
+{
+	size_t i = session_extent(session, position);
+
+	return session->extents[i].offset + (position - session->extent_starts[i]);
+}
+
+// The other way round, position in the dump to position in the bytes this session reads.
+static uint64_t session_own_position(dump_session* session, uint64_t image_position)
+{
+	std::vector<dump_extent>::const_iterator next = std::upper_bound(session->extents.begin(), session->extents.end(), image_position,
+		[](uint64_t position, const dump_extent& extent) { return position < extent.offset; });
+	size_t i = (next == session->extents.begin()) ? 0 : (size_t)(next - session->extents.begin()) - 1;
+
+	return session->extent_starts[i] + (image_position - session->extents[i].offset);
+}
+
+static uint64_t session_journal_position(const void* context, uint64_t position)
+{
+	return session_image_position((dump_session*)context, position);
+}
+
+// Bytes from position to where the next block has to end, the end of its extent.
+static uint64_t session_bytes_left(dump_session* session)
+{
+	size_t i = session_extent(session, session->position);
+
+	return session->extent_starts[i] + session->extents[i].size - session->position;
+}
+
+static std::ostream& session_log(dump_session* session)
+{
+	if(!session->settings.name.empty())
+	{
+		std::cout << session->settings.name << ": ";
+	}
+
+	return std::cout;
+}
+
+bool session_open(dump_session* session)
+{
+	const dump_settings& settings = session->settings;
+
+	pipeline_init(&session->pipeline, settings.pipeline_depth, settings.retries, settings.block_size, settings.read_twice);
+	tuner_init(&session->tuner, settings.retries);
+	session->command_text.reserve(FDUMP_CMD.length() + FDUMP_CMD_ARG_OFFSET.length() + FDUMP_CMD_ARG_SIZE.length()
+		+ settings.device_name.length() + SESSION_COMMAND_NUMBERS);
+
+	// The progress summary has the timings too. bs=auto can go down to its smallest blocks,
+	// and verify=twice reads most blocks of binary data a second time.
+	bool timed = settings.stats || settings.progress != nullptr;
+	uint32_t smallest_block = settings.block_size_auto ? TUNER_MIN_SIZE : settings.block_size;
+	stats_init(&session->stats, timed, settings.size / std::max<uint32_t>(smallest_block, 1) + 1, settings.read_twice ? 2 : 1);
+	session->pipeline->stats = timed ? &session->stats : nullptr;
+
+	// Every run kept is at least ERASED_MAP_MIN long, and the last one may be a short one that
+	// can still grow, so the erased map is never more than this and doesn't grow during the dump.
+	session->erased.reserve(session->size / ERASED_MAP_MIN + 2);
+
+	// Start on a fresh line, any left over "CFE> " prompt is not data.
+	rx_reset_line(session->rx);
+	session->last_data = std::chrono::steady_clock::now();
+
+	if(settings.of_name.empty())
+	{
+		progress_session_start(session);
+		return true;
+	}
+
+	std::string journal_settings = "if=" + settings.device_name + " offset=" + std::to_string(settings.offset)
+		+ " bs=" + (settings.block_size_auto ? BLOCK_SIZE_AUTO : std::to_string(settings.block_size))
+		+ " size=" + std::to_string(settings.size);
+	std::string journal_name = settings.of_name + JOURNAL_EXT;
+
+	if(settings.stripe_count > 1)
+	{
+		// Every stripe keeps a journal of its own.
+		journal_settings += " stripe=" + std::to_string(settings.stripe_size) + " of " + std::to_string(settings.stripe_count);
+		journal_name = settings.of_name + ".stripe" + std::to_string(settings.stripe_index) + JOURNAL_EXT;
+	}
+	else if(session->partial)
+	{
+		// A resume has to read the same parts.
+		std::string extents;
+
+		for(const dump_extent& extent : session->extents)
+		{
+			extents += std::to_string(extent.offset) + "+" + std::to_string(extent.size) + ",";
+		}
+
+		char crc[9];
+		snprintf(crc, sizeof(crc), "%08x", crc32_update(0, (const uint8_t*)extents.data(), extents.length()));
+		journal_settings += " extents=" + std::to_string(session->extents.size()) + " crc=" + crc;
+	}
+
+	if(settings.compress != COMPRESS_NONE)
+	{
+		// Written in one go from the start, there is nothing to resume into.
+		if(settings.resume || session->partial)
+		{
+			session_log(session) << "A compressed " << settings.of_name << " can't be resumed or read in parts." << std::endl;
+			return false;
+		}
+
+		if(!image_open_compressed(&session->output, settings.of_name, settings.compress))
+		{
+			session_log(session) << "Opening " << settings.of_name << " failed: " << strerror(errno) << std::endl;
+			return false;
+		}
+
+		progress_session_start(session);
+		return true;
+	}
+
+	if(settings.journal)
+	{
+		bool journal_ok = settings.resume
+			? journal_resume(&session->journal, journal_name, settings.of_name, journal_settings, &session->bytes_done,
+				&session_journal_position, session)
+			: journal_create(&session->journal, journal_name, journal_settings);
+
+		if(!journal_ok)
+		{
+			return false;
+		}
+	}
+
+	if(session->bytes_done > 0)
+	{
+		session_log(session) << "Resuming after block " << session->journal.blocks << ", " << session->bytes_done
+			<< " of " << session->size << " bytes already in " << settings.of_name << std::endl;
+	}
+
+	// Keep what is already there, resumed blocks or the rest of the range. That image is made beforehand.
+	if(!image_open(&session->output, settings.of_name, settings.sparse ? 0 : settings.size, session->bytes_done > 0 || session->partial))
+	{
+		session_log(session) << "Opening " << settings.of_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	session->position = session->bytes_done;
+	session->bytes_read = session->bytes_done;
+
+	// The digests start off with what is already in the image, the one read of it they need.
+	if(session->bytes_done > 0 && session->digest.types != 0
+		&& !digest_file(&session->digest, settings.of_name, session->bytes_done))
+	{
+		session_log(session) << "Reading " << settings.of_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	progress_session_start(session);
+	return true;
+}
+
+static void session_send_command(dump_session* session, const pipeline_command& command)
+{
+	// Built in the session's own string, it has the room for it since session_open().
+	std::string& s_cmd = session->command_text;
+	char number[24];
+
+	s_cmd.assign(FDUMP_CMD);
+	s_cmd += ' ';
+	s_cmd += FDUMP_CMD_ARG_OFFSET;
+	snprintf(number, sizeof(number), "%" PRIu64, command.offset);
+	s_cmd += number;
+	s_cmd += ' ';
+	s_cmd += FDUMP_CMD_ARG_SIZE;
+	snprintf(number, sizeof(number), "%" PRIu32, command.size);
+	s_cmd += number;
+	s_cmd += ' ';
+	s_cmd += session->settings.device_name;
+	s_cmd += '\r';
+
+	uint64_t start = stats_start(&session->stats);
+	uart_write(session->uart_device, (void*)s_cmd.c_str(), s_cmd.length());
+	stats_add(&session->stats, SP_COMMAND, start);
+}
+
+static void session_print_block(dump_session* session, flash_block* block)
+{
+	console_out* console = session->settings.console;
+
+	if(console != nullptr)
+	{
+		// Each run of good lines goes to the console thread at once.
+		for(uint32_t i = 0; i < block->lines; )
+		{
+			uint32_t first = i;
+
+			while(i < block->lines && block->line_ok[i])
+			{
+				i++;
+			}
+
+			if(i > first)
+			{
+				uint32_t end = std::min(block->size, i * (uint32_t)BYTES_PER_LINE);
+				console_hexdump(console, block->offset + first * BYTES_PER_LINE, block->data + first * BYTES_PER_LINE,
+					end - first * BYTES_PER_LINE);
+			}
+
+			while(i < block->lines && !block->line_ok[i])
+			{
+				i++;
+			}
+		}
+
+		return;
+	}
+
+	char text[FORMATTED_LINE_MAX];
+
+	for(uint32_t i = 0; i < block->lines; i++)
+	{
+		if(block->line_ok[i])
+		{
+			// The position in decimal format, then the data like hexdump.
+			format_data_line(text, block->offset + i * BYTES_PER_LINE, block->data + i * BYTES_PER_LINE,
+				block_line_size(block, i), nullptr);
+
+			std::cout << text << std::endl;
+		}
+	}
+}
+
+// Counts a line that is all ERASED_BYTE or all zero, and adds it to the erased map.
+static void session_check_erased(dump_session* session, uint64_t position, const uint8_t* line, uint32_t len)
+{
+	uint8_t value = line[0];
+
+	if(value != ERASED_BYTE && value != 0)
+	{
+		return;
+	}
+
+	for(uint32_t i = 1; i < len; i++)
+	{
+		if(line[i] != value)
+		{
+			return;
+		}
+	}
+
+	(value == ERASED_BYTE ? session->erased_bytes : session->zero_bytes) += len;
+
+	if(!session->erased.empty())
+	{
+		erased_run& last = session->erased.back();
+
+		if(last.offset + last.size == position && last.value == value)
+		{
+			last.size += len;
+			return;
+		}
+
+		// Only long runs are listed, a stray line of padding in the middle of data isn't worth it.
+		if(last.size < ERASED_MAP_MIN)
+		{
+			session->erased.pop_back();
+		}
+	}
+
+	session->erased.push_back({ position, len, value });
+}
+
+// Lists the erased runs, in flash offsets, for map=.
+static bool session_write_erased_map(dump_session* session)
+{
+	const dump_settings& settings = session->settings;
+	FILE* map = fopen(settings.map_name.c_str(), "w");
+
+	if(map == nullptr)
+	{
+		return false;
+	}
+
+	fprintf(map, "# fdump erased map of %s offset=%" PRIu64 " size=%" PRIu64 ": <offset> <length> <ff|00>\n",
+		settings.device_name.c_str(), settings.offset, settings.size);
+
+	for(const erased_run& run : session->erased)
+	{
+		if(run.size >= ERASED_MAP_MIN)
+		{
+			fprintf(map, "%" PRIu64 " %" PRIu64 " %02x\n", settings.offset + run.offset, run.size, run.value);
+		}
+	}
+
+	return fclose(map) == 0;
+}
+
+// Write out a block that has been read, and journal it if it is complete.
+// Returns false if the image or the journal couldn't be written.
+static bool session_finish_block(dump_session* session, flash_block* block)
+{
+	if(session->settings.block_size_auto && !session->interrupted)
+	{
+		tuner_update(&session->tuner, block->lines, block->first_seconds, block->first_wire_bytes,
+			session->uart_device->baud, block->lines - block->first_lines_ok - block->first_lines_unconfirmed,
+			block->lines - block->lines_ok);
+	}
+
+	if(session->settings.print_data)
+	{
+		uint64_t start = stats_start(&session->stats);
+		session_print_block(session, block);
+		stats_add(&session->stats, SP_PRINT, start);
+	}
+
+	for(uint32_t i = 0; i < block->lines; i++)
+	{
+		uint32_t line_size = block_line_size(block, i);
+
+		if(block->line_ok[i])
+		{
+			session->bytes_read += line_size;
+			session_check_erased(session, block->offset - session->settings.offset + i * BYTES_PER_LINE,
+				block->data + i * BYTES_PER_LINE, line_size);
+		}
+		else
+		{
+			// Lines that never came through, or never twice the same, are left zero, so everything
+			// after them is still in place.
+			memset(block->data + i * BYTES_PER_LINE, 0, line_size);
+		}
+	}
+
+	uint64_t start = stats_start(&session->stats);
+
+	if(!session->settings.of_name.empty())
+	{
+		journal_block_start(&session->journal);
+
+		// Blocks go where they belong in the image, which with stripes is not after the last one.
+		journal_update(&session->journal, block->data, block->size);
+		stats_add(&session->stats, SP_CHECKSUM, start);
+		start = stats_start(&session->stats);
+
+		bool written = session->settings.sparse
+			? image_write_sparse(&session->output, block->offset - session->settings.offset, block->data, block->size)
+			: image_write(&session->output, block->offset - session->settings.offset, block->data, block->size);
+
+		stats_add(&session->stats, SP_WRITE, start);
+		start = stats_start(&session->stats);
+
+		if(!written)
+		{
+			session_log(session) << "Writing " << session->settings.of_name << " failed: " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+
+	// Same bytes as the image, zeros for lines still missing included.
+	digest_update(&session->digest, block->data, block->size);
+	stats_add(&session->stats, SP_CHECKSUM, start);
+	stats_sample(&session->stats, &session->stats.block_us, block->started_ns);
+	progress_session_block(session, block);
+
+	if(!block_complete(block))
+	{
+		if(!session->interrupted)
+		{
+			session->incomplete_blocks++;
+		}
+
+		return true;
+	}
+
+	// Only whole blocks are journaled, a resume starts over on one with gaps left.
+	if(session->journal.file != nullptr)
+	{
+		// The block is in the file already, so the journal can say so.
+		return journal_block_done(&session->journal, session_own_position(session, block->offset - session->settings.offset));
+	}
+
+	return true;
+}
+
+// Writes out the finished blocks, then sends as many commands as the console takes.
+// Returns false if the image or the journal couldn't be written.
+bool session_send(dump_session* session)
+{
+	dump_pipeline* pipeline = session->pipeline;
+	flash_block* block;
+
+	// Blocks are written out in order, as soon as the oldest one is done.
+	while((block = pipeline_finished_block(pipeline)) != nullptr)
+	{
+		if(!session_finish_block(session, block))
+		{
+			return false;
+		}
+
+		pipeline_release_block(pipeline);
+	}
+
+	// Keep the console busy, with pipeline=0 only once the prompt is back.
+	while(pipeline_can_send(pipeline) && (session->console_ready || pipeline->depth > 0))
+	{
+		pipeline_command command;
+
+		if(pipeline_next_reread(pipeline, &command))
+		{
+			if(session->settings.very_verbose)
+			{
+				session_log(session) << "Re-reading " << command.size << " bytes at offset " << command.offset << std::endl;
+			}
+		}
+		else if(session->position < session->size)
+		{
+			// The last block is whatever is left, so a size that isn't a multiple of bs= is read in full.
+			uint64_t bytes_left = session_bytes_left(session);
+
+			command.offset = session->settings.offset + session_image_position(session, session->position);
+			command.size = session->settings.block_size_auto
+				? tuner_next_size(&session->tuner, bytes_left)
+				: (uint32_t)std::min((uint64_t)session->settings.block_size, bytes_left);
+			command.first_read = true;
+			command.block = pipeline_add_block(pipeline, command.offset, command.size);
+
+			if(command.block == nullptr)
+			{
+				// Window full, the oldest block is still waiting on its re-reads.
+				break;
+			}
+
+			if(session->settings.very_verbose && session->settings.block_size_auto)
+			{
+				session_log(session) << "bs=auto: " << command.size << " bytes at " << command.offset
+					<< " (command overhead " << (uint32_t)(session->tuner.overhead * 1000) << " ms, "
+					<< session->tuner.error_rate * 100 << "% of lines re-read)" << std::endl;
+			}
+
+			session->position += command.size;
+		}
+		else
+		{
+			break;
+		}
+
+		session_send_command(session, command);
+		pipeline_sent(pipeline, command, session->rx->bytes_read);
+
+		session->console_ready = false;
+		session->last_data = std::chrono::steady_clock::now();
+	}
+
+	return true;
+}
+
+// Takes the complete lines waiting in the receive ring.
+void session_receive(dump_session* session)
+{
+	rx_buffer* rx = session->rx;
+	const char* line;
+	uint32_t line_len;
+	uint64_t start = stats_start(&session->stats);
+	uint64_t decode_ns = session->stats.phase_ns[SP_DECODE];
+
+	while(rx_next_line(rx, &line, &line_len))
+	{
+		// Data lines go where their address column says, the status lines finish commands in order.
+		if(pipeline_add_line(session->pipeline, line, line_len) == LK_STATUS)
+		{
+			pipeline_command_done(session->pipeline, rx->bytes_read);
+			session->got_status = true;
+		}
+	}
+
+	// The hex kernel has a phase of its own.
+	stats_add(&session->stats, SP_PARSE, start);
+	session->stats.phase_ns[SP_PARSE] -= session->stats.phase_ns[SP_DECODE] - decode_ns;
+
+	// The console is ready once the status line is followed by the prompt, which
+	// has no new line after it so it is the partial line left over.
+	if(session->got_status && rx->line_len >= CFE_PROMPT.length()
+		&& strncmp(rx->line, CFE_PROMPT.c_str(), CFE_PROMPT.length()) == 0)
+	{
+		rx_reset_line(rx);
+		session->console_ready = true;
+		session->got_status = false;
+	}
+}
+
+void session_data_arrived(dump_session* session, std::chrono::steady_clock::time_point now)
+{
+	session->last_data = now;
+}
+
+// When the commands on their way are given up on if nothing more arrives.
+std::chrono::steady_clock::time_point session_deadline(dump_session* session)
+{
+	return session->last_data + std::chrono::milliseconds(session->settings.idle_timeout_ms);
+}
+
+void session_check_idle(dump_session* session, std::chrono::steady_clock::time_point now)
+{
+	if(now < session_deadline(session))
+	{
+		return;
+	}
+
+	// Neither the status line nor the prompt came, what did arrive is used and the gaps re-read.
+	if(session->settings.verbose && !session->pipeline->sent.empty())
+	{
+		session_log(session) << "No reply for " << session->settings.idle_timeout_ms << " ms, giving up on "
+			<< session->pipeline->sent.size() << " command(s)" << std::endl;
+	}
+
+	while(!session->pipeline->sent.empty())
+	{
+		pipeline_command_done(session->pipeline, session->rx->bytes_read);
+	}
+
+	session->console_ready = true;
+	session->last_data = now;
+}
+
+bool session_done(dump_session* session)
+{
+	// Everything is read and written.
+	return session->pipeline->window.empty() && session->position >= session->size;
+}
+
+// Interrupted, write out what there is of the blocks still being read.
+bool session_interrupt(dump_session* session)
+{
+	dump_pipeline* pipeline = session->pipeline;
+
+	session->interrupted = true;
+
+	while(!pipeline->window.empty())
+	{
+		if(!session_finish_block(session, pipeline->window.front()))
+		{
+			return false;
+		}
+
+		pipeline_release_block(pipeline);
+	}
+
+	return true;
+}
+
+// Prints the digests of a whole image, adds them to the manifest and checks the expected one.
+static bool session_finish_digests(dump_session* session)
+{
+	const dump_settings& settings = session->settings;
+	std::string image_name = settings.of_name.empty() ? settings.device_name : compress_image_name(settings.of_name, settings.compress);
+
+	if(session->digest.types == 0 || session->digest.bytes != session->size)
+	{
+		// Nothing asked for, or the dump stopped short.
+		return true;
+	}
+
+	return digest_report(&session->digest, settings.name.empty() ? "" : settings.name + ": ", image_name,
+		settings.manifest_name, settings.verify_type, settings.verify_hex);
+}
+
+// Returns false if the image couldn't be written out in full or doesn't match verify=.
+bool session_close(dump_session* session)
+{
+	bool ok = true;
+
+	if(session->erased_bytes + session->zero_bytes > 0 && session->settings.verbose)
+	{
+		session_log(session) << "Erased: " << session->erased_bytes << " bytes of 0xff, " << session->zero_bytes
+			<< " bytes of 0x00, " << std::count_if(session->erased.begin(), session->erased.end(),
+				[](const erased_run& run) { return run.size >= ERASED_MAP_MIN; })
+			<< " run(s) of " << ERASED_MAP_MIN << " bytes or more" << std::endl;
+	}
+
+	// Parts of the range only make part of a map, map= is turned down with those as it is parsed.
+	if(!session->settings.map_name.empty() && !session->partial && !session_write_erased_map(session))
+	{
+		session_log(session) << "Writing map " << session->settings.map_name << " failed: " << strerror(errno) << std::endl;
+		ok = false;
+	}
+
+	if(image_is_open(&session->output))
+	{
+		if(session->settings.verbose)
+		{
+			session_log(session) << "Closing handle to file " << session->settings.of_name;
+		}
+
+		ok = image_close(&session->output) && ok;
+
+		if(session->settings.verbose)
+		{
+			std::cout << (ok ? "	[done]" : "	[failed]") << std::endl;
+		}
+
+		if(!ok)
+		{
+			session_log(session) << "Writing " << session->settings.of_name << " failed: " << strerror(errno) << std::endl;
+		}
+		else if(session->settings.compress != COMPRESS_NONE && session->settings.verbose)
+		{
+			session_log(session) << "Compressed " << session->bytes_read << " bytes to " << session->output.bytes_written
+				<< " in " << session->settings.of_name << std::endl;
+		}
+	}
+
+	// The journal is only removed once every byte is in the image.
+	journal_close(&session->journal, session->journal.bytes == session->size);
+
+	if(session->settings.stats)
+	{
+		stats_report(&session->stats, session->settings.name.empty() ? "" : session->settings.name + ": ",
+			(uint32_t)session->uart_device->baud, session->rx->bytes_read - session->started_wire_bytes);
+	}
+
+	ok = session_finish_digests(session) && ok;
+	progress_session_end(session, ok);
+
+	return ok;
+}
+
+void session_free(dump_session* session)
+{
+	// Free allocated memory;
+	if(session != nullptr)
+	{
+		pipeline_free(session->pipeline);
+		delete session;
+	}
+}
@@ -0,0 +1,142 @@
+// dump_session.h: One dump of a flash range through one CFE console, with all of its state
+// in one place. fdump runs a single session, batch= runs one per port. session_send() keeps
+// the console busy and session_receive() takes the lines that came in, neither of them waits
+// on the tty, so the caller decides how to wait for data.
+
+#ifndef DUMP_SESSION_H
+#define DUMP_SESSION_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "uart.h"
+#include "serial_rx.h"
+#include "journal.h"
+#include "image_file.h"
+#include "digest.h"
+#include "stats.h"
+#include "progress.h"
+#include "console_out.h"
+#include "block_tuner.h"
+#include "dump_pipeline.h"
+
+const std::string FDUMP_CMD_ARG_OFFSET = "-offset="; // Offset argument for FDUMP_CMD.
+const std::string FDUMP_CMD_ARG_SIZE = "-size="; // Size argument for FDUMP_CMD.
+const std::string BLOCK_SIZE_AUTO = "auto"; // bs=auto
+const uint8_t ERASED_BYTE = 0xFF;	// What erased NOR and NAND flash reads as.
+const uint64_t ERASED_MAP_MIN = 4096; // Shorter runs of erased or zero lines are only counted, not listed.
+const uint32_t SESSION_COMMAND_NUMBERS = 48; // Room in a command for its numbers, spaces and CR.
+
+// Part of the range, offset is from the start of the range.
+struct dump_extent
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+// A run of lines that are all ERASED_BYTE or all zero.
+struct erased_run
+{
+	uint64_t offset;			// From the start of the range.
+	uint64_t size;
+	uint8_t value;
+};
+
+// What to dump and how.
+struct dump_settings
+{
+	std::string name;			// Prefix for messages, the tty in batch mode.
+	std::string device_name;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t block_size;		// Largest block with bs=auto.
+	bool block_size_auto;
+	uint32_t pipeline_depth;
+	uint32_t retries;
+	uint32_t idle_timeout_ms;
+	std::string of_name;		// Empty for no output file.
+	bool journal;				// Keep a journal next to of= to resume from.
+	bool sparse;				// Leave runs of zeros out of of= as holes.
+	uint32_t compress;			// CompressType of of=, which then has no journal.
+	std::string map_name;		// Where to write the erased map, empty for none.
+	bool resume;
+
+	// Only these parts of the range, in order and apart, into an image that has the rest.
+	// Empty for all of it.
+	std::vector<dump_extent> extents;
+
+	// Striped over several consoles: this one reads every stripe_count'th run of
+	// stripe_size bytes, starting with run stripe_index.
+	uint32_t stripe_count;		// 1 when not striped.
+	uint32_t stripe_index;
+	uint64_t stripe_size;
+
+	// Digests of the image as it is written, see digest.h.
+	uint32_t digests;			// DigestType bits, 0 for none.
+	std::string manifest_name;	// Empty for none.
+	uint32_t verify_type;		// 0 for no expected digest.
+	std::string verify_hex;
+	bool read_twice;			// verify=twice: lines with bytes shown as '.' are only good once two copies agree.
+
+	bool print_data;
+	console_out* console;		// -l goes through it when it is open, nullptr prints directly.
+	bool stats;					// Time the phases and print them at the end, see stats.h.
+	progress_log* progress;		// JSON progress events go here, nullptr for none. Shared by every session.
+	bool verbose;
+	bool very_verbose;
+};
+
+struct dump_session
+{
+	dump_settings settings;
+	uart_dev* uart_device;
+	rx_buffer* rx;
+	dump_pipeline* pipeline;
+	block_tuner tuner;
+	dump_journal journal;
+	image_file output;
+
+	std::vector<dump_extent> extents;	// What this session reads, from settings.extents or its stripe.
+	std::vector<uint64_t> extent_starts; // Where each extent starts in the bytes this session reads.
+	bool partial;				// Reads only parts of the range.
+	uint64_t size;				// Bytes this session reads, all of settings.size unless partial.
+
+	// Progress, positions count the bytes this session reads, see session_image_position().
+	uint64_t position;			// Start of the next new block.
+	uint64_t bytes_done;		// Already in the image from an earlier run, with resume.
+	uint64_t bytes_read;		// In the image so far, including bytes_done.
+	uint32_t incomplete_blocks;	// Written with lines still missing.
+	bool console_ready;			// The prompt is back, so CFE reads the next command right away.
+	bool got_status;
+	bool interrupted;
+	std::chrono::steady_clock::time_point last_data;
+	digest_set digest;			// Of the image from its start, the blocks are written in order.
+
+	// Lines read that are all ERASED_BYTE or all zero.
+	std::vector<erased_run> erased;	// Runs of ERASED_MAP_MIN or more.
+	uint64_t erased_bytes;
+	uint64_t zero_bytes;
+
+	dump_stats stats;
+	uint64_t started_wire_bytes; // rx bytes_read when the session started, for --stats.
+	progress_point progress_mark;
+	std::string command_text;	// The fdump command being sent, kept so each one doesn't allocate.
+};
+
+bool session_parse_verify(const std::string& text, bool* read_twice, uint32_t* verify_type, std::string* verify_hex);
+void session_init(dump_session** session, const dump_settings& settings, uart_dev* uart_device, rx_buffer* rx);
+bool session_open(dump_session* session);
+uint64_t session_image_position(dump_session* session, uint64_t position);
+bool session_send(dump_session* session);
+void session_receive(dump_session* session);
+void session_data_arrived(dump_session* session, std::chrono::steady_clock::time_point now);
+std::chrono::steady_clock::time_point session_deadline(dump_session* session);
+void session_check_idle(dump_session* session, std::chrono::steady_clock::time_point now);
+bool session_done(dump_session* session);
+bool session_interrupt(dump_session* session);
+bool session_close(dump_session* session);
+void session_free(dump_session* session);
+
+#endif
@@ -13,8 +13,8 @@
 //		  This program will automate the sending of command(s) to CFE to extract flash memory, 
 //		  and save it locally in an image. 
 //
-//		  You may need to change the baud rate (DEFAULT_BAUD B115200), if it's a slow speed you will 
-//		  need to set VTIME_APPLIED to VTIME_SLOW and recompile.
+//		  You may need to change the baud rate (default 115200) with baud=, if it's a slow link 
+//		  that can go quiet for a while you may need a longer timeout=.
 //
 // 		  It works a bit like Unix dd, to read the flash you will need to at least specify:
 //			 1. The device name e.g. flash0, or flash0.boot, or flash0.nvram, etc.
@@ -33,329 +33,617 @@
 // [1] https://github.com/gbmhunter/CppLinuxSerial
 // [2] https://blog.mbedded.ninja/programming/operating-systems/linux/linux-serial-ports-using-c-cpp/#vmin-and-vtime-c_cc
 //
-// Trim functions for std::string copied from:
-// [1] https://www.techiedelight.com/trim-string-cpp-remove-leading-trailing-spaces/
-//
-// Hex character conversion from stack overflow.
-// [1] https://stackoverflow.com/questions/17261798/converting-a-hex-string-to-a-byte-array
+// Trim and hex conversion functions are in line_parser.cpp, see references there.
 
 #include "fdump.h"
 
 #ifdef POSIX
+	// Only flags are set here: the console thread's lock may be held when the signal comes.
 	void sighandler(int sig)
 	{
-		if(verbose)
-		{
-			std::cout << "Signal " << sig << " caught..." << std::endl;	
-		}
-
+		caught_signal = sig;
 		continue_cfe = false;
 	}
 #endif
 
-bool serial_read_single_char(uart_dev* uart_device, char** out)
+// Says which signal stopped the dump, once, from outside the handler.
+void report_signal()
 {
-	// Allocate memory for read buffer, set size to read just 1 byte.
-	char read_buffer[1];
-	read_buffer[0] = '\0'; // memset(&read_buf, '\0', sizeof(read_buf));
-	void* data = (void*)&read_buffer[0];
-
-	// Read blocks for a real short time since VTIME=1 (1 is the shortest time to block) 
-	// Read blocks until any number of characters are returned since VMIN=0.
+#ifdef POSIX
+	if(verbose && caught_signal != 0)
+	{
+		std::cout << "Signal " << caught_signal << " caught..." << std::endl;
+		caught_signal = 0;
+	}
+#endif
+}
 
-	unsigned long num_bytes = uart_read(uart_device, &data, sizeof(read_buffer));
+void serial_read(rx_buffer* rx)
+{
+	rx_reset_line(rx);
 
-	//if (num_bytes < 0) 
-	//{
-	//	std::cout << "Error reading: " << strerror(errno) << std::endl;
-	//    return false;
-	//}
-	
-	if(num_bytes > 0)
+	while(rx_fill(rx))
 	{
-		// Just return a single character.
-		*out = &read_buffer[0];
+		const char* line;
+		uint32_t line_len;
 
-		return true;
+		while(rx_next_line(rx, &line, &line_len))
+		{
+			std::cout << line << std::endl;
+		}
 	}
 
-	// Nothing to read.
-	return false;
+	// Whatever is left is likely the CFE> prompt.
+	rx_reset_line(rx);
 }
 
-void serial_read(uart_dev* uart_device)
+// The dump the command line asks for.
+dump_settings dump_settings_from_args()
 {
-	bool read = true;
-	while(read)
-	{		
-		char* c;
-		read = serial_read_single_char(uart_device, &c);
-		std::cout << *c;
-	}
+	dump_settings settings;
+
+	settings.device_name = *device_name;
+	settings.offset = offset;
+	settings.size = size_in_bytes;
+	settings.block_size = block_size;
+	settings.block_size_auto = block_size_auto;
+	settings.pipeline_depth = pipeline_depth;
+	settings.retries = retries;
+	settings.idle_timeout_ms = idle_timeout_ms;
+	settings.of_name = output_to_file ? *of_name : "";
+	settings.journal = true;
+	settings.sparse = sparse;
+	settings.compress = compress_type;
+	settings.map_name = (map_name != nullptr) ? *map_name : "";
+	settings.resume = resume;
+	settings.stripe_count = 1;
+	settings.stripe_index = 0;
+	settings.stripe_size = 0;
+	settings.digests = digests;
+	settings.manifest_name = (manifest_name != nullptr) ? *manifest_name : "";
+	settings.verify_type = verify_type;
+	settings.verify_hex = verify_hex;
+	settings.read_twice = read_twice;
+	settings.print_data = print_data;
+	settings.console = console;
+	settings.stats = show_stats;
+	settings.progress = progress;
+	settings.verbose = verbose;
+	settings.very_verbose = very_verbose;
+
+	return settings;
 }
 
-std::string ltrim(const std::string& s)
+// Read and write out the dump, waiting on the tty between steps.
+// Returns false if the image or the journal couldn't be written.
+bool flash_dump(dump_session* session)
 {
-	size_t start = s.find_first_not_of(WHITESPACE);
-	return (start == std::string::npos) ? "" : s.substr(start);
-}
+	while(continue_cfe)
+	{
+		if(!session_send(session))
+		{
+			return false;
+		}
 
-std::string rtrim(const std::string& s)
-{
-	size_t end = s.find_last_not_of(WHITESPACE);
-	return (end == std::string::npos) ? "" : s.substr(0, end + 1);
-}
+		if(session_done(session))
+		{
+			return true;
+		}
 
-std::string trim(const std::string& s)
-{
-	return rtrim(ltrim(s));
-}
+		// Pull everything the tty has ready in one go, waits up to UART_READ_TIMEOUT_MS if there is nothing.
+		uint64_t start = stats_start(&session->stats);
+		bool filled = rx_fill(session->rx);
+		stats_add(&session->stats, SP_RECEIVE, start);
 
-bool starts_with(std::string source, std::string compare)
-{
-	return source.rfind(compare, 0) == 0;
+		if(filled)
+		{
+			session_data_arrived(session, std::chrono::steady_clock::now());
+		}
+		else
+		{
+			session_check_idle(session, std::chrono::steady_clock::now());
+		}
+
+		session_receive(session);
+	}
+
+	return session_interrupt(session);
 }
 
-int hex_to_int(char input)
+// One session over the tty from open to close, adds what it read to bytes_read.
+// Returns false if it failed or left blocks with missing lines.
+bool dump_run(const dump_settings& settings, rx_buffer* rx, uint64_t* bytes_read)
 {
-	if(input >= '0' && input <= '9')
+	bool fail = false;
+	dump_session* dump;
+	session_init(&dump, settings, rx->uart_device, rx);
+
+	if(!session_open(dump))
 	{
-		return input - '0';
+		fail = true;
 	}
-	else if(input >= 'a' && input <= 'f')
+
+	// The console rate is settled, from here on the reader thread owns the tty's receive side.
+	if(!fail && rx_thread)
 	{
-		return input - 'a' + 10;
+		rx_start_reader(rx);
 	}
-	else if(input >= 'A' && input <= 'F')
+
+	if(!fail && !flash_dump(dump))
 	{
-		return input - 'A' + 10;
+		fail = true;
 	}
-	throw std::invalid_argument("Invalid input string");
-}
 
-// This function assumes src to be a zero terminated sanitized string with
-// an even number of [0-9a-f] characters, and target to be sufficiently large
-void hex_to_buffer(const char* src, char* target)
-{
-	// Convert hex data to a byte buffer.
-	while(*src && src[1])
+	rx_stop_reader(rx);
+
+	if(!session_close(dump))
 	{
-		*(target++) = hex_to_int(*src)*16 + hex_to_int(src[1]);
-		src += 2;
+		fail = true;
 	}
-}
 
-bool is_printable_ascii_char(char c)
-{
-	return (c > 31) && (c < 127);
+	*bytes_read += dump->bytes_read;
+
+	if(dump->incomplete_blocks > 0)
+	{
+		// Missing lines were written as zeros, a resume reads those blocks again.
+		std::cout << dump->incomplete_blocks << " block(s) still had missing or unconfirmed lines after " << settings.retries 
+			<< " re-read round(s), run again with resume to fill them." << std::endl;
+		fail = true;
+	}
+
+	if(verbose && dump->pipeline != nullptr)
+	{
+		dump_pipeline* pipeline = dump->pipeline;
+
+		std::cout << "Line checks: " << pipeline->bad_lines << " damaged, " << pipeline->stray_lines 
+			<< " out of place, " << pipeline->repaired_lines << " repaired, " << pipeline->confirmed_lines
+			<< " confirmed by a second copy, with " << pipeline->rereads << " re-reads" << std::endl;
+	}
+
+	session_free(dump);
+
+	return !fail;
 }
 
-void hexbuffer_to_friendlystring(const char* src, char* target)
+// Dumps with ref= or probe. It copies the reference, or erased flash for probe, to of=, finds
+// the regions that changed and reads only those over the copy. If CFE has a checksum command,
+// a region changed where its CRC32 isn't the copy's. Without one ref= reads the whole range
+// like any dump and then compares of= with the reference, for delta=. With sampled, and with
+// probe, a few samples of every region are read instead and the regions with a sample that
+// differs are read in full. The regions left out weren't read, so unless verify= matches the
+// image is unverified: this still returns true, with a warning, and fdump exits with
+// EXIT_UNVERIFIED.
+bool diff_dump(rx_buffer* rx, uint64_t* bytes_read)
 {
-	// Convert hex data to printable c-string.
-	while(*src && src[1])
+	// With probe the reference is erased flash, which of= starts out as.
+	std::string reference = (ref_name != nullptr) ? *ref_name : "";
+	std::string against = (ref_name != nullptr) ? *ref_name : "erased flash";
+	uint64_t ref_size = size_in_bytes;
+	uint64_t regions = (size_in_bytes + region_size - 1) / region_size;
+	dump_settings reading = dump_settings_from_args();
+	std::string checksum = (crc_command != nullptr) ? *crc_command : "";
+	bool crc = !checksum.empty() || diff_find_crc_command(rx, &checksum);
+
+	if(!probe && !crc && !sampled)
 	{
-		char byte = hex_to_int(*src)*16 + hex_to_int(src[1]);
+		std::cout << "Reading device " << *device_name << " in full, CFE has no checksum command to compare "
+			<< against << " with" << std::endl;
 
-		if(!is_printable_ascii_char(byte))
+		if(!dump_run(reading, rx, bytes_read))
 		{
-			byte = ' ';
+			return false;
 		}
 
-		*(target++) = byte;
-		src += 2;
-	}
-}
+		std::vector<dump_extent> whole;
 
-void output_file_open()
-{
-	if(!output_to_file) return;
+		if(!diff_reference_size(reference, &ref_size))
+		{
+			std::cout << "Opening " << against << " failed: " << strerror(errno) << std::endl;
+			return false;
+		}
 
-	// Open and create file if not exist and in binary overwrite mode.
-	_of_flash.open((*of_name).c_str(), std::ios::out | std::ios::binary); // Overwrite mode.
+		diff_region_extents(size_in_bytes, ref_size, region_size, &whole);
 
-	if (_of_flash.fail())
-    {
-    	throw std::ios_base::failure(std::strerror(errno));
-    }
+		if(!diff_changed_extents(*of_name, reference, size_in_bytes, ref_size, region_size, whole, &reading.extents))
+		{
+			std::cout << "Comparing " << *of_name << " with " << against << " failed: " << strerror(errno) << std::endl;
+			return false;
+		}
 
-	assert(_of_flash.is_open());
-}
+		uint64_t changed_bytes = 0;
 
-void output_file_write(char* buffer, uint32_t real_bytes_per_line)
-{
-	if(!output_to_file) return;
+		for(const dump_extent& extent : reading.extents)
+		{
+			changed_bytes += extent.size;
+		}
 
-	//make sure write fails with exception if something is wrong.
-    _of_flash.exceptions(_of_flash.exceptions() | std::ios::failbit | std::ifstream::badbit);
+		std::cout << (changed_bytes + region_size - 1) / region_size << " of " << regions << " regions differ from "
+			<< against << " (" << changed_bytes << " bytes)" << std::endl;
 
-	_of_flash.write(buffer, real_bytes_per_line);
-}
+		if(delta_name != nullptr && !diff_write_delta(*delta_name, *of_name, size_in_bytes, reading.extents))
+		{
+			std::cout << "Writing delta " << *delta_name << " failed: " << strerror(errno) << std::endl;
+			return false;
+		}
 
-void output_file_close()
-{
-	if(!output_to_file) return;
+		return true;
+	}
+
+	std::ifstream existing((*of_name).c_str());
+	bool ok;
+
+	if(resume && existing.is_open())
+	{
+		// A resume keeps the copy, with what was patched into it so far.
+		ok = reference.empty() || diff_reference_size(reference, &ref_size);
+	}
+	else
+	{
+		ok = reference.empty() ? diff_fill_erased(*of_name, size_in_bytes)
+			: diff_copy_reference(reference, *of_name, size_in_bytes, &ref_size);
+	}
+
+	existing.close();
 
-	if(_of_flash.is_open())
+	if(!ok)
 	{
-		if(verbose)
+		std::cout << "Copying " << against << " to " << *of_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	if(crc)
+	{
+		std::cout << "Comparing " << regions << " regions of " << region_size << " bytes of " << *device_name
+			<< " with " << against << " by CFE's " << checksum << " command" << std::endl;
+
+		if(!diff_crc_extents(rx, checksum, *device_name, offset, *of_name, size_in_bytes, ref_size, region_size, &reading.extents))
 		{
-			std::cout << "Closing handle to file " << (*of_name);
+			std::cout << "Comparing " << *of_name << " with " << against << " failed: " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		// The samples only go into the copy, which is read back to compare.
+		dump_settings sampling = dump_settings_from_args();
+		diff_sample_extents(size_in_bytes, ref_size, region_size, diff_samples, &sampling.extents);
+		sampling.block_size = DIFF_SAMPLE_SIZE;
+		sampling.block_size_auto = false;
+		sampling.journal = false;
+		sampling.resume = false;
+		sampling.digests = 0;
+
+		std::cout << "Sampling " << regions << " regions of " << region_size << " bytes of " << *device_name
+			<< " against " << against << std::endl;
+
+		if(!sampling.extents.empty() && !dump_run(sampling, rx, bytes_read))
+		{
+			return false;
 		}
-		
-		_of_flash.close();	
 
-		if(verbose)
+		if(!diff_changed_extents(*of_name, reference, size_in_bytes, ref_size, region_size, sampling.extents, &reading.extents))
 		{
-			std::cout << "	[done]" << std::endl;
+			std::cout << "Comparing " << *of_name << " with " << against << " failed: " << strerror(errno) << std::endl;
+			return false;
 		}
 	}
-}
-
-void parse_data_line(std::string line, uint32_t offset, uint32_t* total_bytes_read,
-	uint32_t data_length, uint32_t data_character_len, uint32_t block_id)
-{
-	std::string seq_id = "";
-	std::string hex_data = "";
 
-	// Trim just in case.
-	line = trim(line);
+	uint64_t changed_bytes = 0;
 
-	if(starts_with(line, FDUMP_CMD + " "))
+	for(const dump_extent& extent : reading.extents)
 	{
-		line = "";
+		changed_bytes += extent.size;
 	}
-	else if(starts_with(line, "*** command status ="))
+
+	std::cout << "Reading device " << *device_name << ", " << (changed_bytes + region_size - 1) / region_size 
+		<< " of " << regions << " regions differ from " << against << " (" << changed_bytes << " bytes)" << std::endl;
+
+	// The digests are of the whole image, which is only there once the changes are in.
+	reading.digests = 0;
+
+	if(!reading.extents.empty() && !dump_run(reading, rx, bytes_read))
 	{
-		line = "";
+		return false;
 	}
-	else if(!line.empty()) 
+
+	if(delta_name != nullptr && !diff_write_delta(*delta_name, *of_name, size_in_bytes, reading.extents))
 	{
-		// Parse the line to get the hex values, then convert them into bytes.
-		//std::cout << line << std::endl;
-		try 
-		{
-			// Get the sequence id from the line (useful for debugging)
-			std::smatch match_seq;
-			if (std::regex_search(line, match_seq, re_seqid) && match_seq.size() > 1) 
-			{
-				seq_id = match_seq.str(1);
-			}
-			
-			std::sregex_iterator next(line.begin(), line.end(), re_data);
-			std::sregex_iterator end;
-			while (next != end) 
-			{
-				std::smatch match = *next;
+		std::cout << "Writing delta " << *delta_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
 
-				hex_data += match.str();
+	if(digests != 0)
+	{
+		digest_set digest;
+		digest_init(&digest, digests);
 
-				next++;
-			}
-		} 
-		catch (std::regex_error& e) 
+		if(!digest_file(&digest, *of_name, size_in_bytes)
+			|| !digest_report(&digest, "", *of_name, (manifest_name != nullptr) ? *manifest_name : "", verify_type, verify_hex))
 		{
-		  	// Syntax error in the regular expression?
-			std::cout << "Regex syntax error?" << std::endl;
+			return false;
 		}
+	}
+
+	uint64_t left_out = regions - (changed_bytes + region_size - 1) / region_size;
+
+	// A CRC from CFE or a verify= that matched vouches for the regions left out.
+	if(!crc && verify_type == 0 && left_out > 0)
+	{
+		std::cout << "Unverified: " << left_out << " region(s) of " << *of_name
+			<< " are " << against << " where their samples matched it, a change between the samples is missed." << std::endl;
+
+		// The image is all there, scripts tell it from a failed dump by the exit status.
+		unverified = true;
+	}
 
-		if(hex_data.length() > data_character_len)
+	return true;
+}
+
+// Rebuilds of= from ref= and the delta in in=.
+bool patch_run()
+{
+	uint64_t patched = 0;
+
+	if(!diff_apply_delta(*ref_name, *in_name, *of_name, &patched))
+	{
+		std::cout << "Patching " << *ref_name << " with " << *in_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	std::cout << "Done." << std::endl;
+	std::cout << "Bytes patched: " << patched << std::endl;
+
+	if(digests != 0)
+	{
+		digest_set digest;
+		uint64_t size = 0;
+
+		digest_init(&digest, digests);
+
+		return diff_reference_size(*of_name, &size) && digest_file(&digest, *of_name, size)
+			&& digest_report(&digest, "", *of_name, (manifest_name != nullptr) ? *manifest_name : "", verify_type, verify_hex);
+	}
+
+	return true;
+}
+
+// Writes the part of the compressed image in= that offset= and size= cover to of=.
+bool unpack_run()
+{
+	uint64_t extracted = 0;
+
+	if(!compress_extract(*in_name, offset, size_in_bytes, *of_name, &extracted))
+	{
+		std::cout << "Unpacking " << *in_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	std::cout << "Done." << std::endl;
+	std::cout << "Bytes unpacked: " << extracted << std::endl;
+
+	return true;
+}
+
+bool replay_write(const uint8_t* data, uint64_t len, uint64_t position)
+{
+	// Called in input order with the data recovered from the capture.
+	if(print_data && console != nullptr)
+	{
+		console_hexdump(console, position, data, (uint32_t)len);
+	}
+	else if(print_data)
+	{
+		char text[FORMATTED_LINE_MAX];
+
+		for(uint64_t i = 0; i < len; i += BYTES_PER_LINE)
 		{
-			// Ensure length of hex data is data_character_len characters long (32 by default). 
-			// Otherwise truncate the remainder. 
-			// This is done because the regex matches 
-			// extra parts of the line that aren't valid data.
-			hex_data.erase(data_character_len, std::string::npos);	
+			uint32_t line_len = (len - i < BYTES_PER_LINE) ? (uint32_t)(len - i) : BYTES_PER_LINE;
+
+			format_data_line(text, position + i, data + i, line_len, nullptr);
+			std::cout << text << NEW_LINE;
 		}
+	}
 
-		if(!hex_data.empty())
-		{
-			uint32_t real_bytes_per_line = hex_data.length() / 2;
-			
-			if(print_data)
-			{
-				char* printable_buffer = new char[real_bytes_per_line];
+	if(output_to_file && !image_write(&replay_image, position, data, len))
+	{
+		std::cout << "Writing " << (*of_name) << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
 
-				hexbuffer_to_friendlystring(hex_data.c_str(), printable_buffer);
-				printable_buffer[real_bytes_per_line-1] = '\0';
+	digest_update(&replay_digest, data, len);
 
-				// Print the seq_id in decimal format.
-				uint32_t seq_id_dec = offset + ((block_id-1) * data_length);
-				printf("%010u", seq_id_dec);
+	return true;
+}
 
-				// Uncomment to print the seq_id in hex format.
-				//std::cout << seq_id;
+bool replay_run()
+{
+	replay_stats stats;
 
-				std::cout << " " << hex_data;
+	image_init(&replay_image);
+	digest_init(&replay_digest, digests);
 
-				printf(" %s", printable_buffer);
-				
+	if(output_to_file && !((compress_type != COMPRESS_NONE) ? image_open_compressed(&replay_image, *of_name, compress_type)
+		: image_open(&replay_image, *of_name, 0, false)))
+	{
+		std::cout << "Opening " << *of_name << " failed: " << strerror(errno) << std::endl;
+		return false;
+	}
 
-				std::cout << std::endl;
+	std::cout << "Replaying capture " << (*in_name == REPLAY_STDIN ? "from stdin" : *in_name) << std::endl;
 
-				delete[] printable_buffer;
-			}
+	bool ok = replay_capture(*in_name, replay_threads, &replay_write, &stats);
 
-			if(output_to_file)
-			{
-				//char* buffer = new char[BYTES_PER_LINE];
-				char* buffer = new char[real_bytes_per_line];
+	if(verbose && output_to_file)
+	{
+		std::cout << "Closing handle to file " << (*of_name);
+	}
 
-				hex_to_buffer(hex_data.c_str(), &buffer[0]);	
+	if(!image_close(&replay_image))
+	{
+		std::cout << "Writing " << (*of_name) << " failed: " << strerror(errno) << std::endl;
+		ok = false;
+	}
+	else if(verbose && output_to_file)
+	{
+		std::cout << "	[done]" << std::endl;
+	}
 
-				//printf(" %c", buffer[real_bytes_per_line-1]); // Have a look at last byte in line of data to check if sane.
+	if(!ok)
+	{
+		std::cout << "Replay of " << *in_name << "			[failed]	" << strerror(errno) << std::endl;
+	}
 
-				output_file_write(&buffer[0], real_bytes_per_line);	
+	std::cout << "Done." << std::endl;
+	std::cout << "Size in bytes read: " << std::to_string(stats.bytes) << std::endl;
 
-				delete[] buffer;
-			}
-			
-			*total_bytes_read += real_bytes_per_line;
-		}
+	if(verbose)
+	{
+		double mb_per_second = (stats.seconds > 0.0) ? (double)stats.input_bytes / stats.seconds / 1e6 : 0.0;
+
+		std::cout << "Replayed " << stats.input_bytes << " bytes of capture, " << stats.lines << " lines, " 
+			<< stats.data_lines << " data lines in " << stats.seconds << " s (" << mb_per_second << " MB/s, " 
+			<< stats.threads << " threads)" << std::endl;
+	}
+
+	if(ok && digests != 0)
+	{
+		ok = digest_report(&replay_digest, "", output_to_file ? compress_image_name(*of_name, compress_type) : *in_name, 
+			(manifest_name != nullptr) ? *manifest_name : "", verify_type, verify_hex);
+	}
+
+	return ok;
+}
+
+// The line settings and dump for a batch job or a channel, from the command line.
+batch_job batch_job_from_args()
+{
+	batch_job job{};
+	job.settings = dump_settings_from_args();
+	job.baud = baud_rate;
+	job.flow_control = DEFAULT_FLOW_CONTROL;
+	job.parity = parity;
+	job.parity_mode = DEFAULT_PARITY_MODE;
+	job.stop_bits = stop_bits;
+	job.data_bits = data_bits;
+
+	return job;
+}
+
+bool batch_main()
+{
+	// Anything a job line leaves out comes from the command line.
+	batch_job defaults = batch_job_from_args();
+	defaults.settings.of_name = "";
+	defaults.settings.map_name = "";
+	defaults.settings.compress = (compress_name != nullptr) ? compress_type : (uint32_t)COMPRESS_NONE;
+	defaults.settings.digests &= ~verify_type;
+	defaults.settings.verify_type = 0;
+
+	std::vector<batch_job*> jobs;
+	bool ok = batch_load(*batch_name, defaults, &jobs);
+
+	if(ok)
+	{
+#ifdef POSIX
+		signal(SIGABRT, &sighandler);
+		signal(SIGTERM, &sighandler);
+		signal(SIGINT, &sighandler);
+#endif
+
+		std::cout << "Batch of " << jobs.size() << " dumps from " << *batch_name << std::endl;
+
+		ok = batch_run(jobs, &continue_cfe);
+		report_signal();
 	}
+
+	batch_free(jobs);
+
+	std::cout << "Done." << std::endl;
+
+	return ok;
 }
 
-void flash_read_block(uart_dev* uart_device, uint32_t offset, uint32_t* total_bytes_read)
+// One dump striped over tty= and the consoles in channels=, all into the same CFE.
+bool stripe_main()
 {
-	uint32_t data_length = BYTES_PER_LINE; // There should be 16 bytes returned per line. So block_size must be a multiple of 16.
-	uint32_t data_character_len = data_length * 2; // There should be 32 characters making up the hex data in the line.
-	bool read = true;
-	std::string line = "";
-	uint32_t block_id = 0;
+	std::vector<std::string> ttys = { *tty_interface };
+	std::string names = *channel_names;
+	size_t start = 0;
 
-	while(read && continue_cfe)
-	{		
-		char* c;
-		read = serial_read_single_char(uart_device, &c);
+	while(start <= names.length())
+	{
+		size_t comma = std::min(names.find(',', start), names.length());
 
-		if(read)
+		if(comma > start)
 		{
-			if(*c =='\n' || *c == '\r')
-			{
-				// Parse lines.
-				if(!line.empty())
-				{
-					// Parse line to strip commands and feedback that is not data.
-					parse_data_line(line, offset, total_bytes_read, data_length, data_character_len, block_id);
-					
-					// Be ready for next line.
-					line = "";
-					block_id ++;
-				}
-			}
-			else
-			{
-				// Append the single character to the line parser.
-				line += *c;
-			}
+			ttys.push_back(names.substr(start, comma - start));
+		}
+
+		start = comma + 1;
+	}
+
+	if(output_to_file)
+	{
+		// Every channel writes its own blocks into the one image, so it has to be there first.
+		FILE* image = fopen((*of_name).c_str(), resume ? "ab" : "wb");
 
+		if(image == nullptr)
+		{
+			std::cout << "Opening " << *of_name << " failed: " << strerror(errno) << std::endl;
+			return false;
 		}
+
+		fclose(image);
 	}
 
-	if(!continue_cfe) 
+	std::vector<batch_job*> jobs;
+
+	for(uint32_t i = 0; i < ttys.size(); i++)
 	{
-		read = false;
+		batch_job* job = new batch_job(batch_job_from_args());
+		job->tty = ttys[i];
+		job->settings.name = ttys[i];
+		job->settings.stripe_count = (uint32_t)ttys.size();
+		job->settings.stripe_index = i;
+		job->settings.stripe_size = (stripe_size > 0) ? stripe_size : block_size;
+		jobs.push_back(job);
 	}
+
+#ifdef POSIX
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+#endif
+
+	std::cout << "Reading device " << *device_name << " over " << ttys.size() << " channels, "
+		<< jobs.front()->settings.stripe_size << " bytes at a time" << std::endl;
+
+	bool ok = batch_run(jobs, &continue_cfe);
+	uint64_t bytes_read = 0;
+
+	report_signal();
+
+	for(batch_job* job : jobs)
+	{
+		bytes_read += (job->session != nullptr) ? job->session->bytes_read : 0;
+	}
+
+	batch_free(jobs);
+
+	std::cout << "Done." << std::endl;
+	std::cout << "Size in bytes read: " << bytes_read << std::endl;
+
+	if(ok && digests != 0 && output_to_file)
+	{
+		// The channels write all over the image, so it is hashed once they are done.
+		digest_set digest;
+		digest_init(&digest, digests);
+
+		ok = digest_file(&digest, *of_name, size_in_bytes)
+			&& digest_report(&digest, "", *of_name, (manifest_name != nullptr) ? *manifest_name : "", verify_type, verify_hex);
+	}
+
+	return ok;
 }
 
 constexpr uint32_t arg_hash(const char* entropy)
@@ -397,7 +685,7 @@ std::string* arg_get_value(char* arg)
 	char c = 0xFF;
 	bool searching = true;
 	bool ignore_key_name = true;
-	int arg_len = strlen(arg);
+	uint32_t arg_len = (uint32_t)strlen(arg);
 
 	arg[arg_len] = '\0';
 
@@ -497,9 +785,9 @@ void show_help()
     "  This program will automate the sending of command(s)" NEW_LINE
     "  to CFE to extract flash memory, and save it locally in an image." NEW_LINE
     NEW_LINE
-    "  You may need to change the baud rate (DEFAULT_BAUD B115200)," NEW_LINE 
-    "  if it's a slow speed you will need to set VTIME_APPLIED" NEW_LINE 
-    "  to VTIME_SLOW and recompile. There are Comm Timeout settings for Windows." NEW_LINE
+    "  You may need to change the baud rate (default 115200) with baud=," NEW_LINE 
+    "  if it's a slow link that can go quiet for a while you may need" NEW_LINE 
+    "  a longer timeout=." NEW_LINE
     NEW_LINE
     "  It works a bit like Unix dd, to read the flash you will need to" NEW_LINE 
     "  at least specify:" NEW_LINE
@@ -522,14 +810,20 @@ void show_help()
     " 3. bs          - The block size. Must be set to multiples of 16 to help parser." NEW_LINE
     "                  Small block sizes and a really large 'size' set" NEW_LINE
     "                  is really slow for reads." NEW_LINE
+    "                  bs=auto times each block and counts its damaged lines," NEW_LINE
+    "                  and sizes the next one to balance the per command" NEW_LINE
+    "                  overhead against the cost of reading a block again." NEW_LINE
     " 4. size/count  - The count in bytes of memory to copy." NEW_LINE
     "                  All values are in decimal." NEW_LINE
     "                  Importantly you will likely need to know the exact size" NEW_LINE
     "                  you need to copy which can be hard to figure out." NEW_LINE
+    "                  If it isn't a multiple of bs= the last block is shorter." NEW_LINE
     "Valid options are:" NEW_LINE 
     " -h / -help / --help, Display the help and exit." NEW_LINE
     " -of for output file, -v for verbose, -vv for very verbose," NEW_LINE 
     " -l to print the data like hexdump." NEW_LINE
+    " -print_rate=50      Show at most this many -l lines a second, the newest of" NEW_LINE
+    "                     each block, for a slow terminal. Default 0 shows them all." NEW_LINE
     " -tty=/dev/ttyUSB0   To change the tty serial device on Linux." NEW_LINE
     " -tty=/dev/ttyS0" NEW_LINE
     " -tty=/dev/ttyS1" NEW_LINE 
@@ -539,7 +833,42 @@ void show_help()
 	" -tty=COM1           To change the tty usb serial device on Windows." NEW_LINE
 	"                       Maybe also try COM2, or anything above COM10 to COM256." NEW_LINE
     NEW_LINE
-    " You may also need to change the baud rate and settings which are: 115200 8/N/1" NEW_LINE
+    " -baud=921600        To change the baud rate, default is 115200." NEW_LINE
+    "                     Rates up to 4000000 and, on Linux and the BSDs, custom rates work" NEW_LINE
+    "                     if the adapter supports them. fdump stops if the driver can't apply it." NEW_LINE
+    NEW_LINE
+    " -autobaud=921600    Switch the CFE console to the fastest rate up to this one" NEW_LINE
+    "                     for the dump, and back to baud= at the end. Needs a CFE" NEW_LINE
+    "                     with a baud command, each rate is checked before use." NEW_LINE
+    " -baudcmd=\"baud %u\" The console command that changes the rate, if help" NEW_LINE
+    "                     doesn't list a known one. %u is replaced by the rate." NEW_LINE
+    NEW_LINE
+    " -timeout=2000       A command is finished once CFE prints its status line" NEW_LINE
+    "                     and the prompt. If neither comes, it is given up on" NEW_LINE
+    "                     after this many milliseconds without any data." NEW_LINE
+    " -pipeline=1         Type this many fdump commands ahead of the one CFE is" NEW_LINE
+    "                     running, so it starts the next without waiting on fdump." NEW_LINE
+    "                     Depends on how much typed input the console keeps while" NEW_LINE
+    "                     busy, lost commands are read again. Default 0, up to 8." NEW_LINE
+    " -retries=3          Every line is checked against its address and the bytes" NEW_LINE
+    "                     it should hold, lost or damaged ranges of a block are" NEW_LINE
+    "                     read again with a narrow fdump this many times." NEW_LINE
+    " -rxthread=0         Read the tty on the main thread between parsing lines" NEW_LINE
+    "                     instead of on a reader thread of its own. Default 1." NEW_LINE
+    " -hash=sha256,crc32  Work out these digests (crc32, sha256, xxh64 or all) from" NEW_LINE
+    "                     the blocks as they are written and print them at the end." NEW_LINE
+    " -manifest=SUMS      Add the digests to this file as sha256sum --tag writes them," NEW_LINE
+    "                     sha256sum -c or xxhsum -c can check the image. Default hash=sha256." NEW_LINE
+    " -verify=sha256:<hex> Fail if the image doesn't have this digest." NEW_LINE
+    " -verify=twice       Only take a line with bytes shown as '.' in its ASCII" NEW_LINE
+    "                     column once a second copy agrees, reading most binary" NEW_LINE
+    "                     data twice. Goes with a digest as twice,sha256:<hex>." NEW_LINE
+    " --stats             Print the time spent in each step of the dump, block" NEW_LINE
+    "                     latency p50/p99/max and the line rate against baud=." NEW_LINE
+    " -progress=FILE      Write progress as a JSON object a line, a start, block" NEW_LINE
+    "                     and end event per dump, to FILE or to fd:N." NEW_LINE
+    NEW_LINE
+    " You may also need to change the other settings which are: 8/N/1" NEW_LINE
     " *To do that you will have to change the code and recompile." NEW_LINE
     NEW_LINE
     " Examples:" NEW_LINE
@@ -551,6 +880,57 @@ void show_help()
     " (large block size to make reads quicker):" NEW_LINE
     "    ./fdump if=flash0.nvram of=f0.nvram.bin offset=0 bs=65536 size=65536 -v -l" NEW_LINE
     NEW_LINE
+    " Resume: Every block written to of= is recorded in of.journal with its CRC-32." NEW_LINE
+    " If a dump is cut short, run it again with the same options and resume" NEW_LINE
+    " to carry on from the first missing block instead of starting over:" NEW_LINE
+    "    ./fdump if=flash0 of=flash0.bin offset=0 bs=65536 size=16777216 -v resume" NEW_LINE
+    NEW_LINE
+    " Replay: Rebuild an image from a captured console log (minicom, screen)" NEW_LINE
+    " of fdump sessions that were run by hand, no router or tty needed:" NEW_LINE
+    "    ./fdump replay in=capture.log of=image.bin -v" NEW_LINE
+    "    cat capture.log | ./fdump replay of=image.bin" NEW_LINE
+    "  in=       - The captured log, default is stdin (in=-)." NEW_LINE
+    "  threads=  - Parser threads, default is one per CPU." NEW_LINE
+    NEW_LINE
+    " Batch: Dump several routers at once, one per tty, from a job file with" NEW_LINE
+    " a line per dump. Options a line leaves out come from the command line:" NEW_LINE
+    "    tty=/dev/ttyUSB0 if=flash0 offset=0 size=16777216 of=router1.bin" NEW_LINE
+    "    tty=/dev/ttyUSB1 if=flash0 offset=0 size=16777216 of=router2.bin" NEW_LINE
+    "    ./fdump batch=jobs.txt bs=auto baud=115200 pipeline=1 -v" NEW_LINE
+    NEW_LINE
+    " Compressed: An of= ending in .gz is written gzip compressed as the dump runs," NEW_LINE
+    " in 1 MiB chunks listed in of.idx, so part of it can be read back alone:" NEW_LINE
+    "    ./fdump if=flash0 of=flash0.bin.gz offset=0 bs=65536 size=16777216" NEW_LINE
+    "    ./fdump unpack in=flash0.bin.gz offset=65536 size=4096 of=part.bin" NEW_LINE
+    "  compress= - gzip or none, whatever of= is called." NEW_LINE
+    NEW_LINE
+    " Erased flash: -v counts the lines read that are all 0xff or all 0x00." NEW_LINE
+    "  sparse    - Leave runs of zeros out of of= as holes." NEW_LINE
+    "  map=      - Write the runs of 4096 bytes or more to this file." NEW_LINE
+    "  probe     - Only read the regions= that aren't all 0xff, found by CFE's" NEW_LINE
+    "              checksum command or else by samples like ref= sampled. Sampled" NEW_LINE
+    "              regions that look erased are filled in unread, so unless" NEW_LINE
+    "              verify= matches fdump warns and exits with 2 for unverified." NEW_LINE
+    NEW_LINE
+    " Reference: Find what changed since an earlier image of the same flash." NEW_LINE
+    " If help lists a checksum command, only the regions whose CRC-32 differs" NEW_LINE
+    " are read. Otherwise the flash is read in full and compared afterwards." NEW_LINE
+    "    ./fdump if=flash0 of=new.bin offset=0 bs=65536 size=16777216 ref=old.bin delta=new.delta" NEW_LINE
+    "    ./fdump patch ref=old.bin in=new.delta of=new.bin" NEW_LINE
+    "  region=   - Size of the regions compared, default 65536." NEW_LINE
+    "  delta=    - Also write the regions that changed to this file, for patch." NEW_LINE
+    "  crccmd=   - CFE's checksum command, if help doesn't list crc32 or crc." NEW_LINE
+    "  sampled   - Without a checksum command, read a few spots of every region" NEW_LINE
+    "              and only the regions where one differs in full. A change" NEW_LINE
+    "              between spots is missed, so unless verify= matches fdump warns" NEW_LINE
+    "              and exits with 2 for unverified instead of 0." NEW_LINE
+    "  samples=  - Spots of 64 bytes read from each region, default 4." NEW_LINE
+    NEW_LINE
+    " Channels: Stripe one dump over tty= and more consoles into the same CFE," NEW_LINE
+    " each reading every Nth run of stripe= bytes into the one image:" NEW_LINE
+    "    ./fdump tty=/dev/ttyUSB0 channels=/dev/ttyUSB1 if=flash0 offset=0 bs=65536 size=16777216 of=flash0.bin" NEW_LINE
+    "  stripe=   - Run of bytes per console, a multiple of 16, default is bs=." NEW_LINE
+    NEW_LINE
     " Known Issues: You may press ctrl-c to cancel, however it likely will not" NEW_LINE 
     "               cancel the operation on the CFE console." NEW_LINE
     NEW_LINE
@@ -566,6 +946,10 @@ void show_help()
 
 void free_memory()
 {
+	// Everything queued for the terminal goes out first.
+	console_close(console);
+	console = nullptr;
+
 	if(tty_interface != nullptr)
 	{
 		delete tty_interface;
@@ -579,6 +963,61 @@ void free_memory()
 	{
 		delete of_name;	
 	}
+	if(in_name != nullptr)
+	{
+		delete in_name;
+	}
+	if(batch_name != nullptr)
+	{
+		delete batch_name;
+	}
+	if(channel_names != nullptr)
+	{
+		delete channel_names;
+	}
+	if(ref_name != nullptr)
+	{
+		delete ref_name;
+	}
+	if(map_name != nullptr)
+	{
+		delete map_name;
+	}
+	if(compress_name != nullptr)
+	{
+		delete compress_name;
+	}
+	if(progress_name != nullptr)
+	{
+		delete progress_name;
+	}
+
+	progress_close(progress);
+	progress = nullptr;
+	if(delta_name != nullptr)
+	{
+		delete delta_name;
+	}
+	if(hash_names != nullptr)
+	{
+		delete hash_names;
+	}
+	if(manifest_name != nullptr)
+	{
+		delete manifest_name;
+	}
+	if(verify_digest != nullptr)
+	{
+		delete verify_digest;
+	}
+	if(baud_command != nullptr)
+	{
+		delete baud_command;
+	}
+	if(crc_command != nullptr)
+	{
+		delete crc_command;
+	}
 }
 
 bool parse_program_arguments(int argc, char** argv)
@@ -594,7 +1033,7 @@ bool parse_program_arguments(int argc, char** argv)
 	// size_in_bytes count= or size=				Required
 	// offset 		 skip=  or offset=				Optional
 	// tty_interface tty=							optional  default value is DEFAULT_TTY
-	// blocks_to_copy = size_in_bytes / block_size; Automatically calculated.
+	// blocks_to_copy = size_in_bytes / block_size, rounded up; Automatically calculated.
 	// output_to_file = true, if of is specified.	Automatically calculated.
 	// verbose 		 -v 							Optional
 	// very_verbose	 -vv 							Optional
@@ -668,8 +1107,18 @@ bool parse_program_arguments(int argc, char** argv)
     			if(of_name != nullptr) output_to_file = true;
     		break;
     		case arg_hash("bs="):
-				// Parse block size from next argument.
-    			parse_uint_arg(arg, show_parsed, &block_size);
+				// Parse block size from next argument, or auto to size the blocks as the dump runs.
+    			block_size_auto = (*arg_get_value(arg) == BLOCK_SIZE_AUTO);
+
+    			if(block_size_auto)
+    			{
+    				block_size = TUNER_MAX_SIZE;
+    				show_parsed();
+    			}
+    			else
+    			{
+    				parse_uint_arg(arg, show_parsed, &block_size);
+    			}
     			got_bs = true;
     		break;
     		case arg_hash("count="):
@@ -690,8 +1139,140 @@ bool parse_program_arguments(int argc, char** argv)
     			// Parse tty from next argument.
     			parse_string_arg(arg, show_parsed, &tty_interface);
     		break;
+    		case arg_hash("-baud="):
+    		case arg_hash("baud="):
+    			// Parse line speed from next argument.
+    			parse_uint_arg(arg, show_parsed, &baud_rate);
+    		break;
+    		case arg_hash("autobaud="):
+    			// Parse fastest rate to negotiate from next argument.
+    			parse_uint_arg(arg, show_parsed, &autobaud_max);
+    		break;
+    		case arg_hash("baudcmd="):
+    			// Parse console baud command template from next argument.
+    			parse_string_arg(arg, show_parsed, &baud_command);
+    		break;
+    		case arg_hash("crccmd="):
+    			// Parse console checksum command from next argument.
+    			parse_string_arg(arg, show_parsed, &crc_command);
+    		break;
+    		case arg_hash("resume"):
+    		case arg_hash("-resume"):
+    			resume = true;
+    		break;
+    		case arg_hash("-timeout="):
+    		case arg_hash("timeout="):
+    			// Parse idle timeout in milliseconds from next argument.
+    			parse_uint_arg(arg, show_parsed, &idle_timeout_ms);
+    		break;
+    		case arg_hash("-pipeline="):
+    		case arg_hash("pipeline="):
+    			// Parse commands to type ahead from next argument.
+    			parse_uint_arg(arg, show_parsed, &pipeline_depth);
+    		break;
+    		case arg_hash("-rxthread="):
+    		case arg_hash("rxthread="):
+    			// Parse reader thread switch from next argument.
+    			{
+    				uint32_t value = 1;
+    				parse_uint_arg(arg, show_parsed, &value);
+    				rx_thread = (value != 0);
+    			}
+    		break;
+    		case arg_hash("-retries="):
+    		case arg_hash("retries="):
+    			// Parse re-read budget per block from next argument.
+    			parse_uint_arg(arg, show_parsed, &retries);
+    		break;
     		case arg_hash("-l"):
     			print_data = true;
+    		break;
+    		case arg_hash("-print_rate="):
+    		case arg_hash("print_rate="):
+    			// Parse most -l lines a second from next argument.
+    			parse_uint_arg(arg, show_parsed, &print_rate);
+    		break;
+    		case arg_hash("progress="):
+    			// Parse progress event file or fd:N from next argument.
+    			parse_string_arg(arg, show_parsed, &progress_name);
+    		break;
+    		case arg_hash("--stats"):
+    		case arg_hash("-stats"):
+    			show_stats = true;
+    		break;
+    		case arg_hash("replay"):
+    			replay_mode = true;
+    		break;
+    		case arg_hash("in="):
+    			// Parse captured console log to replay from next argument.
+    			parse_string_arg(arg, show_parsed, &in_name);
+    		break;
+    		case arg_hash("sparse"):
+    			sparse = true;
+    		break;
+    		case arg_hash("probe"):
+    			probe = true;
+    		break;
+    		case arg_hash("sampled"):
+    			sampled = true;
+    		break;
+    		case arg_hash("map="):
+    			// Parse erased map file from next argument.
+    			parse_string_arg(arg, show_parsed, &map_name);
+    		break;
+    		case arg_hash("patch"):
+    			patch_mode = true;
+    		break;
+    		case arg_hash("compress="):
+    			// Parse output compression from next argument.
+    			parse_string_arg(arg, show_parsed, &compress_name);
+    		break;
+    		case arg_hash("unpack"):
+    			unpack_mode = true;
+    		break;
+    		case arg_hash("ref="):
+    			// Parse reference image from next argument.
+    			parse_string_arg(arg, show_parsed, &ref_name);
+    		break;
+    		case arg_hash("delta="):
+    			// Parse delta file from next argument.
+    			parse_string_arg(arg, show_parsed, &delta_name);
+    		break;
+    		case arg_hash("region="):
+    			// Parse region size from next argument.
+    			parse_uint_arg(arg, show_parsed, &region_size);
+    		break;
+    		case arg_hash("samples="):
+    			// Parse samples per region from next argument.
+    			parse_uint_arg(arg, show_parsed, &diff_samples);
+    		break;
+    		case arg_hash("batch="):
+    			// Parse job file from next argument.
+    			parse_string_arg(arg, show_parsed, &batch_name);
+    		break;
+    		case arg_hash("hash="):
+    			// Parse digests to work out from next argument.
+    			parse_string_arg(arg, show_parsed, &hash_names);
+    		break;
+    		case arg_hash("manifest="):
+    			// Parse manifest file from next argument.
+    			parse_string_arg(arg, show_parsed, &manifest_name);
+    		break;
+    		case arg_hash("verify="):
+    			// Parse expected digest from next argument.
+    			parse_string_arg(arg, show_parsed, &verify_digest);
+    		break;
+    		case arg_hash("channels="):
+    			// Parse more consoles to stripe the dump over from next argument.
+    			parse_string_arg(arg, show_parsed, &channel_names);
+    		break;
+    		case arg_hash("stripe="):
+    			// Parse stripe run size from next argument.
+    			parse_uint_arg(arg, show_parsed, &stripe_size);
+    		break;
+    		case arg_hash("threads="):
+    			// Parse replay worker thread count from next argument.
+    			parse_uint_arg(arg, show_parsed, &replay_threads);
     		break;
 			case arg_hash("-h"): // Already parsed.
 			case arg_hash("-help"):
@@ -715,11 +1296,160 @@ bool parse_program_arguments(int argc, char** argv)
     }
 
     // Input validation.
-	if(got_if && got_size && got_bs && got_offset)
+	if(hash_names != nullptr && !digest_parse_types(*hash_names, &digests))
+	{
+		std::cout << "FAIL: hash= takes crc32, sha256, xxh64 or all, comma separated." << std::endl;
+
+		return false;
+	}
+
+	if(verify_digest != nullptr)
+	{
+		if(!session_parse_verify(*verify_digest, &read_twice, &verify_type, &verify_hex))
+		{
+			std::cout << "FAIL: verify= takes twice, a digest name and its hex like sha256:<64 hex digits>, or both comma separated." << std::endl;
+
+			return false;
+		}
+
+		// The expected digest has to be worked out.
+		digests |= verify_type;
+	}
+
+	if(manifest_name != nullptr && digests == 0)
+	{
+		digests = DIGEST_SHA256;
+	}
+
+	if(compress_name != nullptr)
+	{
+		if(!compress_parse_type(*compress_name, &compress_type))
+		{
+			std::cout << "FAIL: compress= takes gzip or none." << std::endl;
+
+			return false;
+		}
+	}
+	else if(output_to_file)
+	{
+		compress_type = compress_type_for_name(*of_name);
+	}
+
+	if(unpack_mode)
+	{
+		// Only files, offset= and size= are in the image.
+		if(in_name == nullptr || !output_to_file)
+		{
+			std::cout << "FAIL: unpack needs in= and of=." << std::endl;
+
+			return false;
+		}
+
+		return true; // PASS
+	}
+	else if(patch_mode)
+	{
+		// Only files, no tty.
+		if(ref_name == nullptr || in_name == nullptr || !output_to_file)
+		{
+			std::cout << "FAIL: patch needs ref=, in= and of=." << std::endl;
+
+			return false;
+		}
+
+		return true; // PASS
+	}
+	else if(replay_mode)
+	{
+		// Only the capture is needed, which defaults to stdin.
+		if(in_name == nullptr)
+		{
+			in_name = new std::string(REPLAY_STDIN);
+		}
+
+		return true; // PASS
+	}
+	else if(baud_rate == 0)
+	{
+		// B0 would hang up the line rather than set a speed.
+		std::cout << "FAIL: baud= must be a rate above 0." << std::endl;
+
+		return false;
+	}
+	else if(pipeline_depth > PIPELINE_MAX_DEPTH)
+	{
+		std::cout << "FAIL: pipeline= can type ahead at most " << PIPELINE_MAX_DEPTH << " commands." << std::endl;
+
+		return false;
+	}
+	else if(got_bs && block_size == 0)
+	{
+		std::cout << "FAIL: bs= must be a size above 0, or auto." << std::endl;
+
+		return false;
+	}
+	else if(stripe_size % BYTES_PER_LINE != 0)
+	{
+		// Runs have to start on a line of fdump output.
+		std::cout << "FAIL: stripe= must be a multiple of " << (uint32_t)BYTES_PER_LINE << "." << std::endl;
+
+		return false;
+	}
+	else if(ref_name != nullptr && (!output_to_file || batch_name != nullptr || channel_names != nullptr))
+	{
+		std::cout << "FAIL: ref= needs of= for the copy it patches, and one tty." << std::endl;
+
+		return false;
+	}
+	else if(probe && (ref_name != nullptr || !output_to_file || batch_name != nullptr || channel_names != nullptr))
+	{
+		std::cout << "FAIL: probe needs of= for the erased image it patches, and one tty, without ref=." << std::endl;
+
+		return false;
+	}
+	else if(sampled && ref_name == nullptr)
+	{
+		std::cout << "FAIL: sampled goes with ref=, probe samples without a checksum command." << std::endl;
+
+		return false;
+	}
+	else if((sparse || map_name != nullptr) && !output_to_file)
+	{
+		std::cout << "FAIL: sparse and map= need of=." << std::endl;
+
+		return false;
+	}
+	else if(map_name != nullptr && (probe || sampled || channel_names != nullptr))
+	{
+		// Each read only sees part of the range, the map would have holes.
+		std::cout << "FAIL: map= can't be used with probe, sampled or channels=." << std::endl;
+
+		return false;
+	}
+	else if(compress_type != COMPRESS_NONE && ((!output_to_file && batch_name == nullptr) || resume || sparse || ref_name != nullptr || probe || channel_names != nullptr))
+	{
+		// It is written from the start in one go.
+		std::cout << "FAIL: A compressed of= can't be used with resume, sparse, ref=, probe or channels=." << std::endl;
+
+		return false;
+	}
+	else if(region_size == 0 || region_size % BYTES_PER_LINE != 0 || diff_samples == 0)
+	{
+		std::cout << "FAIL: region= must be a multiple of " << (uint32_t)BYTES_PER_LINE << " and samples= at least 1." << std::endl;
+
+		return false;
+	}
+	else if(batch_name != nullptr)
+	{
+		// Every job line has its own tty=, if= and size=.
+		return true; // PASS
+	}
+	else if(got_if && got_size && got_bs && got_offset)
 	{
 		//TODO: Actually validate that argument values are correct before PASS here.
 
-		blocks_to_copy = size_in_bytes / block_size; 
+		// A tail shorter than bs= is read as a last, shorter block. With bs=auto this is only the most there can be.
+		blocks_to_copy = (size_in_bytes + block_size - 1) / block_size; 
 
 		if(tty_interface == nullptr)
 		{
@@ -745,7 +1475,6 @@ bool parse_program_arguments(int argc, char** argv)
 int main(int argc, char **argv)
 {
 	bool fail = false; // Assume the best.
-	uint32_t total_bytes_read = 0;
 	
 	device_name = new std::string(DEFAULT_DEV_NAME);
 	offset = 0;
@@ -780,16 +1509,82 @@ int main(int argc, char **argv)
 		display_title();
 	}
 
+	if(!fail && progress_name != nullptr && !progress_open(&progress, *progress_name))
+	{
+		std::cout << "Opening " << *progress_name << " for progress failed: " << strerror(errno) << std::endl;
+		fail = true;
+	}
+
+	if(!fail && (print_data || verbose || very_verbose))
+	{
+		// A slow terminal mustn't hold up the dump.
+		console_open(&console, print_rate);
+	}
+
+	if(!fail && batch_name != nullptr)
+	{
+		// One dump per port from the job file, all at once.
+		fail = !batch_main();
+
+		free_memory();
+
+		return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if(!fail && channel_names != nullptr)
+	{
+		// The one dump striped over several consoles.
+		fail = !stripe_main();
+
+		free_memory();
+
+		return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if(!fail && unpack_mode)
+	{
+		// Offline, part of a compressed image.
+		fail = !unpack_run();
+
+		free_memory();
+
+		return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if(!fail && patch_mode)
+	{
+		// Offline, a reference image and a delta.
+		fail = !patch_run();
+
+		free_memory();
+
+		return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if(!fail && replay_mode)
+	{
+		// Offline replay of a captured console log, no tty needed.
+		fail = !replay_run();
+
+		free_memory();
+
+		return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	// Instantiate a new uart device and configure it:
 	uart_dev* uart_device;
 	uart_init(&uart_device);
-	uart_set_baud(uart_device, DEFAULT_BAUD);
+	uart_set_baud(uart_device, baud_rate);
 	uart_set_flowctrl(uart_device, DEFAULT_FLOW_CONTROL);
 	uart_set_parity(uart_device, parity, DEFAULT_PARITY_MODE);
 	uart_set_stopbits(uart_device, stop_bits);
 	uart_set_databits(uart_device, data_bits);
 	uart_set_verbosity(uart_device, verbose);
 
+	// Buffered receive ring on top of the uart device.
+	rx_buffer* rx;
+	rx_init(&rx, uart_device, rx_thread ? RX_THREAD_BUFFER_SIZE : RX_BUFFER_SIZE);
+
 	if(!fail)
 	{
 		// Open the uart device at the specified port/device name:
@@ -814,39 +1609,55 @@ int main(int argc, char **argv)
 					std::string showdevs_cmd = SHOW_DEVICES_CMD + NEW_LINE;
 
 					uart_write(uart_device, (void*)help_cmd.c_str(), help_cmd.length());
-					serial_read(uart_device);
+					serial_read(rx);
 
 					uart_write(uart_device, (void*)showdevs_cmd.c_str(), showdevs_cmd.length());
-					serial_read(uart_device);
+					serial_read(rx);
 				}
 
-				output_file_open();
+				baud_session session;
+				autobaud_init(&session, uart_device, rx, *device_name, offset, 
+					(baud_command != nullptr) ? *baud_command : "", verbose);
 
-				std::cout << "Reading device " << *device_name << std::endl;
-				for(uint32_t i=1; i <= blocks_to_copy && continue_cfe; i++)
+				if(autobaud_max > 0 && autobaud_probe(&session) && autobaud_switch(&session, autobaud_max) == 0)
 				{
-					std::string s_cmd = FDUMP_CMD + " " + FDUMP_CMD_ARG_OFFSET 
-						+ std::to_string(offset) 
-						+ " " + FDUMP_CMD_ARG_SIZE
-						+ std::to_string(block_size) 
-						+ " " + *device_name 
-						+ "\r";
-
-					const char* cstr_cmd = s_cmd.c_str();
-					uart_write(uart_device, (void*)cstr_cmd, s_cmd.length());
-					
-					flash_read_block(uart_device, offset, &total_bytes_read);
+					// The console is at a rate nothing here can talk to.
+					fail = true;
+				}
 
-					offset += block_size;
+				uint64_t bytes_read = 0;
+
+				if(!fail && (ref_name != nullptr || probe))
+				{
+					fail = !diff_dump(rx, &bytes_read);
 				}
+				else if(!fail)
+				{
+					std::cout << "Reading device " << *device_name << std::endl;
 
-				output_file_close();
+					fail = !dump_run(dump_settings_from_args(), rx, &bytes_read);
+				}
 
 				std::cout << "Done." << std::endl;
-				std::cout << "Size in bytes read: " << std::to_string(total_bytes_read) << std::endl;
+				std::cout << "Size in bytes read: " << std::to_string(bytes_read) << std::endl;
+
+				if(verbose)
+				{
+					std::cout << "Receive syscalls: " << rx->read_calls 
+						<< " (" << rx->empty_reads << " empty) for " << rx->bytes_read << " bytes, " 
+						<< rx_syscalls_per_mib(rx) << " per MiB" << std::endl;
+
+					if(rx_thread)
+					{
+						std::cout << "Receive ring: " << rx->high_water << " of " << rx->capacity 
+							<< " bytes at most, reader stalled " << rx->stalls << " time(s) on a full ring" << std::endl;
+					}
+				}
 
 				if(!continue_cfe)
 				{
+					report_signal();
+
 					if(verbose)
 					{
 						std::cout << "Broke out of read loop." << std::endl;
@@ -854,12 +1665,16 @@ int main(int argc, char **argv)
 						std::cout << "Also trying to send ctrl-c to tty " << (*tty_interface) << "..." << std::endl;	
 					}
 					
+					// Throw away anything still buffered from the interrupted block.
+					rx_discard(rx);
+
 					// Write ctrl-c to tty (EXT_CTRL_C is etx - ASCII code 3)
 					uart_write(uart_device, (void*)(&EXT_CTRL_C), 1);
 
 					bool cfe_has_quit = true; // Assume the best.
-					char* ext;
-					if(serial_read_single_char(uart_device, &ext))
+					char ext_c;
+					char* ext = &ext_c;
+					if(rx_read_char(rx, ext))
 					{
 						// line might start with CFE> prompt or ext code.
 						if(*ext == EXT_CTRL_C || *ext == 'C') 
@@ -893,6 +1708,12 @@ int main(int argc, char **argv)
 						}
 					}
 				}
+
+				// Leave the console at the rate it came up at.
+				if(!autobaud_restore(&session))
+				{
+					fail = true;
+				}
 			}
 			else
 			{
@@ -908,11 +1729,14 @@ int main(int argc, char **argv)
 		}
 	}
 
+	rx_free(rx);
 	uart_free(uart_device);
 
 	// Free all the memory used.
 	free_memory();
 
+	report_signal();
+
 	if(!continue_cfe && verbose)
 	{
 		std::cout << "Quitting like told.." << std::endl;
@@ -922,6 +1746,11 @@ int main(int argc, char **argv)
 	{
 		return EXIT_FAILURE;	
 	}
+
+	if(unverified)
+	{
+		return EXIT_UNVERIFIED;
+	}
 	
 	return EXIT_SUCCESS;	
 }
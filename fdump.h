@@ -6,12 +6,13 @@
 	// C++ headers.
 	#include <string>
 	#include <iostream>
-	#include <regex>
 	#include <algorithm>
 	#include <fstream>
+	#include <chrono>
 
 	// C library headers.
 	#include <cstdlib>
+	#include <cstring>
 	#include <stdio.h>
 	#include <string.h>
 	#include <assert.h>
@@ -29,6 +30,55 @@
 
 	// Minimal C++ Uart library.
 	#include "uart.h"
+	#include "serial_rx.h"
+
+	// Parser for lines of fdump output.
+	#include "line_parser.h"
+
+	// Offline replay of captured console logs.
+	#include "replay.h"
+
+	// Faster console rate for the dump.
+	#include "autobaud.h"
+
+	// Progress journal for resuming dumps.
+	#include "journal.h"
+
+	// Checked blocks with selective re-reads.
+	#include "flash_block.h"
+
+	// Block size for bs=auto.
+	#include "block_tuner.h"
+
+	// Commands typed ahead with pipeline=.
+	#include "dump_pipeline.h"
+
+	// Output image written a block at a time at its offset.
+	#include "image_file.h"
+
+	// Checksums of the image as it is written.
+	#include "digest.h"
+
+	// The state of one dump, one per port with batch=.
+	#include "dump_session.h"
+
+	// Reading only what changed since a reference image.
+	#include "diff.h"
+
+	// Compressed output images and reading them back by index.
+	#include "compress.h"
+
+	// Where the time of a dump goes, --stats.
+	#include "stats.h"
+
+	// Progress events as JSON lines, progress=.
+	#include "progress.h"
+
+	// The console written by a thread of its own, for -l and -v.
+	#include "console_out.h"
+
+	// Several ports at once from a job file.
+	#include "batch.h"
 
 	// Application defines.
 	#define MY_VERSION "0.2"
@@ -39,9 +89,11 @@
 	// Platform specific defines and constants. 
 	// Change here for any platform differences and recompile.
 
-	#define DEFAULT_BAUD 115200 // The default 115200 baud rate to use.
+	#define DEFAULT_BAUD 115200 // The default 115200 baud rate to use, change with baud=.
 	// Unix baud rate options:
-	// 0,  50,  75,  110,  134,  150,  200, 300, 600, 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800
+	// 50,  75,  110,  134,  150,  200, 300, 600, 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 
+	// 460800, 500000, 576000, 921600, 1000000, 1152000, 1500000, 2000000, 2500000, 3000000, 3500000, 4000000
+	// Other rates work through termios2 on Linux, and directly on the BSDs, if the driver can divide down to them.
 
 	const FlowControl DEFAULT_FLOW_CONTROL = FC_NONE; // Set the specified flow control.
 	const ParityMode DEFAULT_PARITY_MODE = PM_NONE; // Parity mode
@@ -62,43 +114,84 @@
 		const std::string DEFAULT_TTY = "/dev/ttyUSB0"; // Default serial device to use. Can also be /dev/ttyS0 (COM1) or /dev/ttyS1 (COM2).	
 	#endif
 
-	const std::string FDUMP_CMD = "fdump"; // CFE command that performs flash memory dumps that outputs data to the terminal.
-	const std::string FDUMP_CMD_ARG_OFFSET = "-offset="; // Offset argument for FDUMP_CMD.
-	const std::string FDUMP_CMD_ARG_SIZE = "-size="; // Size argument for FDUMP_CMD.
 	const std::string HELP_CMD = "help"; // CFE help command. 
 	const std::string SHOW_DEVICES_CMD = "show devices"; // CFE Command to show all devices. 
-	const std::string WHITESPACE = " \n\r\t\f\v";
-	const std::string REGEX_SEQ_ID = "^([0-9a-fA-F]+)"; // Looks for the sequence id in the start of a line returned.
-	const std::string REGEX_HEX_DATA = "(\\b[0-9a-fA-F]{2}\\b)"; // Looks for the hex data within a line returned.
 	const std::string DEFAULT_DEV_NAME = "flash0.nvram"; // "flash0.boot" // for more see 'show devices'.
 	const std::string DEFAULT_FILE_EXT = ".out.bin";
+	const uint32_t DEFAULT_IDLE_TIMEOUT_MS = 2000; // Safety net for a lost status line or prompt, change with timeout=.
 
-	const uint8_t BYTES_PER_LINE = 16; // FDUMP_CMD usually returns 16 bytes of data at once. Likely may break if changed.
 	const char EXT_CTRL_C = '\x03'; // Ctrl-c is etx so send ASCII code 0x03 \x03.
+	const int EXIT_UNVERIFIED = 2; // The dump finished, but regions of it were only sampled and no verify= vouched for them.
 
 	// Application global variables:
 	// Singletons are bad!
 	bool parity = false; 		// Also check DEFAULT_PARITY_MODE
+	uint32_t baud_rate = DEFAULT_BAUD; // Line speed of the tty.
+	uint32_t autobaud_max = 0;	// Fastest rate to switch the console to for the dump, 0 is off.
+	std::string* baud_command = nullptr; // Console command that changes the rate, found with help if not given.
 	uint32_t stop_bits = 1; 	// Use only one stop bit.
 	uint32_t data_bits = 8; 	// How many bits per byte.
 	FlowControl flow_control = FC_NONE;
 	bool continue_cfe = true; 	// Disabled by POSIX sig handler.
+	bool read_twice = false;	// verify=twice, see flash_block.h.
+#ifdef POSIX
+	volatile sig_atomic_t caught_signal = 0; // Set by the sig handler, reported by report_signal().
+#endif
 
-	std::regex re_seqid(REGEX_SEQ_ID); // For tty data line parser.
-	std::regex re_data(REGEX_HEX_DATA);
-
-	std::ofstream _of_flash; // The output file stream.
+	image_file replay_image;	// The output image for replay.
 	std::string* of_name = nullptr; // The output file target.
 	bool output_to_file = true;
 
 	bool verbose = false;
 	bool very_verbose = false;
 	bool print_data = false; 
+	uint32_t print_rate = 0;	// Most -l lines a second with print_rate=, 0 for all of them.
+	console_out* console = nullptr; // With -l or -v the console is written by a thread of its own.
+	bool show_stats = false;	// Time the phases of the dump and print where the time went with --stats.
+	std::string* progress_name = nullptr; // File or fd:N for JSON progress events with progress=.
+	progress_log* progress = nullptr;
+
+	bool resume = false;		// Carry on from the first block missing from the journal instead of starting over.
+
+	uint32_t idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_MS; // Longest a command may go without sending anything.
+	uint32_t retries = BLOCK_RETRIES; // Rounds of narrow re-reads for lines lost or damaged in a block.
+	uint32_t pipeline_depth = 0;	// fdump commands typed ahead of the running one, 0 is lock step.
+	bool rx_thread = true;		// Drain the tty on a reader thread of its own during the dump.
+
+	bool replay_mode = false;	// Rebuild an image from a captured console log instead of the tty.
+	std::string* in_name = nullptr; // The captured console log to replay.
+	bool patch_mode = false;	// Rebuild an image from a reference and a delta instead of the tty.
+	std::string* ref_name = nullptr; // Reference image for ref=, what changed since is found.
+	std::string* delta_name = nullptr; // The regions read go here too with delta=.
+	uint32_t region_size = DIFF_REGION_SIZE; // Read whole if one of its samples differs.
+	uint32_t diff_samples = DIFF_SAMPLES; // Samples read from each region.
+	bool sampled = false;		// ref= only reads the regions a sample of differs in, unverified.
+	std::string* crc_command = nullptr; // CFE checksum command for ref=, found with help if not given.
+	bool unverified = false;	// Regions were only sampled, exit with EXIT_UNVERIFIED.
+	bool probe = false;			// Skip regions that look erased, by checksum or sampled like ref= sampled.
+	bool sparse = false;		// Leave runs of zeros out of of= as holes.
+	std::string* map_name = nullptr; // Erased map of the dump with map=.
+	std::string* compress_name = nullptr; // compress=, parsed into compress_type.
+	uint32_t compress_type = COMPRESS_NONE; // CompressType of of=, from compress= or its extension.
+	bool unpack_mode = false;	// Read part of a compressed image back out by its index instead of the tty.
+	uint32_t replay_threads = 0; // Replay parser threads, 0 is one per CPU.
+
+	std::string* batch_name = nullptr; // Job file for batch=, one dump per port.
+	std::string* hash_names = nullptr; // Digests to work out with hash=, parsed into digests.
+	std::string* manifest_name = nullptr; // File the digests are added to with manifest=.
+	std::string* verify_digest = nullptr; // Expected digest with verify=, name:hex.
+	uint32_t digests = 0;		// DigestType bits.
+	uint32_t verify_type = 0;
+	std::string verify_hex;
+	digest_set replay_digest;	// Of the image replay writes.
+	std::string* channel_names = nullptr; // More consoles into the same CFE for channels=, the dump is striped over them and tty=.
+	uint32_t stripe_size = 0;	// Run of bytes each channel reads in turn, 0 is bs=.
 
 	uint32_t offset;
 	std::string* device_name = nullptr;
 	std::string* tty_interface = nullptr;
 	uint32_t block_size;
+	bool block_size_auto = false;	// bs=auto, block_size is then the largest block.
 	uint32_t size_in_bytes;
 	uint32_t blocks_to_copy;
 
@@ -0,0 +1,196 @@
+// flash_block.cpp: Assembles one block of an fdump from its lines, and finds what is missing.
+//
+// A line is accepted when its address falls on a line boundary inside the block, it has
+// exactly the bytes that line should have, and verify_fdump_line() finds the hex tokens
+// and the ASCII column agree. Anything else is left as a gap, and so is a line that turns
+// up twice with different data, as one of the two must have had its address garbled.
+//
+// With verify=twice a line with a byte the ASCII column shows as '.' is kept but left
+// unconfirmed, a gap for the re-reads, until a second copy has the same bytes. A copy that
+// differs takes its place.
+
+#include <cstring>
+#include "flash_block.h"
+
+void block_init(flash_block** block, uint32_t capacity, bool twice)
+{
+	uint32_t lines = (capacity + BYTES_PER_LINE - 1) / BYTES_PER_LINE;
+
+	*block = new flash_block();
+	(*block)->data = new uint8_t[capacity];
+	(*block)->line_ok = new uint8_t[lines];
+	(*block)->line_unconfirmed = new uint8_t[lines];
+	(*block)->capacity = capacity;
+	(*block)->twice = twice;
+	(*block)->offset = 0;
+	(*block)->size = 0;
+	(*block)->lines = 0;
+	(*block)->lines_ok = 0;
+	(*block)->lines_unconfirmed = 0;
+	(*block)->lines_confirmed = 0;
+	(*block)->pending = 0;
+	(*block)->rounds = 0;
+	(*block)->gap_line = 0;
+	(*block)->first_seconds = 0;
+	(*block)->first_wire_bytes = 0;
+	(*block)->first_lines_ok = 0;
+	(*block)->first_lines_unconfirmed = 0;
+}
+
+void block_start(flash_block* block, uint64_t offset, uint32_t size)
+{
+	block->offset = offset;
+	block->size = (size < block->capacity) ? size : block->capacity;
+	block->lines = (block->size + BYTES_PER_LINE - 1) / BYTES_PER_LINE;
+	block->lines_ok = 0;
+	block->lines_unconfirmed = 0;
+	block->lines_confirmed = 0;
+	block->pending = 0;
+	block->rounds = 0;
+	block->gap_line = block->lines;
+	block->first_seconds = 0;
+	block->first_wire_bytes = 0;
+	block->first_lines_ok = 0;
+	block->first_lines_unconfirmed = 0;
+
+	memset(block->line_ok, 0, block->lines);
+	memset(block->line_unconfirmed, 0, block->lines);
+}
+
+bool block_contains(flash_block* block, uint64_t address)
+{
+	return address >= block->offset && address < block->offset + block->size;
+}
+
+uint32_t block_line_size(flash_block* block, uint32_t line)
+{
+	uint32_t start = line * BYTES_PER_LINE;
+	uint32_t left = block->size - start;
+
+	return (left < BYTES_PER_LINE) ? left : BYTES_PER_LINE;
+}
+
+// Takes a data line scanned by scan_fdump_line(), whose address is inside the block.
+bool block_add_line(flash_block* block, uint64_t address, const uint8_t* data, uint32_t byte_count,
+	const char* line, uint32_t line_len)
+{
+	// The address column is the flash offset of the line.
+	if((address - block->offset) % BYTES_PER_LINE != 0)
+	{
+		return false;
+	}
+
+	uint32_t index = (uint32_t)((address - block->offset) / BYTES_PER_LINE);
+	bool confirmed;
+
+	if(byte_count != block_line_size(block, index) || !verify_fdump_line(line, line_len, data, byte_count, &confirmed))
+	{
+		return false;
+	}
+
+	// Address, tokens and ASCII column agree, that is enough unless verify=twice.
+	confirmed = confirmed || !block->twice;
+
+	uint8_t* target = block->data + index * BYTES_PER_LINE;
+
+	if(block->line_ok[index])
+	{
+		if(memcmp(target, data, byte_count) != 0)
+		{
+			// Two copies that both check out but differ, one has a garbled address. Read it again.
+			block->line_ok[index] = 0;
+			block->lines_ok--;
+			return false;
+		}
+
+		return true;
+	}
+
+	if(block->line_unconfirmed[index] && memcmp(target, data, byte_count) == 0)
+	{
+		// Two copies that agree, a garbled byte would have had to come out the same twice.
+		confirmed = true;
+		block->lines_confirmed++;
+	}
+
+	memcpy(target, data, byte_count);
+
+	if(confirmed)
+	{
+		block->lines_unconfirmed -= block->line_unconfirmed[index];
+		block->line_unconfirmed[index] = 0;
+		block->line_ok[index] = 1;
+		block->lines_ok++;
+	}
+	else if(!block->line_unconfirmed[index])
+	{
+		block->line_unconfirmed[index] = 1;
+		block->lines_unconfirmed++;
+	}
+
+	return true;
+}
+
+bool block_complete(flash_block* block)
+{
+	return block->lines_ok == block->lines;
+}
+
+bool block_next_gap(flash_block* block, uint32_t* from_line, uint64_t* gap_offset, uint32_t* gap_size)
+{
+	uint32_t line = *from_line;
+
+	while(line < block->lines && block->line_ok[line])
+	{
+		line++;
+	}
+
+	if(line >= block->lines)
+	{
+		*from_line = line;
+		return false;
+	}
+
+	uint32_t first = line;
+
+	while(true)
+	{
+		while(line < block->lines && !block->line_ok[line])
+		{
+			line++;
+		}
+
+		// A few good lines before the next gap go along with it, rather than another command.
+		uint32_t next = line;
+
+		while(next < block->lines && block->line_ok[next] && next - line < BLOCK_GAP_JOIN)
+		{
+			next++;
+		}
+
+		if(next >= block->lines || block->line_ok[next])
+		{
+			break;
+		}
+
+		line = next;
+	}
+
+	*from_line = line;
+	*gap_offset = block->offset + (uint64_t)first * BYTES_PER_LINE;
+	*gap_size = (line == block->lines ? block->size : line * BYTES_PER_LINE) - first * BYTES_PER_LINE;
+
+	return true;
+}
+
+void block_free(flash_block* block)
+{
+	// Free allocated memory;
+	if(block != nullptr)
+	{
+		delete[] block->data;
+		delete[] block->line_ok;
+		delete[] block->line_unconfirmed;
+		delete block;
+	}
+}
@@ -0,0 +1,55 @@
+// flash_block.h: Assembles one block of an fdump from its lines, and finds what is missing.
+// Each data line is placed by its address column rather than by the order it arrives in,
+// so a dropped line leaves a gap instead of shifting everything after it, and lines of
+// several blocks can be in flight at once. Lines that don't check out are dropped too,
+// and the gaps are re-read with narrow fdump commands. With verify=twice so are lines with
+// bytes the ASCII column can't vouch for, until two copies agree.
+
+#ifndef FLASH_BLOCK_H
+#define FLASH_BLOCK_H
+
+#include <cstdint>
+
+#include "line_parser.h"
+
+const uint32_t BLOCK_RETRIES = 3; // Default rounds of re-reads for the gaps in a block, change with retries=.
+const uint32_t BLOCK_GAP_JOIN = 4; // Good lines between two gaps read again with them, about what another command costs.
+
+struct flash_block
+{
+	uint8_t* data;			// Block contents, capacity bytes.
+	uint8_t* line_ok;		// One flag per line, set once a good copy of the line is in data.
+	uint8_t* line_unconfirmed; // One flag per line, set while data has a copy waiting for a second one.
+	uint32_t capacity;		// Largest block, in bytes.
+	bool twice;				// verify=twice: a line with a byte shown as '.' waits for a second copy.
+	uint64_t offset;		// Flash offset of the first byte.
+	uint32_t size;			// Bytes in this block.
+	uint32_t lines;			// Lines in this block, the last one may be short.
+	uint32_t lines_ok;
+	uint32_t lines_unconfirmed;
+	uint32_t lines_confirmed; // Made good by a second copy.
+
+	// Re-reads.
+	uint32_t pending;		// Commands sent for this block that haven't finished.
+	uint32_t rounds;		// Re-read rounds started.
+	uint32_t gap_line;		// Where the round being sent has got to, lines when none is.
+
+	// The first read, for bs=auto.
+	uint64_t started_ns;	// When it was sent, for --stats.
+	double first_seconds;
+	uint64_t first_wire_bytes;
+	uint32_t first_lines_ok;
+	uint32_t first_lines_unconfirmed;
+};
+
+void block_init(flash_block** block, uint32_t capacity, bool twice);
+void block_start(flash_block* block, uint64_t offset, uint32_t size);
+bool block_contains(flash_block* block, uint64_t address);
+bool block_add_line(flash_block* block, uint64_t address, const uint8_t* data, uint32_t byte_count,
+	const char* line, uint32_t line_len);
+bool block_complete(flash_block* block);
+bool block_next_gap(flash_block* block, uint32_t* from_line, uint64_t* gap_offset, uint32_t* gap_size);
+uint32_t block_line_size(flash_block* block, uint32_t line);
+void block_free(flash_block* block);
+
+#endif
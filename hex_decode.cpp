@@ -0,0 +1,369 @@
+// hex_decode.cpp: Decoding kernels for the hex payload of one fdump line.
+//
+// Each kernel checks every character is [0-9a-fA-F], turns it into a nibble with
+// (c & 0x0F) + 9 for letters, and then merges nibble pairs into bytes. The SIMD
+// kernels do all 32 characters at once, so replaying multi-gigabyte console logs
+// is not held up one nibble at a time by hex_to_int().
+//
+// The spaced kernels check the separators as well and drop them on the way, the
+// AVX2 one with a shuffle, so lines don't have to be gathered into a buffer first.
+
+#include <cstring>
+#include "hex_decode.h"
+
+#ifdef HEX_DECODE_SSE2
+	#include <emmintrin.h>
+#endif
+#ifdef HEX_DECODE_AVX2
+	#include <immintrin.h>
+#endif
+
+// Nibble value of every character, or -1 if it's not a hex digit.
+struct hex_table
+{
+	int8_t value[256];
+
+	constexpr hex_table() : value()
+	{
+		for(int i = 0; i < 256; i++)
+		{
+			value[i] = -1;
+		}
+		for(int i = 0; i < 10; i++)
+		{
+			value['0' + i] = (int8_t)i;
+		}
+		for(int i = 0; i < 6; i++)
+		{
+			value['a' + i] = (int8_t)(10 + i);
+			value['A' + i] = (int8_t)(10 + i);
+		}
+	}
+};
+
+static constexpr hex_table HEX_TABLE;
+
+static inline void hex_decode_printable_scalar(const uint8_t* bytes, char* printable)
+{
+	for(uint32_t i = 0; i < HEX_DECODE_BYTES; i++)
+	{
+		uint8_t byte = bytes[i];
+		printable[i] = (byte > 31 && byte < 127) ? (char)byte : ' ';
+	}
+}
+
+bool hex_decode_scalar(const char* src, uint8_t* target, char* printable)
+{
+	// OR all the nibbles together so there is only one branch for validation.
+	int8_t invalid = 0;
+
+	for(uint32_t i = 0; i < HEX_DECODE_BYTES; i++)
+	{
+		int8_t hi = HEX_TABLE.value[(uint8_t)src[i * 2]];
+		int8_t lo = HEX_TABLE.value[(uint8_t)src[i * 2 + 1]];
+
+		invalid |= hi | lo;
+		target[i] = (uint8_t)((hi << 4) | (lo & 0x0F));
+	}
+
+	if(invalid < 0)
+	{
+		return false;
+	}
+
+	if(printable != nullptr)
+	{
+		hex_decode_printable_scalar(target, printable);
+	}
+
+	return true;
+}
+
+bool hex_decode_spaced_scalar(const char* src, uint8_t* target, char* printable)
+{
+	int8_t invalid = 0;
+	bool spaced = true;
+
+	for(uint32_t i = 0; i < HEX_DECODE_BYTES; i++)
+	{
+		int8_t hi = HEX_TABLE.value[(uint8_t)src[i * 3]];
+		int8_t lo = HEX_TABLE.value[(uint8_t)src[i * 3 + 1]];
+
+		invalid |= hi | lo;
+		spaced &= (src[i * 3 + 2] == ' ');
+		target[i] = (uint8_t)((hi << 4) | (lo & 0x0F));
+	}
+
+	if(invalid < 0 || !spaced)
+	{
+		return false;
+	}
+
+	if(printable != nullptr)
+	{
+		hex_decode_printable_scalar(target, printable);
+	}
+
+	return true;
+}
+
+#ifdef HEX_DECODE_SSE2
+	// Replace anything that isn't printable ASCII (32 to 126) with a space.
+	static inline void hex_decode_printable_sse2(__m128i bytes, char* printable)
+	{
+		// Signed compares, so bytes >= 128 are negative and fail the first test.
+		__m128i mask = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(31)),
+			_mm_cmpgt_epi8(_mm_set1_epi8(127), bytes));
+		__m128i view = _mm_or_si128(_mm_and_si128(mask, bytes), _mm_andnot_si128(mask, _mm_set1_epi8(' ')));
+
+		_mm_storeu_si128((__m128i*)printable, view);
+	}
+
+	// Validate 16 hex characters and turn them into nibbles, returns false if any is invalid.
+	static inline bool hex_decode_nibbles_sse2(__m128i c, __m128i* nibbles)
+	{
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+		__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+		__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+
+		if(_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+		{
+			return false;
+		}
+
+		*nibbles = _mm_add_epi8(_mm_and_si128(c, _mm_set1_epi8(0x0F)), _mm_and_si128(alpha, _mm_set1_epi8(9)));
+
+		return true;
+	}
+
+	// Each 16 bit lane holds (high nibble, low nibble), merge them into one byte in the low half.
+	static inline __m128i hex_decode_merge_sse2(__m128i nibbles)
+	{
+		__m128i merged = _mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8));
+		return _mm_and_si128(merged, _mm_set1_epi16(0x00FF));
+	}
+
+	bool hex_decode_sse2(const char* src, uint8_t* target, char* printable)
+	{
+		__m128i first;
+		__m128i second;
+
+		if(!hex_decode_nibbles_sse2(_mm_loadu_si128((const __m128i*)src), &first)
+			|| !hex_decode_nibbles_sse2(_mm_loadu_si128((const __m128i*)(src + 16)), &second))
+		{
+			return false;
+		}
+
+		__m128i bytes = _mm_packus_epi16(hex_decode_merge_sse2(first), hex_decode_merge_sse2(second));
+
+		_mm_storeu_si128((__m128i*)target, bytes);
+
+		if(printable != nullptr)
+		{
+			hex_decode_printable_sse2(bytes, printable);
+		}
+
+		return true;
+	}
+
+	// Bits of the separators in each 16 character third of a spaced line, at 2, 5, ... 47.
+	static const int HEX_SPACED_MASK[3] = { 0x4924, 0x2492, 0x9249 };
+
+	// Validate one third of a spaced line and turn its hex characters into nibbles.
+	static inline bool hex_decode_spaced_nibbles_sse2(const char* src, int spaces, uint8_t* nibbles)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)src);
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+		__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+		__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+		int hex = _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+		int space = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')));
+
+		if((hex | spaces) != 0xFFFF || (space & spaces) != spaces)
+		{
+			return false;
+		}
+
+		_mm_storeu_si128((__m128i*)nibbles, _mm_add_epi8(_mm_and_si128(c, _mm_set1_epi8(0x0F)),
+			_mm_and_si128(alpha, _mm_set1_epi8(9))));
+
+		return true;
+	}
+
+	// Without SSSE3 there is no byte shuffle, so the nibbles are paired up one byte at a time.
+	bool hex_decode_spaced_sse2(const char* src, uint8_t* target, char* printable)
+	{
+		uint8_t nibbles[HEX_SPACED_CHARS];
+
+		for(uint32_t i = 0; i < 3; i++)
+		{
+			if(!hex_decode_spaced_nibbles_sse2(src + i * 16, HEX_SPACED_MASK[i], nibbles + i * 16))
+			{
+				return false;
+			}
+		}
+
+		for(uint32_t i = 0; i < HEX_DECODE_BYTES; i++)
+		{
+			target[i] = (uint8_t)((nibbles[i * 3] << 4) | nibbles[i * 3 + 1]);
+		}
+
+		if(printable != nullptr)
+		{
+			hex_decode_printable_sse2(_mm_loadu_si128((const __m128i*)target), printable);
+		}
+
+		return true;
+	}
+#endif
+
+#ifdef HEX_DECODE_AVX2
+	// Decode 32 hex characters already in a register.
+	__attribute__((target("avx2")))
+	static inline bool hex_decode_chars_avx2(__m256i c, uint8_t* target, char* printable)
+	{
+		__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+		__m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+		__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+
+		if(_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1)
+		{
+			return false;
+		}
+
+		__m256i nibbles = _mm256_add_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x0F)),
+			_mm256_and_si256(alpha, _mm256_set1_epi8(9)));
+		__m256i merged = _mm256_or_si256(_mm256_slli_epi16(nibbles, 4), _mm256_srli_epi16(nibbles, 8));
+		merged = _mm256_and_si256(merged, _mm256_set1_epi16(0x00FF));
+
+		// Pack the two 128 bit halves into 16 bytes.
+		__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(merged), _mm256_extracti128_si256(merged, 1));
+
+		_mm_storeu_si128((__m128i*)target, bytes);
+
+		if(printable != nullptr)
+		{
+			__m128i mask = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(31)),
+				_mm_cmpgt_epi8(_mm_set1_epi8(127), bytes));
+			__m128i view = _mm_or_si128(_mm_and_si128(mask, bytes), _mm_andnot_si128(mask, _mm_set1_epi8(' ')));
+
+			_mm_storeu_si128((__m128i*)printable, view);
+		}
+
+		return true;
+	}
+
+	__attribute__((target("avx2")))
+	bool hex_decode_avx2(const char* src, uint8_t* target, char* printable)
+	{
+		// All 32 characters in one register.
+		return hex_decode_chars_avx2(_mm256_loadu_si256((const __m256i*)src), target, printable);
+	}
+
+	__attribute__((target("avx2")))
+	bool hex_decode_spaced_avx2(const char* src, uint8_t* target, char* printable)
+	{
+		__m128i first = _mm_loadu_si128((const __m128i*)src);
+		__m128i second = _mm_loadu_si128((const __m128i*)(src + 16));
+		__m128i third = _mm_loadu_si128((const __m128i*)(src + 32));
+		__m128i space = _mm_set1_epi8(' ');
+
+		if((_mm_movemask_epi8(_mm_cmpeq_epi8(first, space)) & HEX_SPACED_MASK[0]) != HEX_SPACED_MASK[0]
+			|| (_mm_movemask_epi8(_mm_cmpeq_epi8(second, space)) & HEX_SPACED_MASK[1]) != HEX_SPACED_MASK[1]
+			|| (_mm_movemask_epi8(_mm_cmpeq_epi8(third, space)) & HEX_SPACED_MASK[2]) != HEX_SPACED_MASK[2])
+		{
+			return false;
+		}
+
+		// Hex character j is at 3 * (j / 2) + j % 2. The first 16 come from characters 0 to 22,
+		// the others from 24 to 46, each spread over two loads; -1 leaves a byte zero for the OR.
+		const __m128i low_first = _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, 12, 13, 15, -1, -1, -1, -1, -1);
+		const __m128i low_second = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 2, 3, 5, 6);
+		const __m128i high_second = _mm_setr_epi8(8, 9, 11, 12, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		const __m128i high_third = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 1, 2, 4, 5, 7, 8, 10, 11, 13, 14);
+
+		__m128i low = _mm_or_si128(_mm_shuffle_epi8(first, low_first), _mm_shuffle_epi8(second, low_second));
+		__m128i high = _mm_or_si128(_mm_shuffle_epi8(second, high_second), _mm_shuffle_epi8(third, high_third));
+
+		return hex_decode_chars_avx2(_mm256_setr_m128i(low, high), target, printable);
+	}
+#endif
+
+struct hex_kernel
+{
+	const char* name;
+	HexDecodeFn fn;
+	HexDecodeFn spaced;
+	bool (*supported)();
+};
+
+static bool cpu_always() { return true; }
+
+#ifdef HEX_DECODE_AVX2
+	static bool cpu_has_avx2()
+	{
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+
+// Fastest first.
+static const hex_kernel HEX_KERNELS[] =
+{
+#ifdef HEX_DECODE_AVX2
+	{ "avx2", hex_decode_avx2, hex_decode_spaced_avx2, cpu_has_avx2 },
+#endif
+#ifdef HEX_DECODE_SSE2
+	{ "sse2", hex_decode_sse2, hex_decode_spaced_sse2, cpu_always },
+#endif
+	{ "scalar", hex_decode_scalar, hex_decode_spaced_scalar, cpu_always }
+};
+
+static const hex_kernel* hex_decode_select()
+{
+	for(const hex_kernel& kernel : HEX_KERNELS)
+	{
+		if(kernel.supported())
+		{
+			return &kernel;
+		}
+	}
+	return nullptr; // Unreachable, scalar is always supported.
+}
+
+static const hex_kernel* hex_decode_selected = hex_decode_select();
+
+bool hex_decode_line(const char* src, uint8_t* target, char* printable)
+{
+	return hex_decode_selected->fn(src, target, printable);
+}
+
+bool hex_decode_spaced(const char* src, uint8_t* target, char* printable)
+{
+	return hex_decode_selected->spaced(src, target, printable);
+}
+
+const char* hex_decode_kernel_name()
+{
+	return hex_decode_selected->name;
+}
+
+bool hex_decode_set_kernel(const char* name)
+{
+	// Used by the benchmark to compare kernels, and to force the scalar fallback.
+	for(const hex_kernel& kernel : HEX_KERNELS)
+	{
+		if(strcmp(kernel.name, name) == 0 && kernel.supported())
+		{
+			hex_decode_selected = &kernel;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,48 @@
+// hex_decode.h: Decoding kernels for the hex payload of one fdump line.
+// Validates and decodes 32 hex characters into 16 bytes, and optionally
+// writes the printable ASCII view used by -l in the same pass.
+// The best kernel for the CPU (AVX2, SSE2 or scalar) is selected at runtime.
+
+#ifndef HEX_DECODE_H
+#define HEX_DECODE_H
+
+#include <cstdint>
+
+const uint32_t HEX_DECODE_BYTES = 16; // Bytes decoded per call, the same as BYTES_PER_LINE.
+const uint32_t HEX_DECODE_CHARS = HEX_DECODE_BYTES * 2; // Hex characters consumed per call.
+const uint32_t HEX_SPACED_CHARS = HEX_DECODE_BYTES * 3; // Characters consumed by the spaced kernels, "xx " per byte.
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define HEX_DECODE_SSE2 // SSE2 is part of the x86-64 baseline.
+	#if defined(__GNUC__)
+		#define HEX_DECODE_AVX2 // Needs target attributes and __builtin_cpu_supports().
+	#endif
+#endif
+
+// Decode HEX_DECODE_CHARS characters at src into HEX_DECODE_BYTES bytes at target.
+// If printable is not null it receives HEX_DECODE_BYTES characters (not zero terminated),
+// with anything that isn't printable ASCII replaced by a space.
+// Returns false if any character is not a hex digit, target and printable are undefined then.
+typedef bool(*HexDecodeFn)(const char* src, uint8_t* target, char* printable);
+
+// The spaced kernels take the tokens as CFE prints them, each pair followed by one space,
+// HEX_SPACED_CHARS characters in all, so the scanner can decode straight from the line.
+// They also return false if a separator isn't a space.
+
+bool hex_decode_line(const char* src, uint8_t* target, char* printable);
+bool hex_decode_spaced(const char* src, uint8_t* target, char* printable);
+const char* hex_decode_kernel_name();
+bool hex_decode_set_kernel(const char* name);
+
+bool hex_decode_scalar(const char* src, uint8_t* target, char* printable);
+bool hex_decode_spaced_scalar(const char* src, uint8_t* target, char* printable);
+#ifdef HEX_DECODE_SSE2
+bool hex_decode_sse2(const char* src, uint8_t* target, char* printable);
+bool hex_decode_spaced_sse2(const char* src, uint8_t* target, char* printable);
+#endif
+#ifdef HEX_DECODE_AVX2
+bool hex_decode_avx2(const char* src, uint8_t* target, char* printable);
+bool hex_decode_spaced_avx2(const char* src, uint8_t* target, char* printable);
+#endif
+
+#endif
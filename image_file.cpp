@@ -0,0 +1,271 @@
+// image_file.cpp: The output image, written with pwrite() at each block's offset.
+//
+// Nothing is buffered here, a block is in the file (the page cache) as soon as image_write()
+// returns, so it can be journaled right after. Without POSIX a seeking fstream does the same.
+// A compressed image hands its blocks to the compress thread instead.
+
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+
+#ifdef POSIX
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+#endif
+
+#include "image_file.h"
+
+void image_init(image_file* image)
+{
+#ifdef POSIX
+	image->fd = -1;
+#endif
+	image->compressor = nullptr;
+	image->writes = 0;
+	image->bytes_written = 0;
+}
+
+// Opens or creates the image, emptied unless keep. size is the whole dump, 0 if not known.
+bool image_open(image_file* image, const std::string& name, uint64_t size, bool keep)
+{
+	image->name = name;
+	image->writes = 0;
+	image->bytes_written = 0;
+
+#ifdef POSIX
+	image->fd = open(name.c_str(), O_WRONLY | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+
+	if(image->fd < 0)
+	{
+		return false;
+	}
+
+#ifdef LINUX
+	// Reserve the blocks for the dump without changing the file length, so a dump that stops
+	// early still leaves a file as long as what was read. Not every filesystem can do it.
+	if(size > 0 && fallocate(image->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) != 0 && errno == ENOSPC)
+	{
+		close(image->fd);
+		image->fd = -1;
+		errno = ENOSPC;
+
+		return false;
+	}
+#else
+	(void)size;
+#endif
+
+	return true;
+#else
+	(void)size;
+
+	std::ios::openmode mode = std::ios::out | std::ios::binary;
+
+	if(keep)
+	{
+		// in keeps what is there, but only opens a file that exists.
+		image->stream.open(name.c_str(), mode | std::ios::app);
+		image->stream.close();
+		mode |= std::ios::in;
+	}
+
+	image->stream.open(name.c_str(), mode);
+
+	return !image->stream.fail();
+#endif
+}
+
+// Creates a compressed image, see compress.h.
+bool image_open_compressed(image_file* image, const std::string& name, uint32_t type)
+{
+	image->name = name;
+	image->writes = 0;
+	image->bytes_written = 0;
+
+	return compress_open(&image->compressor, name, type);
+}
+
+bool image_is_open(image_file* image)
+{
+	if(image->compressor != nullptr)
+	{
+		return true;
+	}
+
+#ifdef POSIX
+	return image->fd >= 0;
+#else
+	return image->stream.is_open();
+#endif
+}
+
+// Writes len bytes at position in the image, all of them or fails.
+bool image_write(image_file* image, uint64_t position, const void* data, uint64_t len)
+{
+	image->writes++;
+
+	if(image->compressor != nullptr)
+	{
+		return compress_write(image->compressor, position, data, len);
+	}
+
+#ifdef POSIX
+	const char* next = (const char*)data;
+
+	while(len > 0)
+	{
+		ssize_t written = pwrite(image->fd, next, (size_t)len, (off_t)position);
+
+		if(written < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		next += written;
+		position += (uint64_t)written;
+		len -= (uint64_t)written;
+		image->bytes_written += (uint64_t)written;
+	}
+
+	return true;
+#else
+	image->stream.seekp((std::streamoff)position);
+	image->stream.write((const char*)data, (std::streamsize)len);
+
+	if(image->stream.fail())
+	{
+		return false;
+	}
+
+	image->bytes_written += len;
+
+	return true;
+#endif
+}
+
+// Makes len bytes at position zero without writing them where the filesystem can: past the
+// end of the file by making it longer, inside it by punching a hole on Linux.
+static bool image_zero(image_file* image, uint64_t position, uint64_t len)
+{
+#ifdef POSIX
+	struct stat info;
+
+	if(fstat(image->fd, &info) != 0)
+	{
+		return false;
+	}
+
+	uint64_t length = (uint64_t)info.st_size;
+
+	if(position >= length)
+	{
+		return ftruncate(image->fd, (off_t)(position + len)) == 0;
+	}
+
+#ifdef LINUX
+	if(fallocate(image->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)position, (off_t)len) == 0)
+	{
+		return (position + len <= length) || ftruncate(image->fd, (off_t)(position + len)) == 0;
+	}
+#endif
+#endif
+
+	// Written out, the filesystem can't leave a hole there.
+	std::vector<uint8_t> zeros(IMAGE_HOLE_SIZE, 0);
+
+	for(uint64_t done = 0; done < len; done += IMAGE_HOLE_SIZE)
+	{
+		if(!image_write(image, position + done, zeros.data(), std::min<uint64_t>(len - done, IMAGE_HOLE_SIZE)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Like image_write(), but whole IMAGE_HOLE_SIZE runs of zeros, on the file's own block
+// boundaries, are left as holes.
+bool image_write_sparse(image_file* image, uint64_t position, const void* data, uint64_t len)
+{
+	if(image->compressor != nullptr)
+	{
+		// Zeros compress to next to nothing anyway.
+		return image_write(image, position, data, len);
+	}
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t start = position;
+	uint64_t end = position + len;
+	uint64_t run_start = position;	// Of the data or zeros being gathered.
+	bool run_zero = false;
+
+	while(position < end)
+	{
+		uint64_t next = std::min(end, (position / IMAGE_HOLE_SIZE + 1) * IMAGE_HOLE_SIZE);
+		bool zero = (next - position == IMAGE_HOLE_SIZE);
+
+		for(uint64_t i = position; zero && i < next; i++)
+		{
+			zero = (bytes[i - start] == 0);
+		}
+
+		if(zero != run_zero && position > run_start)
+		{
+			bool ok = run_zero ? image_zero(image, run_start, position - run_start)
+				: image_write(image, run_start, bytes + (run_start - start), position - run_start);
+
+			if(!ok)
+			{
+				return false;
+			}
+
+			run_start = position;
+		}
+
+		run_zero = zero;
+		position = next;
+	}
+
+	return run_zero ? image_zero(image, run_start, end - run_start)
+		: image_write(image, run_start, bytes + (run_start - start), end - run_start);
+}
+
+// Returns false if the last writes couldn't be put in the file.
+bool image_close(image_file* image)
+{
+	if(image->compressor != nullptr)
+	{
+		bool ok = compress_close(image->compressor, &image->bytes_written);
+		image->compressor = nullptr;
+
+		return ok;
+	}
+
+#ifdef POSIX
+	if(image->fd < 0)
+	{
+		return true;
+	}
+
+	bool ok = (close(image->fd) == 0);
+	image->fd = -1;
+
+	return ok;
+#else
+	if(!image->stream.is_open())
+	{
+		return true;
+	}
+
+	image->stream.close();
+
+	return !image->stream.fail();
+#endif
+}
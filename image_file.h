@@ -0,0 +1,38 @@
+// image_file.h: The output image, written a whole block at a time at the block's own place
+// in the file, so blocks can come in any order (resume, stripes, re-reads). The space for the
+// dump is reserved up front where the filesystem can do it, or zeros are left out as holes.
+// A compressed image (compress.h) only takes blocks in order.
+
+#ifndef IMAGE_FILE_H
+#define IMAGE_FILE_H
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#include "compress.h"
+
+const uint32_t IMAGE_HOLE_SIZE = 4096; // With sparse writes, zeros are left as holes in whole runs of this, a filesystem block.
+
+struct image_file
+{
+#ifdef POSIX
+	int fd;					// -1 when not open.
+#else
+	std::fstream stream;
+#endif
+	std::string name;
+	compress_writer* compressor; // nullptr for a plain image.
+	uint64_t writes;
+	uint64_t bytes_written;		// To the file, compressed if it is.
+};
+
+void image_init(image_file* image);
+bool image_open(image_file* image, const std::string& name, uint64_t size, bool keep);
+bool image_open_compressed(image_file* image, const std::string& name, uint32_t type);
+bool image_is_open(image_file* image);
+bool image_write(image_file* image, uint64_t position, const void* data, uint64_t len);
+bool image_write_sparse(image_file* image, uint64_t position, const void* data, uint64_t len);
+bool image_close(image_file* image);
+
+#endif
@@ -0,0 +1,211 @@
+// journal.cpp: Progress journal kept next to the output image, so a dump can be resumed.
+//
+// The journal is plain text, one line per block, appended and flushed as soon as the
+// block is in the image, so it survives ctrl-c, a USB adapter going away or the router
+// rebooting. A block is only journaled once it was received in full, which means a
+// resume restarts exactly where the last complete block ended.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cinttypes>
+
+#include "journal.h"
+
+// Table for the reflected CRC-32 polynomial (0xEDB88320) used by zip, gzip and crc32(1).
+struct crc32_table
+{
+	uint32_t value[256];
+
+	constexpr crc32_table() : value()
+	{
+		for(uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+
+			for(int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+			}
+
+			value[i] = crc;
+		}
+	}
+};
+
+static constexpr crc32_table CRC32_TABLE;
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len)
+{
+	crc = ~crc;
+
+	for(size_t i = 0; i < len; i++)
+	{
+		crc = CRC32_TABLE.value[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+static std::string journal_header(const std::string& settings)
+{
+	return JOURNAL_MAGIC + " " + settings;
+}
+
+static bool journal_write_line(dump_journal* journal, const char* line)
+{
+	if(fputs(line, journal->file) < 0 || fputc('\n', journal->file) == EOF || fflush(journal->file) != 0)
+	{
+		std::cout << "Writing journal " << journal->name << " failed." << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool journal_open(dump_journal* journal, const std::string& journal_name)
+{
+	journal->name = journal_name;
+	journal->file = fopen(journal->name.c_str(), "w");
+	journal->crc = 0;
+	journal->block_bytes = 0;
+	journal->blocks = 0;
+	journal->bytes = 0;
+
+	if(journal->file == nullptr)
+	{
+		std::cout << "Opening journal " << journal->name << " failed." << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool journal_create(dump_journal* journal, const std::string& journal_name, const std::string& settings)
+{
+	return journal_open(journal, journal_name) && journal_write_line(journal, journal_header(settings).c_str());
+}
+
+// image_position maps journaled positions into the image, nullptr if they are the same.
+bool journal_resume(dump_journal* journal, const std::string& journal_name, const std::string& image_name, 
+	const std::string& settings, uint64_t* bytes_done, JournalImagePositionFn image_position, const void* context)
+{
+	std::ifstream old_journal(journal_name);
+	std::ifstream image(image_name, std::ios::in | std::ios::binary);
+	std::vector<std::string> kept;
+	std::string line;
+
+	uint32_t blocks_done = 0;
+
+	*bytes_done = 0;
+
+	if(!old_journal.is_open())
+	{
+		std::cout << "No journal " << journal_name << " to resume from, starting at the first block." << std::endl;
+		return journal_create(journal, journal_name, settings);
+	}
+
+	if(!std::getline(old_journal, line) || line != journal_header(settings))
+	{
+		// Resuming with other settings would stitch two different dumps together.
+		std::cout << "Journal " << journal_name << " is for a different dump:" << std::endl
+			<< "  " << line << std::endl
+			<< "Use the same if=, offset=, bs= and size= to resume, or leave out resume to start over." << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> block;
+
+	// Keep the journaled blocks as long as they run on from each other and still match the image.
+	while(std::getline(old_journal, line))
+	{
+		char tag[16];
+		uint64_t position;
+		uint32_t length;
+		uint32_t crc;
+
+		if(sscanf(line.c_str(), "%15s %" SCNu64 " %" SCNu32 " %" SCNx32, tag, &position, &length, &crc) != 4
+			|| tag != JOURNAL_BLOCK
+			|| position != *bytes_done
+			|| length == 0)
+		{
+			break;
+		}
+
+		block.resize(length);
+		image.seekg((std::streamoff)(image_position != nullptr ? image_position(context, position) : position));
+		image.read((char*)block.data(), length);
+
+		if(!image || crc32_update(0, block.data(), length) != crc)
+		{
+			break;
+		}
+
+		kept.push_back(line);
+		*bytes_done += length;
+		blocks_done++;
+	}
+
+	old_journal.close();
+
+	// Rewrite the journal with only the blocks that checked out.
+	if(!journal_create(journal, journal_name, settings))
+	{
+		return false;
+	}
+
+	for(const std::string& record : kept)
+	{
+		if(!journal_write_line(journal, record.c_str()))
+		{
+			return false;
+		}
+	}
+
+	journal->blocks = blocks_done;
+	journal->bytes = *bytes_done;
+
+	return true;
+}
+
+void journal_block_start(dump_journal* journal)
+{
+	journal->crc = 0;
+	journal->block_bytes = 0;
+}
+
+void journal_update(dump_journal* journal, const uint8_t* data, uint32_t len)
+{
+	journal->crc = crc32_update(journal->crc, data, len);
+	journal->block_bytes += len;
+}
+
+bool journal_block_done(dump_journal* journal, uint64_t position)
+{
+	char record[96];
+
+	snprintf(record, sizeof(record), "%s %" PRIu64 " %" PRIu64 " %08" PRIx32,
+		JOURNAL_BLOCK.c_str(), position, journal->block_bytes, journal->crc);
+
+	journal->blocks++;
+	journal->bytes += journal->block_bytes;
+
+	return journal_write_line(journal, record);
+}
+
+void journal_close(dump_journal* journal, bool complete)
+{
+	if(journal->file == nullptr)
+	{
+		return;
+	}
+
+	fclose(journal->file);
+	journal->file = nullptr;
+
+	// A finished image doesn't need resuming.
+	if(complete)
+	{
+		remove(journal->name.c_str());
+	}
+}
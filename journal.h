@@ -0,0 +1,40 @@
+// journal.h: Progress journal kept next to the output image, so a dump can be resumed.
+// Every block that was received in full and written out gets a line with its position,
+// length and CRC-32. With resume the journaled blocks are checked against the image
+// and the dump carries on from the first one that is missing or doesn't match.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+const std::string JOURNAL_EXT = ".journal"; // Journal of out.bin is out.bin.journal, of its second stripe out.bin.stripe1.journal.
+const std::string JOURNAL_MAGIC = "fdump-journal 1"; // First line, followed by the dump settings.
+const std::string JOURNAL_BLOCK = "block"; // Record of one written block: block <position> <length> <crc32>
+
+struct dump_journal
+{
+	FILE* file;
+	std::string name;
+	uint32_t crc;			// CRC-32 of the block being written so far.
+	uint64_t block_bytes;	// Bytes of the block being written so far.
+	uint32_t blocks;		// Blocks recorded, including those kept from a resumed journal.
+	uint64_t bytes;			// Their total length, blocks can differ in size with bs=auto.
+};
+
+// Where a journaled position is in the image, for journals of a stripe of it.
+typedef uint64_t(*JournalImagePositionFn)(const void* context, uint64_t position);
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len);
+
+bool journal_create(dump_journal* journal, const std::string& journal_name, const std::string& settings);
+bool journal_resume(dump_journal* journal, const std::string& journal_name, const std::string& image_name, 
+	const std::string& settings, uint64_t* bytes_done, JournalImagePositionFn image_position, const void* context);
+void journal_block_start(dump_journal* journal);
+void journal_update(dump_journal* journal, const uint8_t* data, uint32_t len);
+bool journal_block_done(dump_journal* journal, uint64_t position);
+void journal_close(dump_journal* journal, bool complete);
+
+#endif
@@ -0,0 +1,407 @@
+// line_parser.cpp: Parser for the console lines CFE prints in response to fdump.
+//
+// Trim functions for std::string copied from:
+// [1] https://www.techiedelight.com/trim-string-cpp-remove-leading-trailing-spaces/
+//
+// Hex character conversion from stack overflow.
+// [1] https://stackoverflow.com/questions/17261798/converting-a-hex-string-to-a-byte-array
+
+#include <stdexcept>
+#include <cassert>
+#include <cstddef>
+#include <chrono>
+#include "line_parser.h"
+#include "hex_decode.h"
+
+std::string ltrim(const std::string& s)
+{
+	size_t start = s.find_first_not_of(WHITESPACE);
+	return (start == std::string::npos) ? "" : s.substr(start);
+}
+
+std::string rtrim(const std::string& s)
+{
+	size_t end = s.find_last_not_of(WHITESPACE);
+	return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+}
+
+std::string trim(const std::string& s)
+{
+	return rtrim(ltrim(s));
+}
+
+bool starts_with(std::string source, std::string compare)
+{
+	return source.rfind(compare, 0) == 0;
+}
+
+int hex_to_int(char input)
+{
+	if(input >= '0' && input <= '9')
+	{
+		return input - '0';
+	}
+	else if(input >= 'a' && input <= 'f')
+	{
+		return input - 'a' + 10;
+	}
+	else if(input >= 'A' && input <= 'F')
+	{
+		return input - 'A' + 10;
+	}
+	throw std::invalid_argument("Invalid input string");
+}
+
+// This function assumes src to be a zero terminated sanitized string with
+// an even number of [0-9a-f] characters, and target to be sufficiently large
+void hex_to_buffer(const char* src, char* target)
+{
+	// Convert hex data to a byte buffer.
+	while(*src && src[1])
+	{
+		*(target++) = hex_to_int(*src)*16 + hex_to_int(src[1]);
+		src += 2;
+	}
+}
+
+bool is_printable_ascii_char(char c)
+{
+	return (c > 31) && (c < 127);
+}
+
+void hexbuffer_to_friendlystring(const char* src, char* target)
+{
+	// Convert hex data to printable c-string.
+	while(*src && src[1])
+	{
+		char byte = hex_to_int(*src)*16 + hex_to_int(src[1]);
+
+		if(!is_printable_ascii_char(byte))
+		{
+			byte = ' ';
+		}
+
+		*(target++) = byte;
+		src += 2;
+	}
+}
+
+void buffer_to_hex(const uint8_t* src, uint32_t len, char* target)
+{
+	// Convert a byte buffer to a zero terminated hex c-string, target needs len*2+1 characters.
+	static const char digits[] = "0123456789abcdef";
+
+	for(uint32_t i = 0; i < len; i++)
+	{
+		*(target++) = digits[src[i] >> 4];
+		*(target++) = digits[src[i] & 0x0F];
+	}
+	*target = '\0';
+}
+
+// Format one line of data the way -l prints it: decimal position, hex bytes, printable view.
+// If printable is null the view is made from data. Returns the length written, target needs FORMATTED_LINE_MAX characters.
+uint32_t format_data_line(char* target, uint64_t position, const uint8_t* data, uint32_t len, const char* printable)
+{
+	char* c = target;
+
+	if(len > BYTES_PER_LINE)
+	{
+		len = BYTES_PER_LINE;
+	}
+
+	// Position in decimal, 10 digits wide.
+	char digits[20];
+	uint32_t count = 0;
+
+	do
+	{
+		digits[count++] = (char)('0' + position % 10);
+		position /= 10;
+	} while(position > 0);
+
+	for(uint32_t i = count; i < 10; i++)
+	{
+		*(c++) = '0';
+	}
+	while(count > 0)
+	{
+		*(c++) = digits[--count];
+	}
+
+	*(c++) = ' ';
+	buffer_to_hex(data, len, c);
+	c += len * 2;
+	*(c++) = ' ';
+
+	for(uint32_t i = 0; i < len; i++)
+	{
+		char byte = (printable != nullptr) ? printable[i] : (char)data[i];
+		*(c++) = is_printable_ascii_char(byte) ? byte : ' ';
+	}
+	*c = '\0';
+
+	return (uint32_t)(c - target);
+}
+
+// Same as hex_to_int() but returns -1 instead of throwing, the scanner sees plenty of non hex characters.
+static inline int hex_value(char c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Letters, digits and underscore, the same characters a regex \b treats as part of a word.
+static inline bool is_word_char(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_whitespace(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+static inline uint64_t scan_clock_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline bool has_prefix(const char* s, uint32_t len, const std::string& prefix)
+{
+	return len >= prefix.length() && prefix.compare(0, prefix.length(), s, prefix.length()) == 0;
+}
+
+// Single pass scanner for one line of fdump output, no allocations.
+// Data lines start with the address column (returned in address), every following
+// token of exactly two hex digits is a data byte and is decoded straight into target,
+// up to max_bytes. Anything after that, e.g. the ASCII column, is ignored.
+// If printable is not null it gets the zero terminated printable view of the bytes for -l.
+// If decode_ns is not null the hex kernel is timed and added to it, for --stats.
+LineKind scan_fdump_line(const char* line, uint32_t line_len, uint8_t* target, uint32_t max_bytes,
+	uint32_t* byte_count, uint32_t* address, char* printable, uint64_t* decode_ns)
+{
+	const char* p = line;
+	const char* end = line + line_len;
+
+	assert(max_bytes <= BYTES_PER_LINE);
+
+	*byte_count = 0;
+
+	// Trim just in case.
+	while(p < end && is_whitespace(*p)) p++;
+	while(end > p && is_whitespace(end[-1])) end--;
+
+	uint32_t len = (uint32_t)(end - p);
+
+	if(len == 0)
+	{
+		return LK_EMPTY;
+	}
+
+	if(len > FDUMP_CMD.length() && has_prefix(p, len, FDUMP_CMD) && p[FDUMP_CMD.length()] == ' ')
+	{
+		return LK_ECHO;
+	}
+
+	if(has_prefix(p, len, CFE_STATUS_PREFIX))
+	{
+		return LK_STATUS;
+	}
+
+	if(has_prefix(p, len, CFE_PROMPT))
+	{
+		return LK_PROMPT;
+	}
+
+	// Address column, the sequence id of the line.
+	uint32_t seq_id = 0;
+	const char* c = p;
+	int nibble;
+
+	while(c < end && (nibble = hex_value(*c)) >= 0)
+	{
+		seq_id = (seq_id << 4) | (uint32_t)nibble;
+		c++;
+	}
+
+	if(c == p || (c < end && is_word_char(*c)))
+	{
+		// Doesn't start with an address so it can't be data.
+		return LK_OTHER;
+	}
+
+	*address = seq_id;
+
+	const char* data_start = c;
+
+	// Fast path: the tokens of a full line as CFE prints them, "ADDR: xx xx ... xx ", decoded
+	// where they are. Anything else is gathered first, then the kernel validates and decodes
+	// all of them at once.
+	if(max_bytes == HEX_DECODE_BYTES)
+	{
+		uint64_t started = (decode_ns != nullptr) ? scan_clock_ns() : 0;
+		bool decoded = (end - c >= (ptrdiff_t)(HEX_SPACED_CHARS + 2) && c[0] == ':' && c[1] == ' '
+			&& hex_decode_spaced(c + 2, target, printable));
+
+		if(decode_ns != nullptr)
+		{
+			*decode_ns += scan_clock_ns() - started;
+		}
+
+		if(!decoded)
+		{
+			char hex_data[HEX_DECODE_CHARS];
+			uint32_t pairs = 0;
+
+			while(c < end && pairs < HEX_DECODE_BYTES)
+			{
+				while(c < end && !is_word_char(*c)) c++;
+
+				const char* token = c;
+
+				while(c < end && is_word_char(*c)) c++;
+
+				if(c - token == 2)
+				{
+					hex_data[pairs * 2] = token[0];
+					hex_data[pairs * 2 + 1] = token[1];
+					pairs++;
+				}
+			}
+
+			started = (decode_ns != nullptr) ? scan_clock_ns() : 0;
+			decoded = (pairs == HEX_DECODE_BYTES && hex_decode_line(hex_data, target, printable));
+
+			if(decode_ns != nullptr)
+			{
+				*decode_ns += scan_clock_ns() - started;
+			}
+		}
+
+		if(decoded)
+		{
+			if(printable != nullptr)
+			{
+				printable[HEX_DECODE_BYTES] = '\0';
+			}
+
+			*byte_count = HEX_DECODE_BYTES;
+
+			return LK_DATA;
+		}
+	}
+
+	// Short line, or a two character token that isn't hex: decode token by token.
+	uint32_t count = 0;
+
+	c = data_start;
+
+	while(c < end && count < max_bytes)
+	{
+		// Skip separators.
+		while(c < end && !is_word_char(*c)) c++;
+
+		const char* token = c;
+
+		while(c < end && is_word_char(*c)) c++;
+
+		if(c - token == 2)
+		{
+			int hi = hex_value(token[0]);
+			int lo = hex_value(token[1]);
+
+			if(hi >= 0 && lo >= 0)
+			{
+				uint8_t byte = (uint8_t)((hi << 4) | lo);
+
+				target[count] = byte;
+
+				if(printable != nullptr)
+				{
+					printable[count] = is_printable_ascii_char((char)byte) ? (char)byte : ' ';
+				}
+
+				count++;
+			}
+		}
+	}
+
+	if(printable != nullptr)
+	{
+		printable[count] = '\0';
+	}
+
+	*byte_count = count;
+
+	return LK_DATA;
+}
+
+// Checks a scanned line against itself. Returns false if the hex tokens or the ASCII column
+// show it was damaged. confirmed is set if the ASCII column vouches for every byte, which it
+// can't for bytes it shows as '.': one of those garbled into another would look the same.
+bool verify_fdump_line(const char* line, uint32_t line_len, const uint8_t* data, uint32_t count, bool* confirmed)
+{
+	const char* c = line;
+	const char* end = line + line_len;
+
+	*confirmed = false;
+
+	while(c < end && is_whitespace(*c)) c++;
+
+	// Address column, then only ':' and spaces before the first hex token.
+	while(c < end && hex_value(*c) >= 0) c++;
+
+	// The hex tokens have to be the bytes, in order, with nothing else in between.
+	// A lost or extra character shifts a token or splits it, which shows up here.
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const char* separator = c;
+
+		while(c < end && (*c == ' ' || *c == ':')) c++;
+
+		if(c == separator || end - c < 2 || hex_value(c[0]) < 0 || hex_value(c[1]) < 0
+			|| (uint8_t)((hex_value(c[0]) << 4) | hex_value(c[1])) != data[i])
+		{
+			return false;
+		}
+
+		c += 2;
+	}
+
+	if(c == end)
+	{
+		// No ASCII column, nothing to confirm the bytes with.
+		return true;
+	}
+
+	if(*c != ' ' || end - c < (ptrdiff_t)count + 1)
+	{
+		// Something glued to the last token, or the ASCII column was cut short.
+		return false;
+	}
+
+	// The ASCII column is the last count characters, CFE shows the other bytes as '.'.
+	// A digit garbled into another hex digit changes the byte, so this catches most of those,
+	// all but a byte swapped for another one that is shown as '.' too.
+	const char* ascii = end - count;
+	bool all_shown = true;
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		char shown = is_printable_ascii_char((char)data[i]) ? (char)data[i] : '.';
+
+		if(ascii[i] != shown)
+		{
+			return false;
+		}
+
+		all_shown = all_shown && shown != '.';
+	}
+
+	*confirmed = all_shown;
+
+	return true;
+}
@@ -0,0 +1,45 @@
+// line_parser.h: Parser for the console lines CFE prints in response to fdump.
+// A data line looks like:
+//   00000000: 46 4c 53 48 00 80 00 00 8e 03 00 00 1c 00 01 00    FLSH............
+// The address column is followed by 16 bytes as two digit hex tokens, then the ASCII column.
+
+#ifndef LINE_PARSER_H
+#define LINE_PARSER_H
+
+#include <string>
+#include <cstdint>
+
+const std::string FDUMP_CMD = "fdump"; // CFE command that performs flash memory dumps that outputs data to the terminal.
+const std::string CFE_STATUS_PREFIX = "*** command status ="; // CFE prints this once a command has finished.
+const std::string CFE_PROMPT = "CFE>"; // CFE console prompt.
+const std::string WHITESPACE = " \n\r\t\f\v";
+
+const uint8_t BYTES_PER_LINE = 16; // FDUMP_CMD usually returns 16 bytes of data at once. Likely may break if changed.
+const uint32_t FORMATTED_LINE_MAX = 64; // Longest line format_data_line() writes, including the terminator.
+
+enum LineKind
+{
+	LK_EMPTY = 0,	// Nothing but whitespace.
+	LK_ECHO = 1,	// Echo of the fdump command we sent.
+	LK_STATUS = 2,	// "*** command status = N"
+	LK_PROMPT = 3,	// "CFE> " with or without a command after it.
+	LK_DATA = 4,	// Address column followed by hex bytes.
+	LK_OTHER = 5	// Anything else, e.g. error messages.
+};
+
+std::string ltrim(const std::string& s);
+std::string rtrim(const std::string& s);
+std::string trim(const std::string& s);
+bool starts_with(std::string source, std::string compare);
+int hex_to_int(char input);
+void hex_to_buffer(const char* src, char* target);
+bool is_printable_ascii_char(char c);
+void hexbuffer_to_friendlystring(const char* src, char* target);
+void buffer_to_hex(const uint8_t* src, uint32_t len, char* target);
+uint32_t format_data_line(char* target, uint64_t position, const uint8_t* data, uint32_t len, const char* printable);
+
+LineKind scan_fdump_line(const char* line, uint32_t line_len, uint8_t* target, uint32_t max_bytes,
+	uint32_t* byte_count, uint32_t* address, char* printable, uint64_t* decode_ns = nullptr);
+bool verify_fdump_line(const char* line, uint32_t line_len, const uint8_t* data, uint32_t count, bool* confirmed);
+
+#endif
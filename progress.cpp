@@ -0,0 +1,279 @@
+// progress.cpp: The progress events, one JSON object a line, flushed as each is written.
+//
+// Rates are in bytes a second. rate is since the session's last event, avg_rate since it
+// started, and eta_s is what is left at avg_rate. Times are seconds since progress= was opened.
+
+#include <cmath>
+#include <cinttypes>
+#include <cerrno>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+#include "progress.h"
+#include "dump_session.h"
+
+bool progress_open(progress_log** log, const std::string& target)
+{
+	FILE* file;
+
+	*log = nullptr;
+
+	if(target.compare(0, PROGRESS_FD_PREFIX.length(), PROGRESS_FD_PREFIX) == 0)
+	{
+		char* end = nullptr;
+		long fd = strtol(target.c_str() + PROGRESS_FD_PREFIX.length(), &end, 10);
+
+		if(end == target.c_str() + PROGRESS_FD_PREFIX.length() || *end != '\0' || fd < 0)
+		{
+			errno = EBADF;
+			return false;
+		}
+
+		file = fdopen((int)fd, "w");
+	}
+	else
+	{
+		file = fopen(target.c_str(), "w");
+	}
+
+	if(file == nullptr)
+	{
+		return false;
+	}
+
+	*log = new progress_log();
+	(*log)->file = file;
+	(*log)->opened_ns = stats_clock();
+	(*log)->line.reserve(PROGRESS_LINE_RESERVE);
+
+	return true;
+}
+
+void progress_close(progress_log* log)
+{
+	if(log != nullptr)
+	{
+		fclose(log->file);
+		delete log;
+	}
+}
+
+static void json_key(std::string* out, const char* key)
+{
+	if(out->back() != '{')
+	{
+		*out += ',';
+	}
+
+	*out += '"';
+	*out += key;
+	*out += "\":";
+}
+
+static void json_string(std::string* out, const char* key, const std::string& value)
+{
+	json_key(out, key);
+	*out += '"';
+
+	for(char c : value)
+	{
+		if(c == '"' || c == '\\')
+		{
+			*out += '\\';
+			*out += c;
+		}
+		else if((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+			*out += escaped;
+		}
+		else
+		{
+			*out += c;
+		}
+	}
+
+	*out += '"';
+}
+
+static void json_uint(std::string* out, const char* key, uint64_t value)
+{
+	char text[24];
+
+	snprintf(text, sizeof(text), "%" PRIu64, value);
+	json_key(out, key);
+	*out += text;
+}
+
+static void json_number(std::string* out, const char* key, double value)
+{
+	char text[32];
+
+	// JSON has no inf or nan.
+	snprintf(text, sizeof(text), "%.3f", std::isfinite(value) ? value : 0.0);
+	json_key(out, key);
+	*out += text;
+}
+
+static void json_bool(std::string* out, const char* key, bool value)
+{
+	json_key(out, key);
+	*out += value ? "true" : "false";
+}
+
+static void json_percentiles(std::string* out, const char* key, const std::vector<uint32_t>& samples)
+{
+	double p50, p99, max;
+	stats_percentiles(samples, &p50, &p99, &max);
+
+	json_key(out, key);
+	*out += '{';
+	json_number(out, "p50", p50);
+	json_number(out, "p99", p99);
+	json_number(out, "max", max);
+	*out += '}';
+}
+
+// The fields every event of a session starts with, in the log's line.
+static std::string& progress_begin(dump_session* session, const char* event, uint64_t now_ns)
+{
+	const dump_settings& settings = session->settings;
+	std::string& out = settings.progress->line;
+
+	out.assign(1, '{');
+
+	json_string(&out, "event", event);
+	json_string(&out, "job", !settings.name.empty() ? settings.name : !settings.of_name.empty() ? settings.of_name : settings.device_name);
+	json_number(&out, "t", (double)(now_ns - settings.progress->opened_ns) / 1e9);
+
+	return out;
+}
+
+static void progress_write(dump_session* session, std::string* out)
+{
+	*out += "}\n";
+	fputs(out->c_str(), session->settings.progress->file);
+	fflush(session->settings.progress->file);
+}
+
+static void progress_counters(dump_session* session, std::string* out)
+{
+	dump_pipeline* pipeline = session->pipeline;
+
+	json_uint(out, "rereads", pipeline->rereads);
+	json_uint(out, "bad_lines", pipeline->bad_lines);
+	json_uint(out, "stray_lines", pipeline->stray_lines);
+	json_uint(out, "incomplete_blocks", session->incomplete_blocks);
+}
+
+void progress_session_start(dump_session* session)
+{
+	if(session->settings.progress == nullptr)
+	{
+		return;
+	}
+
+	const dump_settings& settings = session->settings;
+	uint64_t now = stats_clock();
+	std::string& out = progress_begin(session, "start", now);
+
+	session->progress_mark = { now, session->bytes_read, now, session->bytes_read };
+
+	json_string(&out, "device", settings.device_name);
+	json_uint(&out, "offset", settings.offset);
+	json_uint(&out, "size", settings.size);
+	json_uint(&out, "total", session->size);
+	json_uint(&out, "bytes_done", session->bytes_read);
+	json_string(&out, "of", settings.of_name);
+	json_uint(&out, "baud", (uint64_t)session->uart_device->baud);
+	progress_write(session, &out);
+}
+
+void progress_session_block(dump_session* session, flash_block* block)
+{
+	if(session->settings.progress == nullptr)
+	{
+		return;
+	}
+
+	uint64_t now = stats_clock();
+	progress_point& mark = session->progress_mark;
+	std::string& out = progress_begin(session, "block", now);
+
+	double since_last = (double)(now - mark.last_ns) / 1e9;
+	double since_start = (double)(now - mark.started_ns) / 1e9;
+	double avg_rate = (double)(session->bytes_read - mark.start_bytes) / since_start;
+
+	json_uint(&out, "offset", block->offset);
+	json_uint(&out, "size", block->size);
+	json_uint(&out, "missing_lines", block->lines - block->lines_ok);
+	json_uint(&out, "bytes_done", session->bytes_read);
+	json_uint(&out, "total", session->size);
+	json_number(&out, "rate", (double)(session->bytes_read - mark.last_bytes) / since_last);
+	json_number(&out, "avg_rate", avg_rate);
+	json_number(&out, "eta_s", (double)(session->size - std::min(session->bytes_read, session->size)) / avg_rate);
+	progress_counters(session, &out);
+	progress_write(session, &out);
+
+	mark.last_ns = now;
+	mark.last_bytes = session->bytes_read;
+}
+
+// The summary once the session is closed, ok is how it went.
+void progress_session_end(dump_session* session, bool ok)
+{
+	if(session->settings.progress == nullptr)
+	{
+		return;
+	}
+
+	uint64_t now = stats_clock();
+	const dump_stats& stats = session->stats;
+	std::string& out = progress_begin(session, "end", now);
+	double seconds = (double)(now - session->progress_mark.started_ns) / 1e9;
+
+	json_bool(&out, "ok", ok && session->incomplete_blocks == 0 && !session->interrupted);
+	json_bool(&out, "interrupted", session->interrupted);
+	json_uint(&out, "bytes_done", session->bytes_read);
+	json_uint(&out, "total", session->size);
+	json_number(&out, "seconds", seconds);
+	json_number(&out, "avg_rate", (double)(session->bytes_read - session->progress_mark.start_bytes) / seconds);
+	progress_counters(session, &out);
+	json_uint(&out, "erased_bytes", session->erased_bytes);
+	json_uint(&out, "zero_bytes", session->zero_bytes);
+	json_uint(&out, "wire_bytes", session->rx->bytes_read - session->started_wire_bytes);
+
+	// Only a whole image has digests.
+	json_key(&out, "digests");
+	out += '{';
+
+	for(uint32_t type = 1; type <= DIGEST_ALL; type <<= 1)
+	{
+		if((session->digest.types & type) != 0 && session->digest.bytes == session->size)
+		{
+			std::string name = digest_name(type);
+			std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+			json_string(&out, name.c_str(), digest_hex(&session->digest, type));
+		}
+	}
+
+	out += '}';
+
+	json_key(&out, "phases");
+	out += '{';
+
+	for(uint32_t phase = 0; phase < SP_COUNT; phase++)
+	{
+		json_number(&out, stats_phase_name(phase), (double)stats.phase_ns[phase] / 1e9);
+	}
+
+	out += '}';
+
+	json_uint(&out, "blocks", stats.block_us.size());
+	json_percentiles(&out, "block_ms", stats.block_us);
+	json_percentiles(&out, "first_line_ms", stats.first_line_us);
+	json_uint(&out, "data_lines", stats.data_lines);
+	progress_write(session, &out);
+}
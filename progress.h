@@ -0,0 +1,42 @@
+// progress.h: Progress as newline delimited JSON for whatever runs fdump, with progress=FILE or
+// progress=fd:N. Every session writes a start event, a block event as each block is written and
+// an end event with its digests and where the time went, so a scheduler can follow many dumps
+// without reading the text meant for people:
+//   {"event":"block","job":"/dev/ttyUSB0","t":12.417,"offset":1048576,"size":65536,"bytes_done":1114112,...}
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+const std::string PROGRESS_FD_PREFIX = "fd:"; // progress=fd:3 writes to an inherited descriptor.
+const uint32_t PROGRESS_LINE_RESERVE = 1024; // Room for an event, more than a block event takes.
+
+struct progress_log
+{
+	FILE* file;
+	uint64_t opened_ns;			// Event times count from here.
+	std::string line;			// Event being put together, reused so writing one doesn't allocate.
+};
+
+// Where a session's last event left off, for its rates.
+struct progress_point
+{
+	uint64_t started_ns;
+	uint64_t start_bytes;		// Already in the image when it started, with resume.
+	uint64_t last_ns;
+	uint64_t last_bytes;
+};
+
+struct dump_session;
+struct flash_block;
+
+bool progress_open(progress_log** log, const std::string& target);
+void progress_close(progress_log* log);
+void progress_session_start(dump_session* session);
+void progress_session_block(dump_session* session, flash_block* block);
+void progress_session_end(dump_session* session, bool ok);
+
+#endif
@@ -0,0 +1,319 @@
+// replay.cpp: Offline replay of captured CFE console logs.
+//
+// The capture is mmap'd (or read from stdin in windows), each window is split
+// on line boundaries into one chunk per worker, the workers run scan_fdump_line()
+// over their chunk in parallel, and the recovered bytes are handed to the writer
+// in input order. The writer works through one window while the workers parse the next.
+
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#ifdef POSIX
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#include "replay.h"
+#include "line_parser.h"
+
+struct replay_chunk
+{
+	const char* begin;
+	const char* end;
+	std::vector<uint8_t> data; // Recovered bytes, capacity is kept between rounds.
+	uint64_t lines;
+	uint64_t data_lines;
+};
+
+struct replay_state
+{
+	uint32_t threads;
+	std::vector<replay_chunk> chunks[2]; // One set being parsed while the other is written.
+	uint64_t round;
+	uint64_t position; // Bytes written so far.
+	ReplayWriteFn write;
+	replay_stats* stats;
+	bool ok;
+};
+
+static void replay_parse_line(replay_chunk* chunk, const char* line, uint32_t line_len)
+{
+	uint8_t data[BYTES_PER_LINE];
+	uint32_t byte_count = 0;
+	uint32_t address = 0;
+
+	LineKind kind = scan_fdump_line(line, line_len, data, BYTES_PER_LINE, &byte_count, &address, nullptr);
+
+	if(kind == LK_EMPTY)
+	{
+		return;
+	}
+
+	chunk->lines++;
+
+	if(kind == LK_DATA && byte_count > 0)
+	{
+		chunk->data_lines++;
+		chunk->data.insert(chunk->data.end(), data, data + byte_count);
+	}
+}
+
+static void replay_parse_chunk(replay_chunk* chunk)
+{
+	const char* c = chunk->begin;
+
+	chunk->data.clear();
+	chunk->lines = 0;
+	chunk->data_lines = 0;
+
+	while(c < chunk->end)
+	{
+		const char* newline = (const char*)memchr(c, '\n', chunk->end - c);
+		const char* line_end = (newline != nullptr) ? newline : chunk->end;
+
+		// Captures may also break lines with a bare '\r', e.g. "\r\r\n" from minicom.
+		while(c < line_end)
+		{
+			const char* cr = (const char*)memchr(c, '\r', line_end - c);
+			const char* end = (cr != nullptr) ? cr : line_end;
+
+			if(end > c)
+			{
+				replay_parse_line(chunk, c, (uint32_t)(end - c));
+			}
+
+			c = end + 1;
+		}
+
+		c = line_end + 1;
+	}
+}
+
+static const char* replay_next_line(const char* c, const char* end)
+{
+	const char* newline = (const char*)memchr(c, '\n', end - c);
+	return (newline != nullptr) ? newline + 1 : end;
+}
+
+static void replay_write_chunks(replay_state* state, std::vector<replay_chunk>& chunks)
+{
+	for(replay_chunk& chunk : chunks)
+	{
+		state->stats->lines += chunk.lines;
+		state->stats->data_lines += chunk.data_lines;
+
+		if(chunk.data.empty() || !state->ok)
+		{
+			continue;
+		}
+
+		if(!state->write(chunk.data.data(), chunk.data.size(), state->position))
+		{
+			state->ok = false;
+		}
+
+		state->position += chunk.data.size();
+		state->stats->bytes += chunk.data.size();
+	}
+
+	// Mark as written but keep the capacity for the next round.
+	for(replay_chunk& chunk : chunks)
+	{
+		chunk.data.clear();
+		chunk.lines = 0;
+		chunk.data_lines = 0;
+	}
+}
+
+// Parse one window of complete lines on all workers, writing out the previous window meanwhile.
+static void replay_round(replay_state* state, const char* begin, const char* end)
+{
+	std::vector<replay_chunk>& chunks = state->chunks[state->round & 1];
+	std::vector<replay_chunk>& previous = state->chunks[(state->round + 1) & 1];
+	uint64_t chunk_size = ((uint64_t)(end - begin) + state->threads - 1) / state->threads;
+	const char* c = begin;
+
+	state->stats->input_bytes += (uint64_t)(end - begin);
+
+	// Split on line boundaries so no line is cut between two workers.
+	chunks.resize(state->threads);
+	uint32_t used = 0;
+
+	while(c < end && used < state->threads)
+	{
+		const char* chunk_end = (used == state->threads - 1 || (uint64_t)(end - c) <= chunk_size)
+			? end : replay_next_line(c + chunk_size, end);
+
+		chunks[used].begin = c;
+		chunks[used].end = chunk_end;
+		used++;
+
+		c = chunk_end;
+	}
+	chunks.resize(used);
+
+	std::vector<std::thread> workers;
+	for(uint32_t i = 0; i < used; i++)
+	{
+		workers.push_back(std::thread(replay_parse_chunk, &chunks[i]));
+	}
+
+	// Ordered output of the last round overlaps with parsing this one.
+	replay_write_chunks(state, previous);
+
+	for(std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	state->round++;
+}
+
+static void replay_streamed(replay_state* state, FILE* stream)
+{
+	// Whole lines are parsed a window at a time, a partial line at the end is carried over.
+	std::vector<char> window((size_t)state->threads * REPLAY_CHUNK_SIZE);
+	size_t filled = 0;
+	bool eof = false;
+
+	while(!eof && state->ok)
+	{
+		while(filled < window.size() && !eof)
+		{
+			size_t got = fread(window.data() + filled, 1, window.size() - filled, stream);
+
+			filled += got;
+			eof = (got == 0);
+		}
+
+		const char* begin = window.data();
+		const char* end = begin + filled;
+
+		if(!eof)
+		{
+			// Back up to the end of the last complete line, unless one line fills the whole window.
+			const char* c = end;
+			while(c > begin && c[-1] != '\n') c--;
+			if(c > begin) end = c;
+		}
+
+		replay_round(state, begin, end);
+
+		size_t carry = filled - (size_t)(end - begin);
+		memmove(window.data(), end, carry);
+		filled = carry;
+	}
+}
+
+#ifdef POSIX
+	static bool replay_mapped(replay_state* state, const std::string& in_name)
+	{
+		int fd = open(in_name.c_str(), O_RDONLY);
+
+		if(fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+
+		if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		{
+			// Not something mmap can do, e.g. a fifo. Caller falls back to reading it.
+			close(fd);
+			return false;
+		}
+
+		size_t length = (size_t)st.st_size;
+		void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		close(fd);
+
+		if(map == MAP_FAILED)
+		{
+			return false;
+		}
+
+		madvise(map, length, MADV_SEQUENTIAL);
+
+		const char* c = (const char*)map;
+		const char* end = c + length;
+		uint64_t window = (uint64_t)state->threads * REPLAY_CHUNK_SIZE;
+
+		while(c < end && state->ok)
+		{
+			const char* window_end = ((uint64_t)(end - c) <= window) ? end : replay_next_line(c + window, end);
+
+			replay_round(state, c, window_end);
+
+			c = window_end;
+		}
+
+		munmap(map, length);
+
+		return true;
+	}
+#endif
+
+bool replay_capture(const std::string& in_name, uint32_t threads, ReplayWriteFn write, replay_stats* stats)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	if(threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+	if(threads == 0)
+	{
+		threads = 1;
+	}
+
+	memset(stats, 0, sizeof(replay_stats));
+	stats->threads = threads;
+
+	replay_state state;
+	state.threads = threads;
+	state.round = 0;
+	state.position = 0;
+	state.write = write;
+	state.stats = stats;
+	state.ok = true;
+
+	bool done = false;
+
+#ifdef POSIX
+	if(in_name != REPLAY_STDIN)
+	{
+		done = replay_mapped(&state, in_name);
+	}
+#endif
+
+	if(!done)
+	{
+		FILE* stream = (in_name == REPLAY_STDIN) ? stdin : fopen(in_name.c_str(), "rb");
+
+		if(stream == nullptr)
+		{
+			return false;
+		}
+
+		replay_streamed(&state, stream);
+
+		if(stream != stdin)
+		{
+			fclose(stream);
+		}
+	}
+
+	// Write out the last round, the recovered data is copied so the input can already be gone.
+	replay_write_chunks(&state, state.chunks[(state.round + 1) & 1]);
+
+	stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return state.ok;
+}
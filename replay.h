@@ -0,0 +1,30 @@
+// replay.h: Offline replay of captured CFE console logs.
+// Rebuilds an image from a minicom/screen capture of fdump sessions without the router,
+// using the same line scanner as a live dump.
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <cstdint>
+
+const uint32_t REPLAY_CHUNK_SIZE = 4 * 1024 * 1024; // Input bytes parsed per worker per round.
+const std::string REPLAY_STDIN = "-"; // in=- (or no in=) reads the capture from stdin.
+
+struct replay_stats
+{
+	uint64_t input_bytes;	// Bytes of capture read.
+	uint64_t lines;			// Non empty lines seen.
+	uint64_t data_lines;	// Lines that had data on them.
+	uint64_t bytes;			// Bytes of data recovered, in the order they appear.
+	uint32_t threads;		// Worker threads used.
+	double seconds;			// Wall time.
+};
+
+// Called in input order for each chunk of recovered data.
+// position is where data starts in the recovered stream.
+typedef bool(*ReplayWriteFn)(const uint8_t* data, uint64_t len, uint64_t position);
+
+bool replay_capture(const std::string& in_name, uint32_t threads, ReplayWriteFn write, replay_stats* stats);
+
+#endif
@@ -0,0 +1,372 @@
+// serial_rx.cpp: Buffered receive layer on top of the minimal C++ Uart library.
+//
+// Reading one byte per uart_read() costs one read() syscall per byte, which for a
+// 16 MiB dump is tens of millions of syscalls. Instead each read asks for all the
+// free space in the ring, and while data is streaming the reader waits roughly
+// the time it takes RX_COALESCE_BYTES to arrive at the configured baud rate,
+// so every syscall picks up hundreds to thousands of bytes.
+//
+// With a reader thread the ring is single producer, single consumer: only the reader
+// moves head and only the parser moves tail, each publishing with an atomic store.
+// The mutex and condition variable are only for the parser to sleep on when the
+// ring is empty, the data itself never takes a lock.
+
+#include <cassert>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include "serial_rx.h"
+#include "line_parser.h"
+
+void rx_init(rx_buffer** rx, uart_dev* uart_device, uint32_t capacity)
+{
+	// Capacity must be a power of two for the position mask.
+	assert((capacity & (capacity - 1)) == 0);
+
+	*rx = new rx_buffer();
+	(*rx)->uart_device = uart_device;
+	(*rx)->ring = new char[capacity];
+	(*rx)->capacity = capacity;
+	(*rx)->head = 0;
+	(*rx)->tail = 0;
+	(*rx)->line[0] = '\0';
+	(*rx)->line_len = 0;
+	(*rx)->streaming = false;
+	(*rx)->reader = nullptr;
+	(*rx)->reader_running = false;
+	(*rx)->parser_waiting = false;
+	(*rx)->read_calls = 0;
+	(*rx)->empty_reads = 0;
+	(*rx)->bytes_read = 0;
+	(*rx)->high_water = 0;
+	(*rx)->stalls = 0;
+}
+
+uint32_t rx_coalesce_us(rx_buffer* rx)
+{
+	uint32_t baud = rx->uart_device->baud;
+
+	if(!rx->streaming || baud == 0)
+	{
+		return 0;
+	}
+
+	// One character on the wire is 10 bits with 8/N/1 framing.
+	uint64_t wait_us = (uint64_t)RX_COALESCE_BYTES * 10 * 1000000 / baud;
+
+	return (wait_us > RX_COALESCE_MAX_US) ? RX_COALESCE_MAX_US : (uint32_t)wait_us;
+}
+
+static void rx_coalesce_wait(rx_buffer* rx)
+{
+	uint32_t wait_us = rx_coalesce_us(rx);
+
+	if(wait_us > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+	}
+}
+
+// One uart_read() into the free space of the ring, got is what it returned.
+// Returns false without reading if the ring is full.
+static bool rx_read_tty(rx_buffer* rx, uint32_t* got, bool coalesce)
+{
+	uint64_t head = rx->head.load(std::memory_order_relaxed);
+	uint64_t used = head - rx->tail.load(std::memory_order_acquire);
+	uint32_t free_space = rx->capacity - (uint32_t)used;
+
+	*got = 0;
+
+	if(free_space == 0)
+	{
+		return false;
+	}
+
+	// Only read up to the end of the ring storage so the read stays contiguous.
+	uint32_t position = (uint32_t)(head & (rx->capacity - 1));
+	uint32_t contiguous = rx->capacity - position;
+	uint32_t bytes_to_read = (free_space < contiguous) ? free_space : contiguous;
+
+	if(coalesce)
+	{
+		rx_coalesce_wait(rx);
+	}
+
+	void* data = (void*)&rx->ring[position];
+	unsigned long num_bytes = uart_read(rx->uart_device, &data, bytes_to_read);
+
+	rx->read_calls++;
+
+	if(num_bytes > 0)
+	{
+		// Publishes the bytes to the parser.
+		rx->head.store(head + num_bytes);
+		rx->bytes_read += num_bytes;
+
+		if(used + num_bytes > rx->high_water)
+		{
+			rx->high_water = used + num_bytes;
+		}
+
+		// Only coalesce if the tty had less ready than we asked for.
+		rx->streaming = (num_bytes < bytes_to_read);
+	}
+	else
+	{
+		rx->empty_reads++;
+		rx->streaming = false;
+	}
+
+	*got = (uint32_t)num_bytes;
+
+	return true;
+}
+
+static void rx_reader_main(rx_buffer* rx)
+{
+	while(rx->reader_running)
+	{
+		uint32_t got;
+
+		if(!rx_read_tty(rx, &got, true))
+		{
+			// The parser has fallen a whole ring behind, the tty driver buffers meanwhile.
+			rx->stalls++;
+			std::this_thread::sleep_for(std::chrono::microseconds(RX_STALL_WAIT_US));
+			continue;
+		}
+
+		// The mutex makes sure the parser is either asleep on data_ready or sees the new head.
+		if(got > 0 && rx->parser_waiting)
+		{
+			std::lock_guard<std::mutex> lock(rx->wait_mutex);
+			rx->data_ready.notify_one();
+		}
+	}
+}
+
+void rx_start_reader(rx_buffer* rx)
+{
+	if(rx->reader == nullptr)
+	{
+		rx->reader_running = true;
+		rx->reader = new std::thread(rx_reader_main, rx);
+	}
+}
+
+void rx_stop_reader(rx_buffer* rx)
+{
+	if(rx->reader != nullptr)
+	{
+		// Returns within one uart_read() timeout.
+		rx->reader_running = false;
+		rx->reader->join();
+
+		delete rx->reader;
+		rx->reader = nullptr;
+	}
+}
+
+// With a reader thread: wait up to the uart read timeout for it to bring in something.
+static bool rx_wait_data(rx_buffer* rx)
+{
+	auto has_data = [rx]() { return rx->head.load() != rx->tail.load(std::memory_order_relaxed); };
+
+	if(has_data())
+	{
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(rx->wait_mutex);
+
+	rx->parser_waiting = true;
+	bool got = rx->data_ready.wait_for(lock, std::chrono::milliseconds(rx->uart_device->read_timeout_ms), has_data);
+	rx->parser_waiting = false;
+
+	return got;
+}
+
+bool rx_fill(rx_buffer* rx)
+{
+	if(rx->reader != nullptr)
+	{
+		return rx_wait_data(rx);
+	}
+
+	uint32_t got;
+
+	if(!rx_read_tty(rx, &got, true))
+	{
+		// Caller has to drain lines first.
+		return true;
+	}
+
+	// Nothing to read if got == 0.
+	return got > 0;
+}
+
+// For callers that wait on the tty themselves, e.g. with epoll: reads what is ready
+// without waiting, rx_coalesce_us() then says how long to leave the tty before the next read.
+bool rx_fill_ready(rx_buffer* rx)
+{
+	uint32_t got;
+
+	if(!rx_read_tty(rx, &got, false))
+	{
+		return true;
+	}
+
+	return got > 0;
+}
+
+bool rx_next_line(rx_buffer* rx, const char** line, uint32_t* line_len)
+{
+	uint64_t head = rx->head.load(std::memory_order_acquire);
+	uint64_t tail = rx->tail.load(std::memory_order_relaxed);
+
+	while(tail != head)
+	{
+		char c = rx->ring[tail & (rx->capacity - 1)];
+		tail++;
+
+		if(c == '\n' || c == '\r')
+		{
+			// Skip empty lines, e.g. the '\n' of a "\r\n" pair.
+			if(rx->line_len > 0)
+			{
+				rx->line[rx->line_len] = '\0';
+				*line = rx->line;
+				*line_len = rx->line_len;
+
+				// Next call starts a new line. The returned line stays valid until then.
+				rx->line_len = 0;
+
+				// Hands the space back to the reader.
+				rx->tail.store(tail, std::memory_order_release);
+
+				return true;
+			}
+		}
+		else if(rx->line_len < RX_MAX_LINE)
+		{
+			// Append the single character to the line being assembled.
+			rx->line[rx->line_len++] = c;
+		}
+	}
+
+	rx->tail.store(tail, std::memory_order_release);
+
+	// Need more data for a complete line.
+	return false;
+}
+
+bool rx_read_char(rx_buffer* rx, char* c)
+{
+	if(rx->tail == rx->head && !rx_fill(rx))
+	{
+		return false;
+	}
+
+	uint64_t tail = rx->tail.load(std::memory_order_relaxed);
+
+	*c = rx->ring[tail & (rx->capacity - 1)];
+	rx->tail.store(tail + 1, std::memory_order_release);
+
+	return true;
+}
+
+void rx_reset_line(rx_buffer* rx)
+{
+	// Drop any partial line, e.g. the "CFE> " prompt left over from the previous command.
+	rx->line_len = 0;
+	rx->line[0] = '\0';
+}
+
+void rx_discard(rx_buffer* rx)
+{
+	rx->tail.store(rx->head.load(std::memory_order_acquire), std::memory_order_release);
+	rx_reset_line(rx);
+}
+
+// Read and throw away whatever is still arriving, e.g. the tail of the last reply.
+// Only without the reader thread, like rx_command().
+void rx_drain(rx_buffer* rx)
+{
+	while(rx_fill(rx))
+	{
+		rx_discard(rx);
+	}
+	rx_discard(rx);
+}
+
+// Send one console command and collect the reply lines until the prompt after its echo, or
+// until the line goes quiet. Replies to earlier commands, e.g. garbage typed at the wrong
+// rate, are skipped. For the short commands around a dump, not with the reader thread.
+bool rx_command(rx_buffer* rx, const std::string& command, std::vector<std::string>* lines)
+{
+	std::string line_cmd = command + "\r";
+	uint32_t empty_reads = 0;
+	bool echoed = false;
+
+	rx_drain(rx);
+
+	uart_write(rx->uart_device, (void*)line_cmd.c_str(), line_cmd.length());
+
+	lines->clear();
+
+	while(empty_reads < RX_COMMAND_MAX_EMPTY_READS)
+	{
+		if(!rx_fill(rx))
+		{
+			empty_reads++;
+		}
+
+		const char* line;
+		uint32_t line_len;
+
+		while(rx_next_line(rx, &line, &line_len))
+		{
+			std::string reply(line, line_len);
+
+			if(!echoed)
+			{
+				echoed = (reply.find(command) != std::string::npos);
+				lines->clear();
+			}
+
+			lines->push_back(reply);
+		}
+
+		// The prompt isn't followed by a new line, so it is the partial line left over.
+		if(echoed && rx->line_len >= CFE_PROMPT.length()
+			&& strncmp(rx->line, CFE_PROMPT.c_str(), CFE_PROMPT.length()) == 0)
+		{
+			rx_reset_line(rx);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+double rx_syscalls_per_mib(rx_buffer* rx)
+{
+	if(rx->bytes_read == 0)
+	{
+		return 0.0;
+	}
+
+	return (double)rx->read_calls * 1048576.0 / (double)rx->bytes_read;
+}
+
+void rx_free(rx_buffer* rx)
+{
+	// Free allocated memory;
+	if(rx != nullptr)
+	{
+		rx_stop_reader(rx);
+
+		delete[] rx->ring;
+		delete rx;
+	}
+}
@@ -0,0 +1,70 @@
+// serial_rx.h: Buffered receive layer on top of the minimal C++ Uart library.
+// Pulls as much as the tty has ready with each uart_read() into a reusable
+// ring buffer and hands complete lines to the caller. With rx_start_reader()
+// a thread of its own does the reading, so a slow disk or terminal on the
+// parsing side can't hold up draining the tty.
+
+#ifndef SERIAL_RX_H
+#define SERIAL_RX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Minimal C++ Uart library.
+#include "uart.h"
+
+const uint32_t RX_BUFFER_SIZE = 16384; // Ring buffer capacity. Must be a power of two and bigger than the tty driver buffer (4 KiB on Linux).
+const uint32_t RX_COALESCE_BYTES = 1024; // While data is streaming, let about this many bytes build up in the tty before reading again.
+const uint32_t RX_COALESCE_MAX_US = 50000; // Never wait longer than this between reads, no matter how slow the baud rate.
+const uint32_t RX_MAX_LINE = 1024; // Longest line handed to the parser. fdump lines are ~80 characters, anything longer is truncated.
+const uint32_t RX_THREAD_BUFFER_SIZE = 1048576; // Ring with a reader thread, seconds of data at any baud rate so the parser can fall behind.
+const uint32_t RX_STALL_WAIT_US = 1000; // Reader thread sleep while the ring is full.
+const uint32_t RX_COMMAND_MAX_EMPTY_READS = 20; // rx_command() gives up on a reply after this many empty reads (UART_READ_TIMEOUT_MS each).
+
+struct rx_buffer
+{
+	uart_dev* uart_device;
+	char* ring;			// Ring storage, capacity bytes.
+	uint32_t capacity;	// Power of two so positions can be masked.
+	std::atomic<uint64_t> head;	// Total bytes written into the ring, only the reader moves it.
+	std::atomic<uint64_t> tail;	// Total bytes consumed from the ring, only the parser moves it.
+	char line[RX_MAX_LINE + 1]; // Line being assembled, zero terminated once complete.
+	uint32_t line_len;
+	bool streaming;		// Last read returned data, so more is likely on the way.
+
+	// Reader thread, nullptr when rx_fill() reads the tty itself.
+	std::thread* reader;
+	std::atomic<bool> reader_running;
+	std::atomic<bool> parser_waiting; // The parser is asleep on data_ready.
+	std::mutex wait_mutex;
+	std::condition_variable data_ready;
+
+	// Counters.
+	std::atomic<uint64_t> read_calls;	// Calls to uart_read() (one read() syscall each on POSIX).
+	std::atomic<uint64_t> empty_reads;	// Calls to uart_read() that returned nothing.
+	std::atomic<uint64_t> bytes_read;	// Total bytes received.
+	std::atomic<uint64_t> high_water;	// Most bytes ever waiting in the ring.
+	std::atomic<uint64_t> stalls;		// Times the reader found the ring full and had to wait for the parser.
+};
+
+void rx_init(rx_buffer** rx, uart_dev* uart_device, uint32_t capacity);
+void rx_start_reader(rx_buffer* rx);
+void rx_stop_reader(rx_buffer* rx);
+bool rx_fill(rx_buffer* rx);
+bool rx_fill_ready(rx_buffer* rx);
+uint32_t rx_coalesce_us(rx_buffer* rx);
+bool rx_next_line(rx_buffer* rx, const char** line, uint32_t* line_len);
+bool rx_read_char(rx_buffer* rx, char* c);
+void rx_reset_line(rx_buffer* rx);
+void rx_discard(rx_buffer* rx);
+void rx_drain(rx_buffer* rx);
+bool rx_command(rx_buffer* rx, const std::string& command, std::vector<std::string>* lines);
+double rx_syscalls_per_mib(rx_buffer* rx);
+void rx_free(rx_buffer* rx);
+
+#endif
@@ -0,0 +1,164 @@
+// stats.cpp: Phase totals and latency percentiles for --stats.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+#include "stats.h"
+
+static const char* const STATS_PHASE_NAMES[SP_COUNT] = { "command", "receive", "parse", "decode", "print", "write", "checksum" };
+
+// Nanoseconds on the monotonic clock.
+uint64_t stats_clock()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// blocks is about how many there will be, and commands_per_block how many fdump commands each
+// takes, so the samples don't have to grow as they come in.
+void stats_init(dump_stats* stats, bool enabled, uint64_t blocks, uint32_t commands_per_block)
+{
+	stats->enabled = enabled;
+	stats->started_ns = enabled ? stats_clock() : 0;
+
+	for(uint32_t i = 0; i < SP_COUNT; i++)
+	{
+		stats->phase_ns[i] = 0;
+		stats->phase_calls[i] = 0;
+	}
+
+	stats->block_us.clear();
+	stats->first_line_us.clear();
+	stats->data_lines = 0;
+	stats->data_chars = 0;
+
+	if(enabled)
+	{
+		stats->block_us.reserve((size_t)blocks);
+		stats->first_line_us.reserve((size_t)blocks * commands_per_block);
+	}
+}
+
+// Where a step starts, 0 without --stats.
+uint64_t stats_start(const dump_stats* stats)
+{
+	return stats->enabled ? stats_clock() : 0;
+}
+
+// Adds the time since start_ns to phase.
+void stats_add(dump_stats* stats, StatsPhase phase, uint64_t start_ns)
+{
+	if(stats->enabled)
+	{
+		stats->phase_ns[phase] += stats_clock() - start_ns;
+		stats->phase_calls[phase]++;
+	}
+}
+
+// Keeps the time since start_ns in microseconds.
+void stats_sample(dump_stats* stats, std::vector<uint32_t>* samples, uint64_t start_ns)
+{
+	if(stats->enabled)
+	{
+		samples->push_back((uint32_t)std::min<uint64_t>((stats_clock() - start_ns) / 1000, UINT32_MAX));
+	}
+}
+
+const char* stats_phase_name(uint32_t phase)
+{
+	return (phase < SP_COUNT) ? STATS_PHASE_NAMES[phase] : "";
+}
+
+// Since the start of the dump.
+double stats_seconds(const dump_stats* stats)
+{
+	return (double)(stats_clock() - stats->started_ns) / 1e9;
+}
+
+// Nearest rank, all 0 without samples.
+void stats_percentiles(std::vector<uint32_t> samples, double* p50_ms, double* p99_ms, double* max_ms)
+{
+	*p50_ms = *p99_ms = *max_ms = 0.0;
+
+	if(samples.empty())
+	{
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	auto at = [&samples](double fraction) { return samples[(size_t)(fraction * (double)(samples.size() - 1) + 0.5)] / 1000.0; };
+
+	*p50_ms = at(0.5);
+	*p99_ms = at(0.99);
+	*max_ms = samples.back() / 1000.0;
+}
+
+static std::string stats_percentiles_text(const std::vector<uint32_t>& samples)
+{
+	std::ostringstream text;
+	double p50, p99, max;
+
+	if(samples.empty())
+	{
+		return "none";
+	}
+
+	stats_percentiles(samples, &p50, &p99, &max);
+
+	text << std::fixed << std::setprecision(1) << "p50 " << p50 << " ms, p99 " << p99
+		<< " ms, max " << max << " ms (" << samples.size() << ")";
+
+	return text.str();
+}
+
+void stats_report(const dump_stats* stats, const std::string& prefix, uint32_t baud, uint64_t wire_bytes)
+{
+	if(!stats->enabled)
+	{
+		return;
+	}
+
+	double seconds = stats_seconds(stats);
+	std::ostringstream text;
+
+	text << std::fixed << std::setprecision(3);
+	text << prefix << "Stats: " << seconds << " s, " << stats->block_us.size() << " blocks, "
+		<< stats->data_lines << " data lines" << std::endl;
+
+	for(uint32_t i = 0; i < SP_COUNT; i++)
+	{
+		double phase_seconds = (double)stats->phase_ns[i] / 1e9;
+
+		text << prefix << "  " << std::left << std::setw(10) << STATS_PHASE_NAMES[i] << std::right
+			<< std::setw(10) << phase_seconds << " s " << std::setw(6) << std::setprecision(1)
+			<< (seconds > 0.0 ? phase_seconds * 100.0 / seconds : 0.0) << "% " << std::setprecision(3)
+			<< stats->phase_calls[i] << " calls" << std::endl;
+	}
+
+	text << prefix << "  Block latency: " << stats_percentiles_text(stats->block_us) << std::endl;
+	text << prefix << "  First line:    " << stats_percentiles_text(stats->first_line_us) << std::endl;
+
+	if(stats->data_lines > 0 && seconds > 0.0 && baud > 0)
+	{
+		// 8N1 takes 10 bits a character.
+		double chars_per_line = (double)stats->data_chars / (double)stats->data_lines;
+		double line_rate = (double)stats->data_lines / seconds;
+		double baud_rate = (double)baud / 10.0 / chars_per_line;
+
+		text << std::setprecision(1) << prefix << "  Line rate: " << line_rate << " lines/s, "
+			<< line_rate * 100.0 / baud_rate << "% of the " << baud_rate << " lines/s baud=" << baud
+			<< " carries at " << chars_per_line << " characters a line" << std::endl;
+
+		if(wire_bytes > 0)
+		{
+			text << prefix << "  Data lines are " << (double)stats->data_chars * 100.0 / (double)wire_bytes
+				<< "% of the " << wire_bytes << " bytes received" << std::endl;
+		}
+	}
+
+	std::cout << text.str();
+}
@@ -0,0 +1,47 @@
+// stats.h: Where the time of a dump goes, with --stats. Each step of the block loop is timed
+// on the monotonic clock and added to its phase, and every block's latency and every command's
+// wait for its first line are kept for their percentiles. When it is off all there is left is
+// a test of enabled around each step, so the timing points stay compiled in.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+enum StatsPhase
+{
+	SP_COMMAND = 0,		// Typing the fdump command.
+	SP_RECEIVE,			// rx_fill(), reading the tty or waiting on it.
+	SP_PARSE,			// Splitting lines and placing them in their blocks, less the hex.
+	SP_DECODE,			// The hex kernel.
+	SP_PRINT,			// -l
+	SP_WRITE,			// Into of=.
+	SP_CHECKSUM,		// Journal CRC-32 and hash=.
+	SP_COUNT
+};
+
+struct dump_stats
+{
+	bool enabled;
+	uint64_t started_ns;		// stats_clock() at the start of the dump.
+	uint64_t phase_ns[SP_COUNT];
+	uint64_t phase_calls[SP_COUNT];
+	std::vector<uint32_t> block_us;	// From sending a block's first command until it was written.
+	std::vector<uint32_t> first_line_us; // From a command starting to run until its first data line.
+	uint64_t data_lines;
+	uint64_t data_chars;		// Of the data lines, with their line ends.
+};
+
+uint64_t stats_clock();
+void stats_init(dump_stats* stats, bool enabled, uint64_t blocks, uint32_t commands_per_block);
+uint64_t stats_start(const dump_stats* stats);
+void stats_add(dump_stats* stats, StatsPhase phase, uint64_t start_ns);
+void stats_sample(dump_stats* stats, std::vector<uint32_t>* samples, uint64_t start_ns);
+const char* stats_phase_name(uint32_t phase);
+double stats_seconds(const dump_stats* stats);
+void stats_percentiles(std::vector<uint32_t> samples, double* p50_ms, double* p99_ms, double* max_ms);
+void stats_report(const dump_stats* stats, const std::string& prefix, uint32_t baud, uint64_t wire_bytes);
+
+#endif
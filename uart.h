@@ -27,6 +27,8 @@ enum ParityMode
 
 struct uart_dev;
 
+const uint32_t UART_READ_TIMEOUT_MS = 100; // Longest uart_read() waits for the first byte, change with uart_set_read_timeout().
+
 // Interface between platforms.
 void uart_init(uart_dev** dev);
 void uart_set_baud(uart_dev* dev, uint32_t baud_rate);
@@ -35,10 +37,12 @@ void uart_set_parity(uart_dev* dev, bool parity, int32_t parity_mode);
 void uart_set_stopbits(uart_dev* dev, uint32_t stop_bits);
 void uart_set_databits(uart_dev* dev, uint32_t data_bits);
 void uart_set_verbosity(uart_dev* dev, bool verbosity);
+void uart_set_read_timeout(uart_dev* dev, uint32_t timeout_ms);
 bool uart_open(uart_dev* dev, std::string port_name);
 bool uart_config(uart_dev* dev);
 unsigned long uart_write(uart_dev* dev, void* data, unsigned long bytes_to_write);
 unsigned long uart_read(uart_dev* dev, void** data, unsigned long bytes_to_read);
+void uart_drain(uart_dev* dev);
 void uart_close(uart_dev* dev);
 void uart_free(uart_dev* dev);
 
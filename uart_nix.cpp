@@ -5,9 +5,183 @@
 	#include <cstring>
 	#include "uart.h"
 
+	#ifdef LINUX
+		#include <sys/ioctl.h>
+
+		// Arbitrary rates need termios2, whose header (asm/termbits.h) clashes with <termios.h>.
+		// Same layout as the kernel's generic struct termios2.
+		#if defined(TCGETS2) && defined(TCSETS2)
+			#define UART_TERMIOS2
+
+			struct termios2
+			{
+				tcflag_t c_iflag;
+				tcflag_t c_oflag;
+				tcflag_t c_cflag;
+				tcflag_t c_lflag;
+				cc_t c_line;
+				cc_t c_cc[19];
+				speed_t c_ispeed;
+				speed_t c_ospeed;
+			};
+
+			#ifndef BOTHER
+				#define BOTHER 0010000
+			#endif
+		#endif
+	#endif
+
+	struct uart_baud
+	{
+		uint32_t rate;
+		speed_t speed;
+	};
+
+	// Standard rates, the higher ones only where the platform defines them.
+	static const uart_baud UART_BAUD_RATES[] =
+	{
+		{ 0, B0 }, { 50, B50 }, { 75, B75 }, { 110, B110 }, { 134, B134 }, { 150, B150 },
+		{ 200, B200 }, { 300, B300 }, { 600, B600 }, { 1200, B1200 }, { 1800, B1800 },
+		{ 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+		{ 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+	#ifdef B460800
+		{ 460800, B460800 },
+	#endif
+	#ifdef B500000
+		{ 500000, B500000 },
+	#endif
+	#ifdef B576000
+		{ 576000, B576000 },
+	#endif
+	#ifdef B921600
+		{ 921600, B921600 },
+	#endif
+	#ifdef B1000000
+		{ 1000000, B1000000 },
+	#endif
+	#ifdef B1152000
+		{ 1152000, B1152000 },
+	#endif
+	#ifdef B1500000
+		{ 1500000, B1500000 },
+	#endif
+	#ifdef B2000000
+		{ 2000000, B2000000 },
+	#endif
+	#ifdef B2500000
+		{ 2500000, B2500000 },
+	#endif
+	#ifdef B3000000
+		{ 3000000, B3000000 },
+	#endif
+	#ifdef B3500000
+		{ 3500000, B3500000 },
+	#endif
+	#ifdef B4000000
+		{ 4000000, B4000000 },
+	#endif
+	};
+
+	static const uart_baud* uart_find_baud(uint32_t rate)
+	{
+		for (const uart_baud& baud : UART_BAUD_RATES)
+		{
+			if (baud.rate == rate)
+			{
+				return &baud;
+			}
+		}
+		return nullptr;
+	}
+
+	static uint32_t uart_speed_to_rate(speed_t speed)
+	{
+		for (const uart_baud& baud : UART_BAUD_RATES)
+		{
+			if (baud.speed == speed)
+			{
+				return baud.rate;
+			}
+		}
+		// On the BSDs the speed is the rate.
+		return (uint32_t)speed;
+	}
+
+	#ifdef UART_TERMIOS2
+		static bool uart_set_custom_baud(uart_dev* dev)
+		{
+			struct termios2 tty2;
+
+			if (ioctl(dev->serial_port, TCGETS2, &tty2) != 0)
+			{
+				std::cout << "Error " << std::to_string(errno) << " from TCGETS2: " << strerror(errno) << std::endl;
+				return false;
+			}
+
+			// BOTHER takes the rate from c_ispeed/c_ospeed instead of a Bxxx constant.
+			tty2.c_cflag &= ~CBAUD;
+			tty2.c_cflag |= BOTHER;
+			tty2.c_ispeed = dev->baud;
+			tty2.c_ospeed = dev->baud;
+
+			if (ioctl(dev->serial_port, TCSETS2, &tty2) != 0)
+			{
+				std::cout << "Baud rate " << dev->baud << " rejected by the driver. Error " << std::to_string(errno) 
+					<< " from TCSETS2: " << strerror(errno) << std::endl;
+				return false;
+			}
+
+			return true;
+		}
+	#endif
+
+	static uint32_t uart_applied_baud(uart_dev* dev)
+	{
+	#ifdef UART_TERMIOS2
+		// Reports the rate the driver actually divided down to, custom or not.
+		struct termios2 tty2;
+
+		if (ioctl(dev->serial_port, TCGETS2, &tty2) == 0)
+		{
+			return tty2.c_ospeed;
+		}
+	#endif
+
+		struct termios tty;
+
+		if (tcgetattr(dev->serial_port, &tty) != 0)
+		{
+			return 0;
+		}
+
+		return uart_speed_to_rate(cfgetospeed(&tty));
+	}
+
+	static bool uart_verify_baud(uart_dev* dev)
+	{
+		uint32_t applied = uart_applied_baud(dev);
+		uint32_t difference = (applied > dev->baud) ? applied - dev->baud : dev->baud - applied;
+
+		// A receiver copes with a few percent of clock error, so allow what the divider rounding costs.
+		if ((uint64_t)difference * 100 > (uint64_t)dev->baud * UART_BAUD_TOLERANCE_PERCENT)
+		{
+			std::cout << "Baud rate		[failed]	Asked for " << dev->baud << " but the driver applied " << applied 
+				<< ", refusing to continue." << std::endl;
+			return false;
+		}
+
+		if (dev->verbose && applied != dev->baud)
+		{
+			std::cout << "Baud rate applied	[" << applied << "]" << std::endl;
+		}
+
+		return true;
+	}
+
 	void uart_init(uart_dev** dev)
 	{
-		*dev = (uart_dev*)malloc(sizeof(uart_dev));
+		*dev = new uart_dev(); // Has a std::string, so it needs constructing.
+		(*dev)->read_timeout_ms = UART_READ_TIMEOUT_MS;
 	}
 
 	void uart_set_baud(uart_dev* dev, uint32_t baud_rate)
@@ -41,6 +215,11 @@
 		dev->verbose = verbosity;
 	}
 
+	void uart_set_read_timeout(uart_dev* dev, uint32_t timeout_ms)
+	{
+		dev->read_timeout_ms = timeout_ms;
+	}
+
 	bool uart_open(uart_dev* dev, std::string port_name)
 	{
 		dev->port_name = port_name;
@@ -262,8 +441,8 @@
 		dev->tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
 		dev->tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
 
-		// Wait for up to 1s (VTIME=10 deciseconds), returning as soon as any data is received.
-		dev->tty.c_cc[VTIME] = VTIME_APPLIED;
+		// Never block in the driver, uart_read() waits with poll() and its own timeout.
+		dev->tty.c_cc[VTIME] = 0;
 		dev->tty.c_cc[VMIN] = 0;
 
 		if (dev->verbose)
@@ -273,95 +452,40 @@
 		
 		// Set line speed.
 		// Set in/out baud rate (defines are in termbits.h)
-		switch(dev->baud)
+		const uart_baud* standard = uart_find_baud(dev->baud);
+
+		if (standard != nullptr)
 		{
-			case 0:
-				cfsetispeed(&dev->tty, B0);
-				cfsetospeed(&dev->tty, B0);
-			break;
-			case 50:
-				cfsetispeed(&dev->tty, B50);
-				cfsetospeed(&dev->tty, B50);
-			break;
-			case 75:
-				cfsetispeed(&dev->tty, B75);
-				cfsetospeed(&dev->tty, B75);
-			break;
-			case 110:
-				cfsetispeed(&dev->tty, B110);
-				cfsetospeed(&dev->tty, B110);
-			break;
-			case 134:
-				cfsetispeed(&dev->tty, B134);
-				cfsetospeed(&dev->tty, B134);
-			break;
-			case 150:
-				cfsetispeed(&dev->tty, B150);
-				cfsetospeed(&dev->tty, B150);
-			break;
-			case 200:
-				cfsetispeed(&dev->tty, B200);
-				cfsetospeed(&dev->tty, B200);
-			break;
-			case 300:
-				cfsetispeed(&dev->tty, B300);
-				cfsetospeed(&dev->tty, B300);
-			break;
-			case 600:
-				cfsetispeed(&dev->tty, B600);
-				cfsetospeed(&dev->tty, B600);
-			break;
-			case 1200:
-				cfsetispeed(&dev->tty, B1200);
-				cfsetospeed(&dev->tty, B1200);
-			break;
-			case 1800:
-				cfsetispeed(&dev->tty, B1800);
-				cfsetospeed(&dev->tty, B1800);
-			break;
-			case 2400:
-				cfsetispeed(&dev->tty, B2400);
-				cfsetospeed(&dev->tty, B2400);
-			break;
-			case 4800:
-				cfsetispeed(&dev->tty, B4800);
-				cfsetospeed(&dev->tty, B4800);
-			break;
-			case 9600:
-				cfsetispeed(&dev->tty, B9600);
-				cfsetospeed(&dev->tty, B9600);
-			break;
-			case 19200:
-				cfsetispeed(&dev->tty, B19200);
-				cfsetospeed(&dev->tty, B19200);
-			break;
-			case 38400:
-				cfsetispeed(&dev->tty, B38400);
-				cfsetospeed(&dev->tty, B38400);
-			break;
-			case 57600:
-				cfsetispeed(&dev->tty, B57600);
-				cfsetospeed(&dev->tty, B57600);
-			break;
-			case 115200:
-				cfsetispeed(&dev->tty, B115200);
-				cfsetospeed(&dev->tty, B115200);
-			break;
-			case 230400:
-				cfsetispeed(&dev->tty, B230400);
-				cfsetospeed(&dev->tty, B230400);
-			break;
-			default:
-				cfsetispeed(&dev->tty, B115200);
-				cfsetospeed(&dev->tty, B115200);
+			cfsetispeed(&dev->tty, standard->speed);
+			cfsetospeed(&dev->tty, standard->speed);
+		}
+		else
+		{
+	#ifdef BSD
+			// The BSDs use the rate itself as the speed value, so any rate the driver can divide down to works.
+			cfsetispeed(&dev->tty, (speed_t)dev->baud);
+			cfsetospeed(&dev->tty, (speed_t)dev->baud);
+	#elif !defined(UART_TERMIOS2)
+			std::cout << "Baud rate " << dev->baud << " is not a standard rate and custom rates are unsupported on this platform." << std::endl;
+			return false;
+	#endif
 		}
-
-		// Unix options:
-		// B0,  B50,  B75,  B110,  B134,  B150,  B200, B300, B600, B1200, B1800, B2400, B4800, B9600, B19200, B38400, B57600, B115200, B230400, B460800
 
 		// Save tty settings, also checking for error
 		if (tcsetattr(dev->serial_port, TCSANOW, &dev->tty) == 0)
 		{
+	#ifdef UART_TERMIOS2
+			if (standard == nullptr && !uart_set_custom_baud(dev))
+			{
+				return false;
+			}
+	#endif
+
+			if (!uart_verify_baud(dev))
+			{
+				return false;
+			}
+
 			if (dev->verbose)
 			{
 				std::cout << "Settings saved." << std::endl << std::endl;
@@ -392,7 +516,25 @@
 	{
 		void* read_buffer = *data;
 
-		unsigned long num_bytes = read(dev->serial_port, read_buffer, bytes_to_read);
+		// Wait for up to read_timeout_ms for the first byte, returning as soon as any data is received.
+		// With no timeout the caller already knows the tty is readable, and VMIN=0 makes read() return at once anyway.
+		struct pollfd ready = { dev->serial_port, POLLIN, 0 };
+
+		if (dev->read_timeout_ms > 0 && poll(&ready, 1, (int)dev->read_timeout_ms) <= 0)
+		{
+			// Timed out, or interrupted by a signal (EINTR).
+			return 0;
+		}
+
+		ssize_t result = read(dev->serial_port, read_buffer, bytes_to_read);
+
+		if (result < 0)
+		{
+			// Interrupted by a signal (EINTR) or nothing ready (EAGAIN), treat both as nothing read.
+			return 0;
+		}
+
+		unsigned long num_bytes = (unsigned long)result;
 
 		if (num_bytes > 0)
 		{
@@ -401,13 +543,19 @@
 	#endif
 
 			// Output the data.
-			*data = &read_buffer;
+			*data = read_buffer;
 		}
 
 		// Nothing to read if num_bytes == 0.
 		return num_bytes;
 	}
 
+	void uart_drain(uart_dev* dev)
+	{
+		// Wait until everything written has gone out on the wire.
+		tcdrain(dev->serial_port);
+	}
+
 	void uart_close(uart_dev* dev)
 	{
 		if (dev->tty_opened)
@@ -431,7 +579,7 @@
 		// Free allocated memory;
 		if (dev != nullptr)
 		{
-			free(dev);
+			delete dev;
 		}
 	}
 
@@ -13,6 +13,7 @@
 #include <errno.h> // Error integer and strerror() function
 #include <termios.h> // Contains POSIX terminal control definitions
 #include <unistd.h> // write(), read(), close()
+#include <poll.h> // poll() for read deadlines
 
 //#define UART_TRACING
 
@@ -29,11 +30,10 @@ struct uart_dev
 	uint32_t data_bits;
 	std::string port_name;
     bool verbose;
+	uint32_t read_timeout_ms;
 };
 
-const uint8_t VTIME_FAST = 1; // Set VTIME_APPLIED to this if baud rate is fast enough for read to not need to wait as long.
-const uint8_t VTIME_SLOW = 10; // Set VTIME_APPLIED to this if dealing with a slow serial speed. 
-const uint8_t VTIME_APPLIED = VTIME_FAST;
+const uint32_t UART_BAUD_TOLERANCE_PERCENT = 2; // Most a driver may round the baud rate by before uart_config() fails.
 
 const bool not_modem = true;
 const bool canonical_mode = false; // If true, input is processed when new line is recieved.
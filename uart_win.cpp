@@ -6,7 +6,9 @@
 
 	void uart_init(uart_dev** dev)
 	{
-		*dev = (uart_dev*)malloc(sizeof(uart_dev));
+		*dev = new uart_dev(); // Has a std::string, so it needs constructing.
+		(*dev)->com_opened = false;
+		(*dev)->read_timeout_ms = UART_READ_TIMEOUT_MS;
 	}
 
 	void uart_set_baud(uart_dev* dev, uint32_t baud_rate)
@@ -40,6 +42,31 @@
 		dev->verbose = verbosity;
 	}
 
+	static bool uart_apply_timeouts(uart_dev* dev)
+	{
+		COMMTIMEOUTS timeout; // Timeout configuration.
+
+		// ReadFile() returns at once with whatever was received, or waits up to 
+		// read_timeout_ms for the first byte if nothing was (MAXDWORD, MAXDWORD, constant).
+		timeout.ReadIntervalTimeout = MAXDWORD;
+		timeout.ReadTotalTimeoutMultiplier = MAXDWORD;
+		timeout.ReadTotalTimeoutConstant = dev->read_timeout_ms;
+		timeout.WriteTotalTimeoutMultiplier = 1; // Value that is multiplied by the number of bytes to be sent.
+		timeout.WriteTotalTimeoutConstant = 1; // Value that is added to the WriteTotalTimeoutMultiplier multiplier.
+
+		return SetCommTimeouts(dev->win_handle, &timeout) != false;
+	}
+
+	void uart_set_read_timeout(uart_dev* dev, uint32_t timeout_ms)
+	{
+		dev->read_timeout_ms = timeout_ms;
+
+		if (dev->com_opened)
+		{
+			uart_apply_timeouts(dev);
+		}
+	}
+
 	bool uart_open(uart_dev* dev, std::string port_name)
 	{
 		dev->port_name = port_name;
@@ -107,7 +134,6 @@
 	bool uart_config(uart_dev* dev)
 	{
 		DCB conf; // tty configuration.
-		COMMTIMEOUTS timeout; // Timeout configuration.
 
 		// Apply configuration of serial communication port to current configuration.
 		if (GetCommState(dev->win_handle, &conf) != false)
@@ -223,15 +249,21 @@
 			{
 				std::cout << "Set new settings on serial port." << std::endl;
 
-				// Timeout configuration.
-				timeout.ReadIntervalTimeout = 1; // The specified timeout between each byte recieved.
-				timeout.ReadTotalTimeoutMultiplier = 1; // Value that is multiplied by the number of bytes to read.
-				timeout.ReadTotalTimeoutConstant = 1; // Value that is added to the ReadTotalTimeoutMultiplier multiplier.
-				timeout.WriteTotalTimeoutMultiplier = 1; // Value that is multiplied by the number of bytes to be sent.
-				timeout.WriteTotalTimeoutConstant = 1; // Value that is added to the WriteTotalTimeoutMultiplier multiplier.
+				// Refuse to run at a different speed than asked for, the driver may not support it.
+				DCB applied;
+				ZeroMemory(&applied, sizeof(DCB));
+				applied.DCBlength = sizeof(DCB);
+
+				if (GetCommState(dev->win_handle, &applied) == false || applied.BaudRate != dev->baud)
+				{
+					std::cout << "Baud rate		[failed]	Asked for " << dev->baud << " but the driver applied " << applied.BaudRate 
+						<< ", refusing to continue." << std::endl;
+
+					return false;
+				}
 
 				// Save the timeout configuration in the device.
-				if (SetCommTimeouts(dev->win_handle, &timeout) != false)
+				if (uart_apply_timeouts(dev))
 				{
 					if (dev->verbose)
 					{
@@ -344,6 +376,12 @@
 		return num_bytes;
 	}
 
+	void uart_drain(uart_dev* dev)
+	{
+		// Wait until everything written has gone out on the wire.
+		FlushFileBuffers(dev->win_handle);
+	}
+
 	void uart_close(uart_dev* dev)
 	{
 		if(dev->com_opened)
@@ -368,7 +406,7 @@
 		// Free allocated memory;
 		if (dev != nullptr)
 		{
-			free(dev);
+			delete dev;
 		}
 	}
 
@@ -27,6 +27,7 @@ struct uart_dev
 	uint32_t data_bits;
 	std::string port_name;
     bool verbose;
+	uint32_t read_timeout_ms;
 };
 
 std::string win32_get_error_msg(DWORD last_error);